@@ -0,0 +1,477 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "RecordField.h"
+
+namespace Bluebird
+{
+	namespace Arrow
+	{
+		// Minimal back-to-front FlatBuffers builder, just enough of the format to
+		// emit the Arrow IPC Schema and RecordBatch messages.  Bytes are pushed in
+		// reverse and flipped on Finish, so every offset is measured from the end.
+		class FlatBufferBuilder
+		{
+			private:
+
+				std::vector<std::uint8_t>							m_Reversed;
+				std::size_t											m_MinAlign;
+				std::uint32_t										m_TableStart;
+				std::vector<std::pair<std::uint16_t, std::uint32_t>>	m_TableFields;
+
+				template<typename S>
+				void PushRaw(const S& p_Value)
+				{
+					std::uint8_t l_Bytes[sizeof(S)];
+					std::memcpy(l_Bytes, &p_Value, sizeof(S));
+					for (std::size_t i(sizeof(S)); i > 0; --i)
+					{
+						m_Reversed.push_back(l_Bytes[i - 1]);
+					}
+				}
+
+				void Prep(const std::size_t& p_Align, const std::size_t& p_Additional)
+				{
+					m_MinAlign = std::max(m_MinAlign, p_Align);
+					const std::size_t l_Pad((~(m_Reversed.size() + p_Additional) + 1) & (p_Align - 1));
+					m_Reversed.insert(m_Reversed.end(), l_Pad, 0);
+				}
+
+			public:
+
+				FlatBufferBuilder()
+					:
+					m_Reversed(),
+					m_MinAlign(1),
+					m_TableStart(0),
+					m_TableFields()
+				{
+				}
+
+				const std::uint32_t Size() const noexcept
+				{
+					return static_cast<std::uint32_t>(m_Reversed.size());
+				}
+
+				template<typename S>
+				const std::uint32_t PushScalar(const S& p_Value)
+				{
+					Prep(sizeof(S), 0);
+					PushRaw(p_Value);
+					return Size();
+				}
+
+				const std::uint32_t PushOffset(const std::uint32_t& p_Target)
+				{
+					Prep(sizeof(std::uint32_t), 0);
+					PushRaw<std::uint32_t>(Size() + sizeof(std::uint32_t) - p_Target);
+					return Size();
+				}
+
+				const std::uint32_t CreateString(const std::string& p_Value)
+				{
+					Prep(sizeof(std::uint32_t), p_Value.size() + 1);
+					m_Reversed.push_back(0);
+					m_Reversed.insert(m_Reversed.end(), p_Value.rbegin(), p_Value.rend());
+					PushRaw<std::uint32_t>(static_cast<std::uint32_t>(p_Value.size()));
+					return Size();
+				}
+
+				const std::uint32_t CreateOffsetVector(const std::vector<std::uint32_t>& p_Offsets)
+				{
+					Prep(sizeof(std::uint32_t), p_Offsets.size() * sizeof(std::uint32_t));
+					for (auto l_Itr(p_Offsets.rbegin()); l_Itr != p_Offsets.rend(); ++l_Itr)
+					{
+						PushOffset(*l_Itr);
+					}
+					PushRaw<std::uint32_t>(static_cast<std::uint32_t>(p_Offsets.size()));
+					return Size();
+				}
+
+				// Vector of structs made of p_Members int64 members each (FieldNode, Buffer)
+				const std::uint32_t CreateInt64StructVector(const std::vector<std::int64_t>& p_Values, const std::size_t& p_Members)
+				{
+					const std::size_t l_Bytes(p_Values.size() * sizeof(std::int64_t));
+					Prep(sizeof(std::uint32_t), l_Bytes);
+					Prep(sizeof(std::int64_t), l_Bytes);
+					for (auto l_Itr(p_Values.rbegin()); l_Itr != p_Values.rend(); ++l_Itr)
+					{
+						PushRaw(*l_Itr);
+					}
+					PushRaw<std::uint32_t>(static_cast<std::uint32_t>(p_Values.size() / p_Members));
+					return Size();
+				}
+
+				void StartTable()
+				{
+					m_TableFields.clear();
+					m_TableStart = Size();
+				}
+
+				template<typename S>
+				void AddScalar(const std::uint16_t& p_Id, const S& p_Value)
+				{
+					m_TableFields.emplace_back(p_Id, PushScalar(p_Value));
+				}
+
+				void AddOffset(const std::uint16_t& p_Id, const std::uint32_t& p_Target)
+				{
+					m_TableFields.emplace_back(p_Id, PushOffset(p_Target));
+				}
+
+				const std::uint32_t EndTable()
+				{
+					PushScalar<std::int32_t>(0);
+					const std::uint32_t l_Table(Size());
+
+					std::uint16_t l_FieldCount(0);
+					for (const auto& l_Field : m_TableFields)
+					{
+						l_FieldCount = std::max<std::uint16_t>(l_FieldCount, l_Field.first + 1);
+					}
+
+					std::vector<std::uint16_t> l_Entries(l_FieldCount, 0);
+					for (const auto& l_Field : m_TableFields)
+					{
+						l_Entries[l_Field.first] = static_cast<std::uint16_t>(l_Table - l_Field.second);
+					}
+
+					for (auto l_Itr(l_Entries.rbegin()); l_Itr != l_Entries.rend(); ++l_Itr)
+					{
+						PushRaw(*l_Itr);
+					}
+					PushRaw<std::uint16_t>(static_cast<std::uint16_t>(l_Table - m_TableStart));
+					PushRaw<std::uint16_t>(static_cast<std::uint16_t>(4 + 2 * l_FieldCount));
+
+					// Patch the table's soffset to point back at the vtable we just wrote
+					const std::int32_t l_VTableDistance(static_cast<std::int32_t>(Size() - l_Table));
+					std::uint8_t l_Bytes[sizeof(std::int32_t)];
+					std::memcpy(l_Bytes, &l_VTableDistance, sizeof(std::int32_t));
+					for (std::size_t i(0); i < sizeof(std::int32_t); ++i)
+					{
+						m_Reversed[l_Table - 1 - i] = l_Bytes[i];
+					}
+
+					m_TableFields.clear();
+					return l_Table;
+				}
+
+				const std::vector<std::uint8_t> Finish(const std::uint32_t& p_Root)
+				{
+					Prep(m_MinAlign, sizeof(std::uint32_t));
+					PushOffset(p_Root);
+					return std::vector<std::uint8_t>(m_Reversed.rbegin(), m_Reversed.rend());
+				}
+		};
+
+		// Identifiers from the Arrow Schema.fbs and Message.fbs definitions
+		const std::int16_t	c_MetadataVersionV5(4);
+		const std::uint8_t	c_HeaderSchema(1);
+		const std::uint8_t	c_HeaderRecordBatch(3);
+		const std::uint8_t	c_TypeInt(2);
+		const std::uint8_t	c_TypeFloatingPoint(3);
+		const std::int16_t	c_PrecisionSingle(1);
+		const std::int16_t	c_PrecisionDouble(2);
+		const std::uint32_t	c_Continuation(0xFFFFFFFF);
+
+		inline const std::size_t PadTo8(const std::size_t& p_Length) noexcept
+		{
+			return (p_Length + 7) & ~static_cast<std::size_t>(7);
+		}
+
+		inline const std::uint32_t CreateMessage(
+			FlatBufferBuilder& p_Builder,
+			const std::uint8_t& p_HeaderType,
+			const std::uint32_t& p_Header,
+			const std::int64_t& p_BodyLength)
+		{
+			p_Builder.StartTable();
+			p_Builder.AddScalar<std::int64_t>(3, p_BodyLength);
+			p_Builder.AddOffset(2, p_Header);
+			p_Builder.AddScalar<std::int16_t>(0, c_MetadataVersionV5);
+			p_Builder.AddScalar<std::uint8_t>(1, p_HeaderType);
+			return p_Builder.EndTable();
+		}
+
+		inline const std::vector<std::uint8_t> BuildSchemaMessage(const RecordFields& p_Fields)
+		{
+			FlatBufferBuilder l_Builder;
+
+			std::vector<std::uint32_t> l_FieldOffsets;
+			for (const auto& l_Field : p_Fields)
+			{
+				const std::uint32_t l_Name(l_Builder.CreateString(l_Field.m_Name));
+				const std::uint32_t l_Children(l_Builder.CreateOffsetVector({}));
+
+				std::uint8_t l_TypeType(c_TypeInt);
+				l_Builder.StartTable();
+				switch (l_Field.m_Type)
+				{
+					case FieldType::Float32:
+					case FieldType::Float64:
+						l_TypeType = c_TypeFloatingPoint;
+						l_Builder.AddScalar<std::int16_t>(0, l_Field.m_Type == FieldType::Float32 ? c_PrecisionSingle : c_PrecisionDouble);
+						break;
+					default:
+					{
+						const bool l_Signed(
+							l_Field.m_Type == FieldType::Int8 || l_Field.m_Type == FieldType::Int16 ||
+							l_Field.m_Type == FieldType::Int32 || l_Field.m_Type == FieldType::Int64);
+						l_Builder.AddScalar<std::int32_t>(0, static_cast<std::int32_t>(l_Field.m_Width * 8));
+						l_Builder.AddScalar<std::uint8_t>(1, l_Signed ? 1 : 0);
+						break;
+					}
+				}
+				const std::uint32_t l_Type(l_Builder.EndTable());
+
+				l_Builder.StartTable();
+				l_Builder.AddOffset(0, l_Name);
+				l_Builder.AddOffset(3, l_Type);
+				l_Builder.AddOffset(5, l_Children);
+				l_Builder.AddScalar<std::uint8_t>(1, 0);		// nullable
+				l_Builder.AddScalar<std::uint8_t>(2, l_TypeType);
+				l_FieldOffsets.push_back(l_Builder.EndTable());
+			}
+
+			const std::uint32_t l_Fields(l_Builder.CreateOffsetVector(l_FieldOffsets));
+			l_Builder.StartTable();
+			l_Builder.AddOffset(1, l_Fields);
+			l_Builder.AddScalar<std::int16_t>(0, 0);		// Little endian
+			const std::uint32_t l_Schema(l_Builder.EndTable());
+
+			return l_Builder.Finish(CreateMessage(l_Builder, c_HeaderSchema, l_Schema, 0));
+		}
+
+		inline const std::vector<std::uint8_t> BuildRecordBatchMessage(
+			const RecordFields& p_Fields,
+			const std::int64_t& p_Rows,
+			const std::int64_t& p_BodyLength)
+		{
+			FlatBufferBuilder l_Builder;
+
+			// One FieldNode and a (validity, values) Buffer pair per column, the
+			// validity buffers being empty as nothing in a record is nullable
+			std::vector<std::int64_t> l_Nodes;
+			std::vector<std::int64_t> l_Buffers;
+			std::int64_t l_Offset(0);
+			for (const auto& l_Field : p_Fields)
+			{
+				const std::int64_t l_Length(p_Rows * static_cast<std::int64_t>(l_Field.m_Width));
+				l_Nodes.push_back(p_Rows);
+				l_Nodes.push_back(0);
+				l_Buffers.push_back(l_Offset);
+				l_Buffers.push_back(0);
+				l_Buffers.push_back(l_Offset);
+				l_Buffers.push_back(l_Length);
+				l_Offset += static_cast<std::int64_t>(PadTo8(static_cast<std::size_t>(l_Length)));
+			}
+
+			const std::uint32_t l_BufferVector(l_Builder.CreateInt64StructVector(l_Buffers, 2));
+			const std::uint32_t l_NodeVector(l_Builder.CreateInt64StructVector(l_Nodes, 2));
+			l_Builder.StartTable();
+			l_Builder.AddScalar<std::int64_t>(0, p_Rows);
+			l_Builder.AddOffset(1, l_NodeVector);
+			l_Builder.AddOffset(2, l_BufferVector);
+			const std::uint32_t l_Batch(l_Builder.EndTable());
+
+			return l_Builder.Finish(CreateMessage(l_Builder, c_HeaderRecordBatch, l_Batch, p_BodyLength));
+		}
+	}
+
+	// Exports a range of a CumulativeWriter<T> log as an Arrow IPC stream: one
+	// Schema message followed by RecordBatch messages of up to p_BatchRows
+	// rows each and the end-of-stream marker.  Batches are transposed into
+	// columns on p_Threads worker threads, then written out in record order;
+	// a batch whose thread cannot be started is built on the calling thread.
+	template<typename T>
+	class ArrowExporter
+	{
+		public:
+
+			enum class ExportStatus
+			{
+				Unknown,
+				NoFields,
+				OffsetOutOfRange,
+				ReadError,
+				StreamError,
+				BadMemoryAlloc,
+				Okay		=	255
+			};
+
+		private:
+
+			const RecordFields	m_Fields;
+			const unsigned int	m_BatchRows;
+			const unsigned int	m_Threads;
+
+			struct Batch
+			{
+				std::vector<std::uint8_t>	m_Metadata;
+				std::vector<std::uint8_t>	m_Body;
+			};
+
+			ArrowExporter() = delete;
+			ArrowExporter(const ArrowExporter&) = delete;
+
+			void BuildBatch(const T* p_Records, const std::size_t& p_Rows, Batch& p_Batch) const
+			{
+				std::size_t l_BodyLength(0);
+				for (const auto& l_Field : m_Fields)
+				{
+					l_BodyLength += Arrow::PadTo8(p_Rows * l_Field.m_Width);
+				}
+
+				p_Batch.m_Body.assign(l_BodyLength, 0);
+				std::size_t l_Offset(0);
+				for (const auto& l_Field : m_Fields)
+				{
+					GatherColumn(
+						reinterpret_cast<const std::uint8_t*>(p_Records),
+						sizeof(T),
+						p_Rows,
+						l_Field,
+						p_Batch.m_Body.data() + l_Offset);
+					l_Offset += Arrow::PadTo8(p_Rows * l_Field.m_Width);
+				}
+
+				p_Batch.m_Metadata = Arrow::BuildRecordBatchMessage(
+					m_Fields,
+					static_cast<std::int64_t>(p_Rows),
+					static_cast<std::int64_t>(l_BodyLength));
+			}
+
+			static void WriteMessage(std::ostream& p_Out, const std::vector<std::uint8_t>& p_Metadata, const std::vector<std::uint8_t>& p_Body)
+			{
+				const std::int32_t l_MetadataLength(static_cast<std::int32_t>(Arrow::PadTo8(p_Metadata.size())));
+				const char l_Padding[8] = { 0 };
+
+				p_Out.write(reinterpret_cast<const char*>(&Arrow::c_Continuation), sizeof(Arrow::c_Continuation));
+				p_Out.write(reinterpret_cast<const char*>(&l_MetadataLength), sizeof(l_MetadataLength));
+				p_Out.write(reinterpret_cast<const char*>(p_Metadata.data()), p_Metadata.size());
+				p_Out.write(l_Padding, l_MetadataLength - p_Metadata.size());
+				p_Out.write(reinterpret_cast<const char*>(p_Body.data()), p_Body.size());
+			}
+
+		public:
+
+			ArrowExporter(const RecordFields& p_Fields, const unsigned int& p_BatchRows = 65536, const unsigned int& p_Threads = 0)
+				:
+				m_Fields(p_Fields),
+				m_BatchRows(std::max(1u, p_BatchRows)),
+				m_Threads(p_Threads != 0 ? p_Threads : std::max(1u, std::thread::hardware_concurrency()))
+			{
+			}
+
+			const ExportStatus Export(
+				CumulativeWriter<T>& p_Writer,
+				const unsigned int& p_FirstRecord,
+				const unsigned int& p_Count,
+				std::ostream& p_Out) const
+			{
+				if (m_Fields.empty())
+				{
+					return ExportStatus::NoFields;
+				}
+				if (p_FirstRecord > p_Writer.RecordCount() || p_Count > p_Writer.RecordCount() - p_FirstRecord)
+				{
+					return ExportStatus::OffsetOutOfRange;
+				}
+
+				try
+				{
+					WriteMessage(p_Out, Arrow::BuildSchemaMessage(m_Fields), {});
+
+					std::vector<T> l_Records;
+					std::vector<Batch> l_Batches(m_Threads);
+					unsigned int l_Next(p_FirstRecord);
+					const unsigned int l_End(p_FirstRecord + p_Count);
+					while (l_Next < l_End)
+					{
+						// Read enough rows for one batch per worker in a single call
+						const unsigned int l_GroupRows(
+							static_cast<unsigned int>(std::min<unsigned long long>(
+								l_End - l_Next,
+								static_cast<unsigned long long>(m_BatchRows) * m_Threads)));
+						l_Records.resize(l_GroupRows);
+						if (p_Writer.ReadRecords(l_Next, l_GroupRows, l_Records.data()) != CumulativeWriter<T>::RecordReadStatus::Okay)
+						{
+							return ExportStatus::ReadError;
+						}
+
+						// Nothing a worker runs may throw out of it, and every
+						// started worker is joined before anything else can throw
+						const unsigned int l_BatchCount((l_GroupRows + m_BatchRows - 1) / m_BatchRows);
+						std::atomic<bool> l_Failed(false);
+						auto l_Build = [this, &l_Records, &l_Batches, &l_Failed, l_GroupRows](const unsigned int& p_Batch)
+						{
+							const std::size_t l_First(static_cast<std::size_t>(p_Batch) * m_BatchRows);
+							const std::size_t l_Rows(std::min<std::size_t>(m_BatchRows, l_GroupRows - l_First));
+							try
+							{
+								BuildBatch(l_Records.data() + l_First, l_Rows, l_Batches[p_Batch]);
+							}
+							catch (const std::bad_alloc&)
+							{
+								l_Failed = true;
+							}
+						};
+						std::vector<std::thread> l_Workers;
+						l_Workers.reserve(l_BatchCount);
+						for (unsigned int i(0); i < l_BatchCount; ++i)
+						{
+							try
+							{
+								l_Workers.emplace_back(l_Build, i);
+							}
+							catch (const std::system_error&)
+							{
+								l_Build(i);
+							}
+						}
+						for (auto& l_Worker : l_Workers)
+						{
+							l_Worker.join();
+						}
+						if (l_Failed)
+						{
+							return ExportStatus::BadMemoryAlloc;
+						}
+
+						for (unsigned int i(0); i < l_BatchCount; ++i)
+						{
+							WriteMessage(p_Out, l_Batches[i].m_Metadata, l_Batches[i].m_Body);
+						}
+						if (!p_Out)
+						{
+							return ExportStatus::StreamError;
+						}
+
+						l_Next += l_GroupRows;
+					}
+				}
+				catch (const std::bad_alloc&)
+				{
+					return ExportStatus::BadMemoryAlloc;
+				}
+
+				// End of stream marker
+				const std::uint32_t l_EndOfStream[2] = { Arrow::c_Continuation, 0 };
+				p_Out.write(reinterpret_cast<const char*>(l_EndOfStream), sizeof(l_EndOfStream));
+				p_Out.flush();
+
+				return p_Out ? ExportStatus::Okay : ExportStatus::StreamError;
+			}
+	};
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "RecordField.h"
+
+namespace Bluebird
+{
+	// Scans a range of a CumulativeWriter<T> in fixed size batches, each one
+	// already transposed into a packed array per field (structure of arrays)
+	// for vectorised downstream code.  The staging buffer and every column
+	// are allocated once and reused for each batch, and columns start on a
+	// c_Alignment byte boundary so they can be loaded with aligned vector
+	// loads.  Column pointers are only valid until the next call to Next().
+	template<typename T>
+	class ColumnBatchReader
+	{
+		public:
+
+			static const std::size_t	c_Alignment = 64;
+
+			enum class BatchStatus
+			{
+				Unknown,
+				EndOfRange,
+				ReadError,
+				Okay		=	255
+			};
+
+		private:
+
+			struct ColumnBuffer
+			{
+				std::vector<std::uint8_t>	m_Storage;
+				std::uint8_t*				m_Data;
+			};
+
+			CumulativeWriter<T>&		m_Writer;
+			const RecordFields			m_Fields;
+			const unsigned int			m_BatchRecords;
+			unsigned int				m_Next;
+			unsigned int				m_End;
+			unsigned int				m_BatchFirst;
+			std::size_t					m_Records;
+			std::vector<T>				m_Staging;
+			std::vector<ColumnBuffer>	m_Columns;
+
+			ColumnBatchReader() = delete;
+			ColumnBatchReader(const ColumnBatchReader&) = delete;
+
+		public:
+
+			ColumnBatchReader(
+				CumulativeWriter<T>& p_Writer,
+				const RecordFields& p_Fields,
+				const unsigned int& p_First,
+				const unsigned int& p_Count,
+				const unsigned int& p_BatchRecords = 4096)
+				:
+				m_Writer(p_Writer),
+				m_Fields(p_Fields),
+				m_BatchRecords(p_BatchRecords != 0 ? p_BatchRecords : 1),
+				m_Next(p_First),
+				m_End(p_First + p_Count),
+				m_BatchFirst(p_First),
+				m_Records(0),
+				m_Staging(m_BatchRecords),
+				m_Columns(p_Fields.size())
+			{
+				for (std::size_t i(0); i < m_Fields.size(); ++i)
+				{
+					ColumnBuffer& l_Column(m_Columns[i]);
+					l_Column.m_Storage.resize(m_BatchRecords * m_Fields[i].m_Width + c_Alignment);
+					const std::uintptr_t l_Address(reinterpret_cast<std::uintptr_t>(l_Column.m_Storage.data()));
+					l_Column.m_Data = l_Column.m_Storage.data() + (c_Alignment - l_Address % c_Alignment) % c_Alignment;
+				}
+			}
+
+			// Reads and transposes the next batch, or returns EndOfRange once the range is done
+			const BatchStatus Next()
+			{
+				m_Records = 0;
+				if (m_Next >= m_End || m_Next >= m_Writer.RecordCount())
+				{
+					return BatchStatus::EndOfRange;
+				}
+
+				const unsigned int l_Count(std::min(m_BatchRecords, std::min(m_End, m_Writer.RecordCount()) - m_Next));
+				if (m_Writer.ReadRecords(m_Next, l_Count, m_Staging.data()) != CumulativeWriter<T>::RecordReadStatus::Okay)
+				{
+					return BatchStatus::ReadError;
+				}
+
+				for (std::size_t i(0); i < m_Fields.size(); ++i)
+				{
+					GatherColumn(
+						reinterpret_cast<const std::uint8_t*>(m_Staging.data()),
+						sizeof(T),
+						l_Count,
+						m_Fields[i],
+						m_Columns[i].m_Data);
+				}
+
+				m_BatchFirst = m_Next;
+				m_Records = l_Count;
+				m_Next += l_Count;
+				return BatchStatus::Okay;
+			}
+
+			// Number of records in the current batch
+			const std::size_t& Records() const noexcept
+			{
+				return m_Records;
+			}
+
+			// Log index of the first record of the current batch
+			const unsigned int& FirstRecord() const noexcept
+			{
+				return m_BatchFirst;
+			}
+
+			const RecordFields& Fields() const noexcept
+			{
+				return m_Fields;
+			}
+
+			// Field p_Field of the current batch, or nullptr when it is not an M
+			template<typename M>
+			const M* Column(const std::size_t& p_Field) const noexcept
+			{
+				if (p_Field >= m_Fields.size() || m_Fields[p_Field].m_Type != FieldTypeOf<M>())
+				{
+					return nullptr;
+				}
+				return reinterpret_cast<const M*>(m_Columns[p_Field].m_Data);
+			}
+
+			const std::uint8_t* ColumnData(const std::size_t& p_Field) const noexcept
+			{
+				return p_Field < m_Fields.size() ? m_Columns[p_Field].m_Data : nullptr;
+			}
+	};
+
+	template<typename T> const std::size_t ColumnBatchReader<T>::c_Alignment;
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "FileUtils.h"
+
+namespace Bluebird
+{
+	// Commits appends to several CumulativeWriter files, of any record types,
+	// so after a crash either all of them or none of them are in the logs.
+	//
+	// The logs taking part are named when the coordinator is made, and given
+	// ids in that order.  A commit is two phase: first an intent record per
+	// log, holding the log's length before the append, is written to a small
+	// intent log and synced; then the records are appended to every log and
+	// made durable; then a commit record is written to the intent log.  On
+	// open, a transaction with intents but no commit record is rolled back by
+	// cutting each of its logs back to the length in its intent; committed
+	// transactions were already durable in every log, so rolling them
+	// forward needs nothing written.  The intent log is emptied once
+	// recovery is done; if a log or the intent log cannot be cut back the
+	// intents are kept for the next open and the coordinator refuses to
+	// commit, as appending past an unfinished rollback would lose data.
+	//
+	// Make the coordinator, which recovers, before opening the logs:
+	//
+	//	CommitCoordinator l_Coordinator("orders.intent", { "orders.log", "fills.log" });
+	//	CumulativeWriter<Order> l_Orders("orders.log");
+	//	CumulativeWriter<Fill> l_Fills("fills.log");
+	//	auto l_Batch(l_Coordinator.Begin());
+	//	l_Batch.Append(0, l_Orders, &l_Order, 1);
+	//	l_Batch.Append(1, l_Fills, l_NewFills.data(), 3);
+	//	l_Batch.Commit();
+	//
+	// Commits through one coordinator are serialized, and nothing else may
+	// append to the logs while one is in progress.  Every log of a commit is
+	// made durable through its own WaitForFlush, the waits running side by
+	// side, so logs sharing a FlushScheduler (see
+	// CumulativeWriter::UseFlushScheduler) share its next round rather than
+	// a sync each.  After a failed commit the logs must be closed and the
+	// coordinator made again, which rolls the partial commit back.
+	class CommitCoordinator
+	{
+		public:
+
+			struct Intent
+			{
+				std::uint32_t	m_Kind;				// c_PrepareKind or c_CommitKind
+				std::uint32_t	m_Log;
+				std::uint64_t	m_Transaction;
+				std::uint64_t	m_Offset;			// Bytes in the log before the append
+				std::uint64_t	m_Bytes;			// Bytes appended
+			};
+
+			static const std::uint32_t	c_PrepareKind = 0x50455250;		// "PREP"
+			static const std::uint32_t	c_CommitKind = 0x54494D43;		// "CMIT"
+
+			enum class RecoveryState
+			{
+				Unknown,
+				ErrorReadingIntents,
+				ErrorRollingBack,		// A log could not be cut back; nothing is committed until it is
+				ErrorClearingIntents,	// The intent log could not be emptied; likewise
+				RolledBack,			// A partial commit was undone
+				Inconsistent,		// A committed log is shorter than its intent says
+				Okay		=	255
+			};
+
+			class Batch
+			{
+				private:
+
+					struct Staged
+					{
+						unsigned int							m_Log;
+						std::uint64_t							m_Bytes;
+						std::function<std::uint64_t()>			m_Length;
+						std::function<bool()>					m_Append;
+						std::function<bool()>					m_Flush;
+					};
+
+					CommitCoordinator*		m_Coordinator;
+					std::vector<Staged>		m_Staged;
+
+					Batch() = delete;
+					Batch(const Batch&) = delete;
+
+					friend class CommitCoordinator;
+
+				public:
+
+					explicit Batch(CommitCoordinator* p_Coordinator)
+						:
+						m_Coordinator(p_Coordinator),
+						m_Staged()
+					{
+					}
+
+					Batch(Batch&& p_Other) noexcept
+						:
+						m_Coordinator(p_Other.m_Coordinator),
+						m_Staged(std::move(p_Other.m_Staged))
+					{
+						p_Other.m_Coordinator = nullptr;
+					}
+
+					// Stages p_Count records for log p_Log, which p_Writer must have opened
+					template<typename T>
+					void Append(const unsigned int& p_Log, CumulativeWriter<T>& p_Writer, const T* p_Records, const unsigned int& p_Count)
+					{
+						CumulativeWriter<T>* l_Writer(&p_Writer);
+						std::shared_ptr<std::vector<T>> l_Records(std::make_shared<std::vector<T>>(p_Records, p_Records + p_Count));
+						m_Staged.push_back(Staged{
+							p_Log,
+							static_cast<std::uint64_t>(p_Count) * sizeof(T),
+							[l_Writer]() { return static_cast<std::uint64_t>(l_Writer->RecordCount()) * l_Writer->RecordSize(); },
+							[l_Writer, l_Records]() { return l_Writer->WriteRecords(l_Records->data(), static_cast<unsigned int>(l_Records->size())); },
+							[l_Writer]() { return l_Writer->WaitForFlush(); } });
+					}
+
+					// Runs the two phases; true once the commit record is durable
+					const bool Commit()
+					{
+						if (m_Coordinator == nullptr)
+						{
+							return false;
+						}
+						CommitCoordinator* l_Coordinator(m_Coordinator);
+						m_Coordinator = nullptr;
+						return l_Coordinator->Run(m_Staged);
+					}
+			};
+
+		private:
+
+			using Intents = CumulativeWriter<Intent>;
+
+			const std::string				m_IntentFilename;
+			const std::vector<std::string>	m_Logs;
+			std::unique_ptr<Intents>		m_Intents;
+			std::uint64_t					m_NextTransaction;
+			RecoveryState					m_RecoveryState;
+			std::mutex						m_Lock;
+
+			CommitCoordinator() = delete;
+			CommitCoordinator(const CommitCoordinator&) = delete;
+
+			static const std::uint64_t FileSize(const std::string& p_Filename)
+			{
+				std::ifstream l_File(p_Filename, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+				return l_File.good() ? static_cast<std::uint64_t>(l_File.tellg()) : 0;
+			}
+
+			void Recover()
+			{
+				std::vector<Intent> l_Intents(m_Intents->RecordCount());
+				if (!l_Intents.empty() &&
+					m_Intents->ReadRecords(0, static_cast<unsigned int>(l_Intents.size()), l_Intents.data()) != Intents::RecordReadStatus::Okay)
+				{
+					m_RecoveryState = RecoveryState::ErrorReadingIntents;
+					return;
+				}
+
+				std::map<std::uint64_t, bool> l_Committed;
+				for (const auto& l_Intent : l_Intents)
+				{
+					bool& l_Done(l_Committed[l_Intent.m_Transaction]);
+					l_Done = l_Done || l_Intent.m_Kind == c_CommitKind;
+					if (l_Intent.m_Transaction >= m_NextTransaction)
+					{
+						m_NextTransaction = l_Intent.m_Transaction + 1;
+					}
+				}
+
+				m_RecoveryState = RecoveryState::Okay;
+				bool l_RolledBack(true);
+				for (const auto& l_Intent : l_Intents)
+				{
+					if (l_Intent.m_Kind != c_PrepareKind || l_Intent.m_Log >= m_Logs.size())
+					{
+						continue;
+					}
+
+					const std::string& l_Log(m_Logs[l_Intent.m_Log]);
+					const std::uint64_t l_Size(FileSize(l_Log));
+					if (l_Committed[l_Intent.m_Transaction])
+					{
+						if (l_Size < l_Intent.m_Offset + l_Intent.m_Bytes)
+						{
+							m_RecoveryState = RecoveryState::Inconsistent;
+						}
+					}
+					else if (l_Size > l_Intent.m_Offset)
+					{
+						if (!TruncateFile(l_Log, l_Intent.m_Offset))
+						{
+							l_RolledBack = false;
+						}
+						else if (m_RecoveryState == RecoveryState::Okay)
+						{
+							m_RecoveryState = RecoveryState::RolledBack;
+						}
+					}
+				}
+
+				// The intents are the only record of what to cut back, so they
+				// stay until every rollback has happened
+				if (!l_RolledBack)
+				{
+					m_RecoveryState = RecoveryState::ErrorRollingBack;
+					return;
+				}
+				if (!l_Intents.empty() || !m_Intents->WasOkayAtLoad())
+				{
+					m_Intents.reset();
+					const bool l_Cleared(TruncateFile(m_IntentFilename, 0));
+					m_Intents.reset(new Intents(m_IntentFilename));
+					if (!l_Cleared)
+					{
+						m_RecoveryState = RecoveryState::ErrorClearingIntents;
+					}
+				}
+			}
+
+			const bool Run(const std::vector<Batch::Staged>& p_Staged)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_RecoveryState == RecoveryState::ErrorReadingIntents ||
+					m_RecoveryState == RecoveryState::ErrorRollingBack ||
+					m_RecoveryState == RecoveryState::ErrorClearingIntents)
+				{
+					return false;
+				}
+				const std::uint64_t l_Transaction(m_NextTransaction++);
+
+				std::vector<Intent> l_Intents;
+				for (const auto& l_Staged : p_Staged)
+				{
+					if (l_Staged.m_Log >= m_Logs.size())
+					{
+						return false;
+					}
+					Intent l_Intent;
+					std::memset(&l_Intent, 0, sizeof(l_Intent));
+					l_Intent.m_Kind = c_PrepareKind;
+					l_Intent.m_Log = l_Staged.m_Log;
+					l_Intent.m_Transaction = l_Transaction;
+					l_Intent.m_Offset = l_Staged.m_Length();
+					l_Intent.m_Bytes = l_Staged.m_Bytes;
+					l_Intents.push_back(l_Intent);
+				}
+				if (l_Intents.empty())
+				{
+					return true;
+				}
+
+				// Phase one: the intents are durable before any log changes
+				if (!m_Intents->WriteRecords(l_Intents.data(), static_cast<unsigned int>(l_Intents.size())) ||
+					!m_Intents->WaitForFlush())
+				{
+					return false;
+				}
+
+				// Phase two: every append, every log durable, then the commit record
+				for (const auto& l_Staged : p_Staged)
+				{
+					if (!l_Staged.m_Append())
+					{
+						return false;
+					}
+				}
+
+				bool l_Flushed(true);
+				std::vector<std::future<bool>> l_Flushes;
+				for (const auto& l_Staged : p_Staged)
+				{
+					try
+					{
+						l_Flushes.push_back(std::async(std::launch::async, l_Staged.m_Flush));
+					}
+					catch (const std::system_error&)
+					{
+						l_Flushed = l_Staged.m_Flush() && l_Flushed;
+					}
+				}
+				for (auto& l_Flush : l_Flushes)
+				{
+					l_Flushed = l_Flush.get() && l_Flushed;
+				}
+				if (!l_Flushed)
+				{
+					return false;
+				}
+
+				Intent l_Commit;
+				std::memset(&l_Commit, 0, sizeof(l_Commit));
+				l_Commit.m_Kind = c_CommitKind;
+				l_Commit.m_Transaction = l_Transaction;
+				return m_Intents->Write(&l_Commit) && m_Intents->WaitForFlush();
+			}
+
+		public:
+
+			CommitCoordinator(
+				const std::string& p_IntentFilename,
+				const std::vector<std::string>& p_Logs)
+				:
+				m_IntentFilename(p_IntentFilename),
+				m_Logs(p_Logs),
+				m_Intents(new Intents(p_IntentFilename)),
+				m_NextTransaction(1),
+				m_RecoveryState(RecoveryState::Unknown),
+				m_Lock()
+			{
+				Recover();
+			}
+
+			virtual ~CommitCoordinator()
+			{
+				m_Intents->Close();
+			}
+
+			const RecoveryState& Recovery() const noexcept
+			{
+				return m_RecoveryState;
+			}
+
+			const std::vector<std::string>& Logs() const noexcept
+			{
+				return m_Logs;
+			}
+
+			Batch Begin()
+			{
+				return Batch(this);
+			}
+	};
+}
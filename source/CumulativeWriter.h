@@ -0,0 +1,1273 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <ios>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+#else
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <Windows.h>
+#endif
+
+#include "FilePool.h"
+#include "FlushScheduler.h"
+
+namespace Bluebird
+{
+#ifdef _WIN32
+	//Returns the last Win32 error, in string format. Returns an empty string if there is no error.
+	inline const std::string GetLastErrorAsString(const DWORD& p_Error)
+	{
+		std::string l_result("No Error");
+		
+		if (p_Error != 0)
+		{
+			LPSTR messageBuffer(nullptr);
+			size_t size(
+				FormatMessageA(
+					FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+					NULL,
+					p_Error,
+					MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+					(LPSTR)&messageBuffer,
+					0,
+					NULL));
+
+			l_result = std::string(messageBuffer, size);
+
+			//Free the buffer.
+			LocalFree(messageBuffer);
+		}
+
+		return l_result;
+	}
+#endif
+
+	using FileStreamPtr = std::shared_ptr<std::fstream>;
+
+	// Type T must have a public default constructor, or a private
+	// default constructor and "CumulativeWriter" defined as a friend
+	template<typename T>
+	class CumulativeWriter
+	{
+		public:
+
+			enum class Status
+			{
+				Unknown,
+				FileNotFound,
+				ReadyClosed,
+				ReadyOpen,
+				Writing,
+				Reading,
+				Closing,
+				Closed,
+				ErrorOpeningStream,
+				ErrorWriting,
+				ErrorWritingStreamNotReady,
+				ErrorSeeking,
+				ErrorReading,
+				PossibleCorruption,
+				UnableToCalculateRecords
+			};
+
+			enum class RecordReadStatus
+			{
+				Unknown,
+				OffsetOutOfRange,
+				BadMemoryAlloc,
+				StreamNotOpen,
+				StreamReadError,
+				Okay			=	255
+			};
+
+			// How soon a write must be durable.  Default follows the writer:
+			// synced straight away, or left to its flush scheduler.  Critical
+			// syncs the file before the write returns, taking any Bulk records
+			// written before it along, while Bulk rides the scheduler's next
+			// round (or, without one, the next Critical write, WaitForFlush or
+			// Close).  The file is only ever appended to, so a sync covers
+			// everything before it and records become durable in write order
+			// whatever their class.
+			enum class Durability
+			{
+				Default,
+				Critical,
+				Bulk
+			};
+
+			enum class LoadState
+			{
+				Unknown,
+				Corrupt		=	254,
+				Okay		=	255
+			};
+
+		private:
+
+			std::string		m_Filename;
+#ifdef _WIN32
+			HANDLE			m_FileStream;
+			DWORD			m_FileSizeDword;
+#else
+			FileStreamPtr		m_FileStream;
+#endif
+			Status			m_Status;
+			Status			m_PrevStatus;
+			std::mutex		m_Lock;
+			LoadState		m_LoadState;
+
+			const unsigned int	c_RecordSize;
+			unsigned int		m_RecordCount;
+
+			static const unsigned int	c_VisitRecords = 4096;		// Records per read when visiting a range
+
+		public:
+
+			// Called with the index and contents of every record once it has been
+			// appended, while the writer's lock is still held, so observers see
+			// records in order and must not call back into the writer
+			using WriteObserver = std::function<void(const unsigned int& p_RecordIndex, const T& p_Record)>;
+
+		private:
+
+			std::map<unsigned int, WriteObserver>	m_WriteObservers;
+			unsigned int							m_NextObserverId;
+
+			FlushScheduler*		m_FlushScheduler;
+			unsigned int		m_FlushId;
+
+			FilePool*			m_FilePool;
+			unsigned int		m_PoolId;
+			bool				m_Parked;			// Closed by the file pool, reopened on next use
+
+			bool				m_BulkPending;		// Bulk records written but not yet synced
+
+			CumulativeWriter() = delete;
+			CumulativeWriter(const CumulativeWriter&) = delete;
+
+		public:
+
+			CumulativeWriter(const std::string& p_Filename)
+				:
+				m_Filename(p_Filename),
+#ifdef _WIN32
+				m_FileStream(INVALID_HANDLE_VALUE),
+				m_FileSizeDword(0),
+#else
+				m_FileStream(nullptr),
+#endif
+				m_Status(Status::Unknown),
+				m_PrevStatus(m_Status),
+				m_Lock(),
+				m_LoadState(LoadState::Unknown),
+				m_RecordCount(0),
+				c_RecordSize(sizeof(T)),
+				m_WriteObservers(),
+				m_NextObserverId(0),
+				m_FlushScheduler(nullptr),
+				m_FlushId(0),
+				m_FilePool(nullptr),
+				m_PoolId(0),
+				m_Parked(false),
+				m_BulkPending(false)
+			{
+				m_Status = Status::ReadyClosed;
+				OpenFileStream();
+			}
+
+			virtual ~CumulativeWriter()
+			{
+				Close();
+			}
+
+			inline const bool FileStreamValid() const noexcept
+			{
+				return StreamOpen() || m_Parked;
+			}
+
+		private:
+
+			inline const bool StreamOpen() const noexcept
+			{
+#ifdef _WIN32
+				return m_FileStream != INVALID_HANDLE_VALUE;
+#else
+				return m_FileStream != nullptr;
+#endif
+			}
+
+			// Reopens the file if the pool parked it, keeping the cached record
+			// count rather than measuring the file again, and tells the pool the
+			// file is in use.  Called with m_Lock held.
+			const bool Unpark() noexcept
+			{
+				if (m_FilePool == nullptr)
+				{
+					return StreamOpen();
+				}
+
+				if (m_Parked)
+				{
+#ifdef _WIN32
+					m_FileStream = CreateFileA(
+						m_Filename.c_str(),
+						GENERIC_READ | GENERIC_WRITE,
+						FILE_SHARE_READ | FILE_SHARE_WRITE,
+						NULL,
+						OPEN_EXISTING,
+						FILE_ATTRIBUTE_NORMAL,
+						NULL);
+#else
+					try
+					{
+						m_FileStream = std::make_shared<std::fstream>(
+							m_Filename,
+							std::ios_base::out | std::ios_base::in | std::ios_base::app | std::ios_base::ate);
+						if (m_FileStream->is_open())
+						{
+							*m_FileStream << std::unitbuf;
+						}
+						else
+						{
+							m_FileStream = nullptr;
+						}
+					}
+					catch (const std::exception&)
+					{
+						m_FileStream = nullptr;
+					}
+#endif
+					if (!StreamOpen())
+					{
+						return false;
+					}
+					m_Parked = false;
+				}
+
+				m_FilePool->Touch(m_PoolId);
+				return true;
+			}
+
+			// Called by the file pool: closes the file unless it is in use
+			const bool TryPark() noexcept
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock, std::try_to_lock);
+				if (!l_Lock.owns_lock())
+				{
+					return false;
+				}
+
+				if (StreamOpen())
+				{
+					try
+					{
+#ifdef _WIN32
+						CloseHandle(m_FileStream);
+						m_FileStream = INVALID_HANDLE_VALUE;
+#else
+						m_FileStream->close();
+						m_FileStream = nullptr;
+#endif
+					}
+					catch (const std::exception&)
+					{
+					}
+					m_Parked = true;
+				}
+				return true;
+			}
+
+			void OpenFileStream() noexcept
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (!FileStreamValid())
+				{
+					try
+					{
+#ifdef _WIN32
+						m_FileStream = CreateFileA(
+							m_Filename.c_str(),
+							GENERIC_READ | GENERIC_WRITE,
+							FILE_SHARE_READ | FILE_SHARE_WRITE,
+							NULL,		// Default security
+							OPEN_ALWAYS,// Open or create
+							FILE_ATTRIBUTE_NORMAL, // | FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH,
+							NULL);
+#else
+						m_FileStream = std::make_shared<std::fstream>(
+							m_Filename,
+							std::ios_base::out | std::ios_base::in | std::ios_base::app | std::ios_base::ate);
+						*m_FileStream << std::unitbuf;
+#endif
+						CalculateRecordCount();
+						if (m_Status != Status::UnableToCalculateRecords)
+						{
+							m_Status = Status::ReadyOpen;
+						}
+					}
+					catch (const std::exception&)
+					{
+						m_Status = Status::ErrorOpeningStream;
+					}
+				}
+			}
+
+			void CalculateRecordCount()
+			{
+				if (FileStreamValid())
+				{
+					try
+					{
+#ifdef _WIN32
+						LARGE_INTEGER l_FileSize;
+						if (GetFileSizeEx(m_FileStream, &l_FileSize) != 0)
+						{
+							unsigned int l_fpos(static_cast<unsigned int>(l_FileSize.QuadPart));
+#else
+							auto l_fpos(m_FileStream->tellg());
+							//std::fpos_t l_fpos(l_Pos);
+#endif
+							m_RecordCount = static_cast<unsigned int>(l_fpos) / c_RecordSize;
+
+							auto l_Remainder(l_fpos % c_RecordSize);
+							if (l_Remainder == 0)
+							{
+								m_LoadState = LoadState::Okay;
+							}
+							else
+							{
+								//std::cout << "There are [" << l_fpos << "bytes] in the file which is [" << m_RecordCount << "] full records and [" << l_Remainder << "bytes] remaining" << std::endl;
+								m_LoadState = LoadState::Corrupt;
+							}							
+#ifdef _WIN32
+						}					
+						else
+						{
+							m_LoadState = LoadState::Corrupt;
+						}
+#endif
+					}
+					catch (const std::exception&)
+					{
+						m_Status = Status::UnableToCalculateRecords;
+					}
+				}
+			}
+
+			// Makes appended data durable as p_Durability asks: straight away, or
+			// by handing the file to the flush scheduler when one is in use
+			void SyncWritten(const Durability& p_Durability) noexcept
+			{
+				if (p_Durability != Durability::Critical && m_FlushScheduler != nullptr)
+				{
+					m_FlushScheduler->MarkDirty(m_FlushId);
+					return;
+				}
+				if (p_Durability == Durability::Bulk)
+				{
+					m_BulkPending = true;
+					return;
+				}
+#ifdef _WIN32
+				FlushFileBuffers(m_FileStream);
+#else
+				sync();
+#endif
+				m_BulkPending = false;
+			}
+
+			void NotifyWriteObservers(const unsigned int& p_FirstRecord, const T* p_Records, const unsigned int& p_Count) noexcept
+			{
+				for (auto& l_Observer : m_WriteObservers)
+				{
+					try
+					{
+						for (unsigned int i(0); i < p_Count; ++i)
+						{
+							l_Observer.second(p_FirstRecord + i, p_Records[i]);
+						}
+					}
+					catch (const std::exception&)
+					{
+					}
+				}
+			}
+
+			// ReadRecords with m_Lock already held
+			const RecordReadStatus ReadRecordsLocked(const unsigned int& p_FirstRecord, const unsigned int& p_Count, T* p_Out) noexcept
+			{
+				RecordReadStatus l_resultCode(RecordReadStatus::Unknown);
+
+				if (p_Count == 0)
+				{
+					l_resultCode = RecordReadStatus::Okay;
+				}
+				else if (p_FirstRecord < m_RecordCount && p_Count <= m_RecordCount - p_FirstRecord)
+				{
+					m_PrevStatus = m_Status;
+					m_Status = Status::Reading;
+
+					try
+					{
+						if (!Unpark())
+						{
+							throw std::runtime_error("Unable to reopen");
+						}
+#ifdef _WIN32
+						LARGE_INTEGER l_NewFilePosition;
+						LARGE_INTEGER l_SeekPos;
+						l_SeekPos.QuadPart = static_cast<LONGLONG>(p_FirstRecord) * c_RecordSize;
+						if (SetFilePointerEx(
+							m_FileStream,
+							l_SeekPos,
+							&l_NewFilePosition,
+							FILE_BEGIN) != 0)
+						{
+							DWORD l_BytesRead(0);
+							const DWORD l_Length(p_Count * c_RecordSize);
+							if (ReadFile(
+								m_FileStream,
+								p_Out,
+								l_Length,
+								&l_BytesRead,
+								NULL) != 0 && l_BytesRead == l_Length)
+							{
+								m_Status = m_PrevStatus;
+								l_resultCode = RecordReadStatus::Okay;
+							}
+							else
+							{
+								m_Status = Status::ErrorReading;
+								throw std::exception("Read Error");
+							}
+						}
+						else
+						{
+							m_Status = Status::ErrorSeeking;
+							throw std::exception("Seeking Error");
+						}
+#else
+						const std::streamsize l_Length(static_cast<std::streamsize>(p_Count) * c_RecordSize);
+						std::streampos l_SeekPos(static_cast<std::streamoff>(p_FirstRecord) * c_RecordSize);
+						m_FileStream->seekg(l_SeekPos);
+						m_FileStream->read(
+							reinterpret_cast<char*>(p_Out),
+							l_Length);
+						if (m_FileStream->gcount() == l_Length)
+						{
+							m_Status = m_PrevStatus;
+							l_resultCode = RecordReadStatus::Okay;
+						}
+						else
+						{
+							m_FileStream->clear();
+							m_Status = Status::ErrorReading;
+							l_resultCode = RecordReadStatus::StreamReadError;
+						}
+#endif
+					}
+					catch (const std::exception&)
+					{
+						l_resultCode = RecordReadStatus::StreamReadError;
+					}
+				}
+				else
+				{
+					l_resultCode = RecordReadStatus::OffsetOutOfRange;
+				}
+
+				return l_resultCode;
+			}
+
+		public:
+
+			using TPtr = std::shared_ptr<T>;
+			using ReadRecordResult = std::pair<RecordReadStatus, TPtr>;
+
+			// Reads p_Count records from p_FirstRecord a block at a time through
+			// p_Read(first, count, out), calling p_Visit(index, record) for each.
+			// The one catch-up loop shared by the writer and the logs built on it
+			template<typename R, typename V>
+			static const RecordReadStatus VisitRecords(const unsigned int& p_FirstRecord, const unsigned int& p_Count, R p_Read, V& p_Visit)
+			{
+				// Copied, as a visitor may update what the arguments refer to
+				const unsigned int l_First(p_FirstRecord);
+				const unsigned int l_Total(p_Count);
+				try
+				{
+					std::vector<T> l_Block;
+					for (unsigned int l_Done(0); l_Done < l_Total;)
+					{
+						l_Block.resize(std::min(l_Total - l_Done, c_VisitRecords));
+						const unsigned int l_Count(static_cast<unsigned int>(l_Block.size()));
+						const RecordReadStatus l_resultCode(p_Read(l_First + l_Done, l_Count, l_Block.data()));
+						if (l_resultCode != RecordReadStatus::Okay)
+						{
+							return l_resultCode;
+						}
+						for (unsigned int i(0); i < l_Count; ++i)
+						{
+							p_Visit(l_First + l_Done + i, l_Block[i]);
+						}
+						l_Done += l_Count;
+					}
+					return RecordReadStatus::Okay;
+				}
+				catch (const std::bad_alloc&)
+				{
+					return RecordReadStatus::BadMemoryAlloc;
+				}
+			}
+
+			const ReadRecordResult ReadRecord(const unsigned int& p_RecordOffset) noexcept
+			{
+				RecordReadStatus l_resultCode(RecordReadStatus::Unknown);
+				std::shared_ptr<T> l_result(nullptr);
+
+				if (FileStreamValid())
+				{
+					try
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						if (p_RecordOffset < m_RecordCount)
+						{
+							m_PrevStatus = m_Status;
+							m_Status = Status::Reading;
+
+							l_result = std::shared_ptr<T>(new T());
+							
+							try
+							{
+								if (!Unpark())
+								{
+									throw std::runtime_error("Unable to reopen");
+								}
+#ifdef _WIN32							
+								LARGE_INTEGER l_NewFilePosition;
+								LARGE_INTEGER l_SeekPos{ p_RecordOffset * c_RecordSize };
+								if (SetFilePointerEx(
+									m_FileStream,
+									l_SeekPos,
+									&l_NewFilePosition,
+									FILE_BEGIN) != 0)
+								{
+									OVERLAPPED l_Overlapped{ 0 };
+									if (ReadFileEx(
+										m_FileStream,
+										l_result.get(),
+										c_RecordSize,
+										&l_Overlapped,
+										CompletionRoutine) != 0)
+									{										
+										m_Status = m_PrevStatus;
+										l_resultCode = RecordReadStatus::Okay;
+									}
+									else
+									{
+										m_Status = Status::ErrorReading;
+										throw std::exception("Read Error");
+									}
+								}
+								else
+								{
+									m_Status = Status::ErrorSeeking;
+									throw std::exception("Seeking Error");
+								}
+#else
+								std::streampos l_SeekPos(p_RecordOffset * c_RecordSize);
+								m_FileStream->seekg(l_SeekPos);
+								m_FileStream->read(
+									reinterpret_cast<char*>(l_result.get()),
+									c_RecordSize);
+								m_Status = m_PrevStatus;
+								l_resultCode = RecordReadStatus::Okay;
+#endif
+							}
+							catch (const std::exception&)
+							{
+								l_resultCode = RecordReadStatus::StreamReadError;
+							}
+						}
+						else
+						{
+							l_resultCode = RecordReadStatus::OffsetOutOfRange;
+						}
+					}
+					catch (const std::bad_alloc&)
+					{
+						l_resultCode = RecordReadStatus::BadMemoryAlloc;
+					}
+				}
+				else
+				{
+					l_resultCode = RecordReadStatus::StreamNotOpen;
+				}
+
+				return std::make_pair(l_resultCode, l_result);
+			}
+
+			// Reads p_Count consecutive records starting at p_FirstRecord into the
+			// caller's buffer with one seek and one read, instead of one per record
+			const RecordReadStatus ReadRecords(const unsigned int& p_FirstRecord, const unsigned int& p_Count, T* p_Out) noexcept
+			{
+				if (!FileStreamValid())
+				{
+					return RecordReadStatus::StreamNotOpen;
+				}
+
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return ReadRecordsLocked(p_FirstRecord, p_Count, p_Out);
+			}
+
+			// Reads p_Count records from p_FirstRecord a block at a time, calling
+			// p_Visit(index, record) for each.  The lock is only held per block read
+			template<typename V>
+			const RecordReadStatus ForEachRecord(const unsigned int& p_FirstRecord, const unsigned int& p_Count, V p_Visit)
+			{
+				return VisitRecords(
+					p_FirstRecord,
+					p_Count,
+					[this](const unsigned int& p_First, const unsigned int& p_Records, T* p_Out)
+					{
+						return ReadRecords(p_First, p_Records, p_Out);
+					},
+					p_Visit);
+			}
+
+			const ReadRecordResult LoadLastRecord() noexcept
+			{
+				return ReadRecord(m_RecordCount - 1);
+			}
+
+			// Reads the last p_Count records (or all of them, if fewer) newest
+			// first, with a single read of the tail of the file.  The count and
+			// the read are taken under one hold of the lock, so a concurrent
+			// append cannot shift the tail in between
+			const RecordReadStatus ReadLast(const unsigned int& p_Count, std::vector<T>& p_Out) noexcept
+			{
+				if (!FileStreamValid())
+				{
+					p_Out.clear();
+					return RecordReadStatus::StreamNotOpen;
+				}
+
+				try
+				{
+					std::unique_lock<std::mutex> l_Lock(m_Lock);
+					const unsigned int l_Count(std::min(p_Count, m_RecordCount));
+					p_Out.resize(l_Count);
+					const RecordReadStatus l_resultCode(ReadRecordsLocked(m_RecordCount - l_Count, l_Count, p_Out.data()));
+					l_Lock.unlock();
+					if (l_resultCode == RecordReadStatus::Okay)
+					{
+						std::reverse(p_Out.begin(), p_Out.end());
+					}
+					else
+					{
+						p_Out.clear();
+					}
+					return l_resultCode;
+				}
+				catch (const std::bad_alloc&)
+				{
+					return RecordReadStatus::BadMemoryAlloc;
+				}
+			}
+
+			// Reads the records at p_Count arbitrary indices into p_Out, in the
+			// order requested.  The indices are sorted and those close together
+			// coalesced into single reads, which are then spread over
+			// p_Threads threads (0 for one per core).  The reads are positional
+			// reads on a handle of their own, so beyond reading the record count
+			// they neither take the writer's lock nor queue behind each other.
+			// That handle is opened for the call and closed before it returns;
+			// it is not counted by the writer's FilePool, so allow one more open
+			// file per concurrent ReadMany when sizing the pool.
+			const RecordReadStatus ReadMany(
+				const unsigned int* p_Indices,
+				const std::size_t& p_Count,
+				T* p_Out,
+				const unsigned int& p_Threads = 0) noexcept
+			{
+				static const unsigned int c_MaxRunBytes = 1u << 20;		// Largest single read
+				static const unsigned int c_MaxGapBytes = 64u * 1024u;	// Read through gaps up to this size
+
+				if (p_Count == 0)
+				{
+					return RecordReadStatus::Okay;
+				}
+				if (!FileStreamValid())
+				{
+					return RecordReadStatus::StreamNotOpen;
+				}
+
+				try
+				{
+					unsigned int l_Total(0);
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						l_Total = m_RecordCount;
+					}
+					std::vector<std::size_t> l_Order(p_Count);
+					for (std::size_t i(0); i < p_Count; ++i)
+					{
+						if (p_Indices[i] >= l_Total)
+						{
+							return RecordReadStatus::OffsetOutOfRange;
+						}
+						l_Order[i] = i;
+					}
+					std::sort(
+						l_Order.begin(),
+						l_Order.end(),
+						[p_Indices](const std::size_t& p_Left, const std::size_t& p_Right) { return p_Indices[p_Left] < p_Indices[p_Right]; });
+
+					// Each run covers l_Order[first, last) with one read
+					const unsigned int l_MaxRun(std::max(1u, c_MaxRunBytes / c_RecordSize));
+					const unsigned int l_MaxGap(c_MaxGapBytes / c_RecordSize);
+					std::vector<std::pair<std::size_t, std::size_t>> l_Runs;
+					for (std::size_t l_First(0); l_First < p_Count;)
+					{
+						const unsigned int l_Start(p_Indices[l_Order[l_First]]);
+						std::size_t l_Last(l_First + 1);
+						while (l_Last < p_Count &&
+							p_Indices[l_Order[l_Last]] - p_Indices[l_Order[l_Last - 1]] <= l_MaxGap + 1 &&
+							p_Indices[l_Order[l_Last]] - l_Start < l_MaxRun)
+						{
+							++l_Last;
+						}
+						l_Runs.push_back(std::make_pair(l_First, l_Last));
+						l_First = l_Last;
+					}
+
+					// Closes the handle however the read ends
+					struct FileCloser
+					{
+#ifdef _WIN32
+						HANDLE	m_File;
+						~FileCloser() { CloseHandle(m_File); }
+#else
+						int		m_File;
+						~FileCloser() { ::close(m_File); }
+#endif
+					};
+
+#ifdef _WIN32
+					HANDLE l_File(CreateFileA(
+						m_Filename.c_str(),
+						GENERIC_READ,
+						FILE_SHARE_READ | FILE_SHARE_WRITE,
+						NULL,
+						OPEN_EXISTING,
+						FILE_ATTRIBUTE_NORMAL,
+						NULL));
+					if (l_File == INVALID_HANDLE_VALUE)
+					{
+						return RecordReadStatus::StreamNotOpen;
+					}
+#else
+					const int l_File(::open(m_Filename.c_str(), O_RDONLY));
+					if (l_File < 0)
+					{
+						return RecordReadStatus::StreamNotOpen;
+					}
+#endif
+					const FileCloser l_Closer{ l_File };
+
+					std::atomic<std::size_t> l_NextRun(0);
+					std::atomic<bool> l_Failed(false);
+					auto l_Worker = [&]()
+					{
+						std::vector<char> l_Buffer;
+						for (std::size_t l_Run(l_NextRun++); l_Run < l_Runs.size() && !l_Failed; l_Run = l_NextRun++)
+						{
+							const std::size_t l_First(l_Runs[l_Run].first);
+							const std::size_t l_Last(l_Runs[l_Run].second);
+							const unsigned int l_Start(p_Indices[l_Order[l_First]]);
+							const std::size_t l_Length(static_cast<std::size_t>(p_Indices[l_Order[l_Last - 1]] - l_Start + 1) * c_RecordSize);
+							const unsigned long long l_Offset(static_cast<unsigned long long>(l_Start) * c_RecordSize);
+							try
+							{
+								l_Buffer.resize(l_Length);
+							}
+							catch (const std::bad_alloc&)
+							{
+								l_Failed = true;
+								break;
+							}
+#ifdef _WIN32
+							OVERLAPPED l_Overlapped{ 0 };
+							l_Overlapped.Offset = static_cast<DWORD>(l_Offset);
+							l_Overlapped.OffsetHigh = static_cast<DWORD>(l_Offset >> 32);
+							DWORD l_BytesRead(0);
+							const bool l_Read(
+								ReadFile(l_File, l_Buffer.data(), static_cast<DWORD>(l_Length), &l_BytesRead, &l_Overlapped) != 0 &&
+								l_BytesRead == l_Length);
+#else
+							const bool l_Read(::pread(l_File, l_Buffer.data(), l_Length, static_cast<off_t>(l_Offset)) == static_cast<ssize_t>(l_Length));
+#endif
+							if (!l_Read)
+							{
+								l_Failed = true;
+								break;
+							}
+							for (std::size_t i(l_First); i < l_Last; ++i)
+							{
+								std::memcpy(
+									reinterpret_cast<char*>(p_Out + l_Order[i]),
+									l_Buffer.data() + static_cast<std::size_t>(p_Indices[l_Order[i]] - l_Start) * c_RecordSize,
+									c_RecordSize);
+							}
+						}
+					};
+
+					// Reserved up front so no allocation can throw once a thread is running
+					const unsigned int l_Threads(std::min<std::size_t>(
+						l_Runs.size(),
+						p_Threads != 0 ? p_Threads : std::max(1u, std::thread::hardware_concurrency())));
+					std::vector<std::thread> l_Workers;
+					l_Workers.reserve(l_Threads);
+					for (unsigned int i(1); i < l_Threads; ++i)
+					{
+						try
+						{
+							l_Workers.emplace_back(l_Worker);
+						}
+						catch (const std::system_error&)
+						{
+							break;
+						}
+					}
+					l_Worker();
+					for (auto& l_Thread : l_Workers)
+					{
+						l_Thread.join();
+					}
+					return l_Failed ? RecordReadStatus::StreamReadError : RecordReadStatus::Okay;
+				}
+				catch (const std::bad_alloc&)
+				{
+					return RecordReadStatus::BadMemoryAlloc;
+				}
+				catch (const std::exception&)
+				{
+					return RecordReadStatus::StreamReadError;
+				}
+			}
+
+			const unsigned int& RecordCount() const noexcept
+			{
+				return m_RecordCount;
+			}
+
+			// RecordCount read under the writer's lock, for callers racing writers
+			const unsigned int LockedRecordCount()
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return m_RecordCount;
+			}
+
+			const unsigned int& RecordSize() const noexcept
+			{
+				return c_RecordSize;
+			}
+
+			const std::string& Filename() const noexcept
+			{
+				return m_Filename;
+			}
+
+			// Registers an observer of appended records, returning its id for removal
+			const unsigned int AddWriteObserver(const WriteObserver& p_Observer)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				m_WriteObservers[m_NextObserverId] = p_Observer;
+				return m_NextObserverId++;
+			}
+
+			// Feeds p_Observer every record from p_FirstRecord on and then
+			// registers it, all under the writer's lock, so it sees each record
+			// exactly once however many threads are writing.  Nothing is
+			// registered unless the catch-up read succeeds.  The observer's owner
+			// must not hold a lock of its own that a write observer also takes
+			const RecordReadStatus AddWriteObserver(const WriteObserver& p_Observer, const unsigned int& p_FirstRecord, unsigned int& p_ObserverId)
+			{
+				try
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					if (p_FirstRecord > m_RecordCount)
+					{
+						return RecordReadStatus::OffsetOutOfRange;
+					}
+					if (p_FirstRecord < m_RecordCount && !FileStreamValid())
+					{
+						return RecordReadStatus::StreamNotOpen;
+					}
+
+					const RecordReadStatus l_resultCode(VisitRecords(
+						p_FirstRecord,
+						m_RecordCount - p_FirstRecord,
+						[this](const unsigned int& p_First, const unsigned int& p_Records, T* p_Out)
+						{
+							return ReadRecordsLocked(p_First, p_Records, p_Out);
+						},
+						p_Observer));
+					if (l_resultCode == RecordReadStatus::Okay)
+					{
+						m_WriteObservers[m_NextObserverId] = p_Observer;
+						p_ObserverId = m_NextObserverId++;
+					}
+					return l_resultCode;
+				}
+				catch (const std::bad_alloc&)
+				{
+					return RecordReadStatus::BadMemoryAlloc;
+				}
+			}
+
+			void RemoveWriteObserver(const unsigned int& p_ObserverId)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				m_WriteObservers.erase(p_ObserverId);
+			}
+
+			const LoadState& LoadState() const noexcept
+			{
+				return m_LoadState;
+			}
+
+			const bool WasCorruptAtLoad() const noexcept
+			{
+				return m_LoadState == LoadState::Corrupt;
+			}
+
+			const bool WasOkayAtLoad() const noexcept
+			{
+				return m_LoadState == LoadState::Okay;
+			}
+
+			const bool Closing() const noexcept
+			{
+				return m_Status == Status::Closing || m_Status == Status::Closed;
+			}
+
+			void Close() noexcept
+			{
+				m_Status = Status::Closing;
+
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_BulkPending && Unpark())
+				{
+					SyncWritten(Durability::Critical);
+				}
+
+				if (StreamOpen())
+				{
+					try
+					{
+#ifdef _WIN32
+						CloseHandle(m_FileStream);
+						m_FileStream = INVALID_HANDLE_VALUE;
+#else
+						m_FileStream->close();
+						m_FileStream = nullptr;
+#endif
+					}
+					catch (const std::exception&)
+					{
+					}
+				}
+
+				m_Parked = false;
+				if (m_FilePool != nullptr)
+				{
+					m_FilePool->Unregister(m_PoolId);
+					m_FilePool = nullptr;
+				}
+
+				if (m_FlushScheduler != nullptr)
+				{
+					m_FlushScheduler->Unregister(m_FlushId);
+					m_FlushScheduler = nullptr;
+				}
+
+				m_Status = Status::Closed;
+			}
+
+			// Lets p_Pool close this writer's file while it is idle, to cap the
+			// files open across many writers.  The file is reopened on its next
+			// read or write, appending at the end already known.  The handle a
+			// flush scheduler keeps for the file is counted by p_Pool as well.
+			void UseFilePool(FilePool& p_Pool = FilePool::Instance())
+			{
+				FlushScheduler* l_Scheduler(nullptr);
+				unsigned int l_PreviousFlushId(0);
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					if (m_FilePool != nullptr)
+					{
+						m_FilePool->Unregister(m_PoolId);
+					}
+					m_PoolId = p_Pool.Register([this]() { return TryPark(); });
+					m_FilePool = &p_Pool;
+					if (StreamOpen())
+					{
+						p_Pool.Touch(m_PoolId);
+					}
+
+					if (m_FlushScheduler != nullptr)
+					{
+						l_Scheduler = m_FlushScheduler;
+						l_PreviousFlushId = m_FlushId;
+						m_FlushId = m_FlushScheduler->Register(m_Filename, &p_Pool);
+					}
+				}
+
+				// Unregistering may sync, and so ask the pool to park this writer
+				if (l_Scheduler != nullptr)
+				{
+					l_Scheduler->Unregister(l_PreviousFlushId);
+				}
+			}
+
+			// Leaves syncing appended records to p_Scheduler, which batches the
+			// syncs of every file using it, rather than syncing on every write.
+			// Records are then durable once WaitForFlush returns.
+			void UseFlushScheduler(FlushScheduler& p_Scheduler = FlushScheduler::Instance())
+			{
+				FlushScheduler* l_Previous(nullptr);
+				unsigned int l_PreviousFlushId(0);
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					l_Previous = m_FlushScheduler;
+					l_PreviousFlushId = m_FlushId;
+					m_FlushId = p_Scheduler.Register(m_Filename, m_FilePool);
+					m_FlushScheduler = &p_Scheduler;
+				}
+
+				// Unregistering may sync, and so ask the pool to park this writer
+				if (l_Previous != nullptr)
+				{
+					l_Previous->Unregister(l_PreviousFlushId);
+				}
+			}
+
+			// Blocks until every record written so far is durable
+			const bool WaitForFlush()
+			{
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					if (m_BulkPending && Unpark())
+					{
+						SyncWritten(Durability::Critical);
+					}
+				}
+				FlushScheduler* l_Scheduler(m_FlushScheduler);
+				return l_Scheduler == nullptr || l_Scheduler->WaitForFlush();
+			}
+
+#ifdef _WIN32
+			static void WINAPI CompletionRoutine(DWORD u32_ErrorCode, DWORD u32_BytesTransfered, OVERLAPPED* pk_Overlapped)
+			{
+				// Purposefully empty function
+			}
+#endif
+
+			const bool Write(const T* p_Record, const Durability& p_Durability = Durability::Default) noexcept
+			{
+				bool l_result(false);
+
+				if (!Closing())
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_PrevStatus = m_Status;
+
+					if (FileStreamValid())
+					{
+						m_Status = Status::Writing;
+						try
+						{
+							if (!Unpark())
+							{
+								throw std::runtime_error("Unable to reopen");
+							}
+#ifdef _WIN32
+							LARGE_INTEGER l_NewFilePointer;
+							if (SetFilePointerEx(
+								m_FileStream,
+								{ 0 },
+								&l_NewFilePointer,
+								FILE_END) != 0)
+							{
+								OVERLAPPED l_Overlapped{ 0 };
+								if (WriteFileEx(
+									m_FileStream,
+									p_Record,
+									c_RecordSize,
+									&l_Overlapped,
+									CompletionRoutine) != 0)
+								{
+									SyncWritten(p_Durability);
+									++m_RecordCount;
+									m_Status = m_PrevStatus;
+									l_result = true;
+								}
+								else
+								{
+									auto l_GLE(GetLastError());
+									if (l_GLE != ERROR_IO_PENDING)
+									{
+										std::cout << GetLastErrorAsString(l_GLE).c_str() << std::endl;
+										throw std::exception("Unable to Write");
+									}
+								}
+							}
+							else
+							{
+								auto l_GLE(GetLastError());
+								if (l_GLE != ERROR_IO_PENDING)
+								{
+									std::cout << GetLastErrorAsString(l_GLE).c_str() << std::endl;
+									throw std::exception("Unable to Seek");
+								}
+							}
+#else
+							*m_FileStream << std::unitbuf;
+							m_FileStream->seekp(0, std::ios_base::end);
+							m_FileStream->write(reinterpret_cast<const char*>(p_Record), c_RecordSize);
+							m_FileStream->sync();
+							SyncWritten(p_Durability);
+							++m_RecordCount;
+							m_Status = m_PrevStatus;
+							l_result = true;
+#endif														
+							if (l_result)
+							{
+								NotifyWriteObservers(m_RecordCount - 1, p_Record, 1);
+							}
+						}
+						catch (const std::exception&)
+						{
+							m_Status = Status::ErrorWriting;
+						}
+					}
+					else
+					{
+						m_Status = Status::ErrorWritingStreamNotReady;
+					}
+				}
+
+				return l_result;
+			}
+
+			// Appends p_Count records with a single write and a single flush,
+			// so a batch pays the durability cost of one record
+			const bool WriteRecords(const T* p_Records, const unsigned int& p_Count, const Durability& p_Durability = Durability::Default) noexcept
+			{
+				bool l_result(false);
+
+				if (p_Count == 0)
+				{
+					return true;
+				}
+
+				if (!Closing())
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_PrevStatus = m_Status;
+
+					if (FileStreamValid())
+					{
+						m_Status = Status::Writing;
+						try
+						{
+							if (!Unpark())
+							{
+								throw std::runtime_error("Unable to reopen");
+							}
+#ifdef _WIN32
+							LARGE_INTEGER l_NewFilePointer;
+							if (SetFilePointerEx(
+								m_FileStream,
+								{ 0 },
+								&l_NewFilePointer,
+								FILE_END) != 0)
+							{
+								DWORD l_BytesWritten(0);
+								const DWORD l_Length(p_Count * c_RecordSize);
+								if (WriteFile(
+									m_FileStream,
+									p_Records,
+									l_Length,
+									&l_BytesWritten,
+									NULL) != 0 && l_BytesWritten == l_Length)
+								{
+									SyncWritten(p_Durability);
+									m_RecordCount += p_Count;
+									m_Status = m_PrevStatus;
+									l_result = true;
+								}
+								else
+								{
+									std::cout << GetLastErrorAsString(GetLastError()).c_str() << std::endl;
+									throw std::exception("Unable to Write");
+								}
+							}
+							else
+							{
+								std::cout << GetLastErrorAsString(GetLastError()).c_str() << std::endl;
+								throw std::exception("Unable to Seek");
+							}
+#else
+							*m_FileStream << std::unitbuf;
+							m_FileStream->seekp(0, std::ios_base::end);
+							m_FileStream->write(
+								reinterpret_cast<const char*>(p_Records),
+								static_cast<std::streamsize>(p_Count) * c_RecordSize);
+							m_FileStream->sync();
+							SyncWritten(p_Durability);
+							m_RecordCount += p_Count;
+							m_Status = m_PrevStatus;
+							l_result = true;
+#endif
+							if (l_result)
+							{
+								NotifyWriteObservers(m_RecordCount - p_Count, p_Records, p_Count);
+							}
+						}
+						catch (const std::exception&)
+						{
+							m_Status = Status::ErrorWriting;
+						}
+					}
+					else
+					{
+						m_Status = Status::ErrorWritingStreamNotReady;
+					}
+				}
+
+				return l_result;
+			}
+	};
+
+	template<typename T> const unsigned int CumulativeWriter<T>::c_VisitRecords;
+
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "LogMerger.h"
+
+namespace Bluebird
+{
+	// Re-orders a log by the key member K T::* into a new log while holding no
+	// more than roughly p_MemoryBudget bytes of records at a time.
+	//
+	// The input is consumed in runs that fit the budget; each run is split
+	// across the worker threads and sorted in memory (LSD radix sort for
+	// integral keys, std::stable_sort otherwise), the sorted pieces are
+	// spilled to temporary run logs and finally LogMerger combines them into
+	// the output.  At most c_MaxFanIn runs are open and merged at once; with
+	// more, consecutive groups are merged into longer runs first, pass by
+	// pass.  The sort is stable, records with equal keys keep their original
+	// relative order, and floating point NaN keys sort after all others.
+	template<typename T, typename K>
+	class ExternalSorter
+	{
+		static_assert(
+			!std::is_same<typename std::remove_cv<K>::type, bool>::value,
+			"Sort keys must be integral types other than bool (radix sorted) or types ordered by operator<, such as floating point");
+
+		public:
+
+			enum class SortStatus
+			{
+				Unknown,
+				BudgetTooSmall,
+				ReadError,
+				WriteError,
+				Okay		=	255
+			};
+
+		private:
+
+			static const std::size_t	c_MaxFanIn = 64;		// Runs merged at once
+
+			using RunLog = std::unique_ptr<CumulativeWriter<T>>;
+
+			K T::*				m_Key;
+			const std::size_t	m_MemoryBudget;
+			const unsigned int	m_Threads;
+			const std::string	m_TempPrefix;
+
+			ExternalSorter() = delete;
+			ExternalSorter(const ExternalSorter&) = delete;
+
+			// Order preserving map of an integral key onto an unsigned radix
+			template<typename I>
+			static const typename std::make_unsigned<I>::type RadixKey(const I& p_Key) noexcept
+			{
+				using U = typename std::make_unsigned<I>::type;
+				return std::is_signed<I>::value
+					? static_cast<U>(static_cast<U>(p_Key) ^ (static_cast<U>(1) << (sizeof(I) * 8 - 1)))
+					: static_cast<U>(p_Key);
+			}
+
+			void SortRun(T* p_Begin, T* p_End, T* p_Scratch, std::true_type) const
+			{
+				const std::size_t l_Count(static_cast<std::size_t>(p_End - p_Begin));
+				T* l_From(p_Begin);
+				T* l_To(p_Scratch);
+
+				for (std::size_t l_Shift(0); l_Shift < sizeof(K) * 8; l_Shift += 8)
+				{
+					std::size_t l_Buckets[257] = { 0 };
+					for (std::size_t i(0); i < l_Count; ++i)
+					{
+						++l_Buckets[((RadixKey(l_From[i].*m_Key) >> l_Shift) & 0xFF) + 1];
+					}
+
+					// Every key sharing this byte, nothing to reorder on this pass
+					if (std::find(l_Buckets + 1, l_Buckets + 257, l_Count) != l_Buckets + 257)
+					{
+						continue;
+					}
+
+					for (std::size_t b(1); b < 257; ++b)
+					{
+						l_Buckets[b] += l_Buckets[b - 1];
+					}
+					for (std::size_t i(0); i < l_Count; ++i)
+					{
+						l_To[l_Buckets[(RadixKey(l_From[i].*m_Key) >> l_Shift) & 0xFF]++] = l_From[i];
+					}
+					std::swap(l_From, l_To);
+				}
+
+				if (l_From != p_Begin)
+				{
+					std::copy(l_From, l_From + l_Count, p_Begin);
+				}
+			}
+
+			void SortRun(T* p_Begin, T* p_End, T*, std::false_type) const
+			{
+				K T::* l_Key(m_Key);
+				std::stable_sort(
+					p_Begin,
+					p_End,
+					[l_Key](const T& p_Left, const T& p_Right)
+					{
+						return KeyLess(p_Left.*l_Key, p_Right.*l_Key);
+					});
+			}
+
+			const std::string RunName(const std::size_t& p_Run) const
+			{
+				return m_TempPrefix + ".run." + std::to_string(p_Run);
+			}
+
+			// Merges the runs p_Names[p_First, p_End) into p_Output, opening them
+			// only for the merge and sharing the budget among their readahead
+			const SortStatus MergeRuns(
+				const std::vector<std::string>& p_Names,
+				const std::size_t& p_First,
+				const std::size_t& p_End,
+				CumulativeWriter<T>& p_Output) const
+			{
+				std::vector<RunLog> l_Runs;
+				std::vector<CumulativeWriter<T>*> l_Inputs;
+				for (std::size_t i(p_First); i < p_End; ++i)
+				{
+					l_Runs.emplace_back(new CumulativeWriter<T>(p_Names[i]));
+					l_Inputs.push_back(l_Runs.back().get());
+				}
+
+				// Two readahead blocks per run plus the output batches share the budget
+				const std::size_t l_Readahead(std::max<std::size_t>(1, m_MemoryBudget / (sizeof(T) * 2 * (l_Runs.size() + 1))));
+				LogMerger<T, K> l_Merger(
+					m_Key,
+					static_cast<unsigned int>(std::min<std::size_t>(l_Readahead, 1u << 20)),
+					static_cast<unsigned int>(std::min<std::size_t>(l_Readahead, 1u << 20)));
+				switch (l_Merger.Merge(l_Inputs, p_Output))
+				{
+					case LogMerger<T, K>::MergeStatus::Okay:
+						return SortStatus::Okay;
+					case LogMerger<T, K>::MergeStatus::ReadError:
+						return SortStatus::ReadError;
+					default:
+						return SortStatus::WriteError;
+				}
+			}
+
+			static void RemoveRuns(std::vector<std::string>& p_Names)
+			{
+				for (const auto& l_Name : p_Names)
+				{
+					std::remove(l_Name.c_str());
+				}
+				p_Names.clear();
+			}
+
+		public:
+
+			ExternalSorter(
+				K T::* p_Key,
+				const std::size_t& p_MemoryBudget,
+				const std::string& p_TempPrefix,
+				const unsigned int& p_Threads = 0)
+				:
+				m_Key(p_Key),
+				m_MemoryBudget(p_MemoryBudget),
+				m_Threads(p_Threads != 0 ? p_Threads : std::max(1u, std::thread::hardware_concurrency())),
+				m_TempPrefix(p_TempPrefix)
+			{
+			}
+
+			const SortStatus Sort(CumulativeWriter<T>& p_Input, CumulativeWriter<T>& p_Output) const
+			{
+				// Half of the budget holds the run, the other half is radix scratch
+				const std::size_t l_RunRecords(m_MemoryBudget / (2 * sizeof(T)));
+				if (l_RunRecords < m_Threads)
+				{
+					return SortStatus::BudgetTooSmall;
+				}
+
+				using IsRadix = std::integral_constant<bool, std::is_integral<K>::value>;
+				std::vector<T> l_Run;
+				std::vector<T> l_Scratch;
+				std::vector<std::string> l_Runs;
+				std::size_t l_Named(0);
+				SortStatus l_Result(SortStatus::Okay);
+
+				const unsigned int l_Total(p_Input.RecordCount());
+				for (unsigned int l_Next(0); l_Next < l_Total && l_Result == SortStatus::Okay;)
+				{
+					const unsigned int l_Count(static_cast<unsigned int>(std::min<std::size_t>(l_RunRecords, l_Total - l_Next)));
+					l_Run.resize(l_Count);
+					l_Scratch.resize(IsRadix::value ? l_Count : 0);
+					if (p_Input.ReadRecords(l_Next, l_Count, l_Run.data()) != CumulativeWriter<T>::RecordReadStatus::Okay)
+					{
+						l_Result = SortStatus::ReadError;
+						break;
+					}
+					l_Next += l_Count;
+
+					// Each worker sorts and spills its own slice as a separate run,
+					// closed again once written.  The run logs are opened before
+					// any worker starts so nothing can throw while one is running,
+					// and a slice whose thread cannot be started is sorted here.
+					const std::size_t l_Slice((l_Count + m_Threads - 1) / m_Threads);
+					std::vector<RunLog> l_Spills;
+					for (unsigned int i(0); i < m_Threads && i * l_Slice < l_Count; ++i)
+					{
+						l_Runs.push_back(RunName(l_Named++));
+						std::remove(l_Runs.back().c_str());
+						l_Spills.emplace_back(new CumulativeWriter<T>(l_Runs.back()));
+					}
+
+					std::vector<char> l_Written(l_Spills.size(), 0);
+					auto l_Spill = [this, &l_Run, &l_Scratch, &l_Spills, &l_Written, l_Slice, l_Count](const std::size_t& p_Slice)
+					{
+						T* l_Begin(l_Run.data() + p_Slice * l_Slice);
+						T* l_End(l_Run.data() + std::min<std::size_t>(l_Count, (p_Slice + 1) * l_Slice));
+						T* l_ScratchBegin(IsRadix::value ? l_Scratch.data() + p_Slice * l_Slice : nullptr);
+						SortRun(l_Begin, l_End, l_ScratchBegin, IsRadix());
+						l_Written[p_Slice] = l_Spills[p_Slice]->WriteRecords(l_Begin, static_cast<unsigned int>(l_End - l_Begin)) ? 1 : 0;
+					};
+					std::vector<std::thread> l_Workers;
+					l_Workers.reserve(l_Spills.size());
+					for (std::size_t i(0); i < l_Spills.size(); ++i)
+					{
+						try
+						{
+							l_Workers.emplace_back(l_Spill, i);
+						}
+						catch (const std::system_error&)
+						{
+							l_Spill(i);
+						}
+					}
+					for (auto& l_Worker : l_Workers)
+					{
+						l_Worker.join();
+					}
+					for (std::size_t i(0); i < l_Spills.size(); ++i)
+					{
+						if (l_Written[i] == 0)
+						{
+							l_Result = SortStatus::WriteError;
+						}
+					}
+				}
+
+				l_Run = std::vector<T>();
+				l_Scratch = std::vector<T>();
+
+				// Consecutive groups are merged so equal keys still come out in input order
+				while (l_Result == SortStatus::Okay && l_Runs.size() > c_MaxFanIn)
+				{
+					std::vector<std::string> l_Merged;
+					for (std::size_t l_First(0); l_First < l_Runs.size() && l_Result == SortStatus::Okay; l_First += c_MaxFanIn)
+					{
+						l_Merged.push_back(RunName(l_Named++));
+						std::remove(l_Merged.back().c_str());
+						CumulativeWriter<T> l_Output(l_Merged.back());
+						l_Result = MergeRuns(l_Runs, l_First, std::min(l_Runs.size(), l_First + c_MaxFanIn), l_Output);
+					}
+					RemoveRuns(l_Runs);
+					l_Runs.swap(l_Merged);
+				}
+
+				if (l_Result == SortStatus::Okay && !l_Runs.empty())
+				{
+					l_Result = MergeRuns(l_Runs, 0, l_Runs.size(), p_Output);
+				}
+
+				RemoveRuns(l_Runs);
+				return l_Result;
+			}
+	};
+
+	template<typename T, typename K> const std::size_t ExternalSorter<T, K>::c_MaxFanIn;
+}
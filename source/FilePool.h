@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace Bluebird
+{
+	// Caps how many files a set of writers keeps open at once.
+	//
+	// Writers register a park function and touch their entry whenever they
+	// use their file.  Once more than p_Capacity entries are open the least
+	// recently used are asked to park, closing their handle until they next
+	// touch it.  Park functions must not block: a writer busy with its file
+	// declines and the next least recently used is asked instead, so the cap
+	// may be exceeded briefly while every open file is in use.
+	class FilePool
+	{
+		public:
+
+			// Closes the file if it is idle, returning whether it did
+			using ParkFunction = std::function<bool()>;
+
+		private:
+
+			struct Entry
+			{
+				ParkFunction						m_Park;
+				bool								m_Open;
+				std::list<unsigned int>::iterator	m_Recent;
+			};
+
+			const std::size_t				m_Capacity;
+			std::mutex						m_Lock;
+			std::map<unsigned int, Entry>	m_Entries;
+			std::list<unsigned int>			m_Recent;		// Open entries, most recently used first
+			unsigned int					m_NextId;
+
+			FilePool(const FilePool&) = delete;
+
+			void Evict(const unsigned int& p_Keep)
+			{
+				auto l_Candidate(m_Recent.end());
+				while (m_Recent.size() > m_Capacity && l_Candidate != m_Recent.begin())
+				{
+					--l_Candidate;
+					if (*l_Candidate == p_Keep)
+					{
+						continue;
+					}
+
+					Entry& l_Entry(m_Entries[*l_Candidate]);
+					if (l_Entry.m_Park())
+					{
+						l_Entry.m_Open = false;
+						l_Candidate = m_Recent.erase(l_Candidate);
+					}
+				}
+			}
+
+		public:
+
+			FilePool(const std::size_t& p_Capacity = 1024)
+				:
+				m_Capacity(std::max<std::size_t>(1, p_Capacity)),
+				m_Lock(),
+				m_Entries(),
+				m_Recent(),
+				m_NextId(0)
+			{
+			}
+
+			// The pool shared by the whole process
+			static FilePool& Instance()
+			{
+				static FilePool l_Instance;
+				return l_Instance;
+			}
+
+			const unsigned int Register(const ParkFunction& p_Park)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				m_Entries[m_NextId] = Entry{ p_Park, false, m_Recent.end() };
+				return m_NextId++;
+			}
+
+			// Once this returns the entry's park function will not be called again
+			void Unregister(const unsigned int& p_Id)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				const auto l_Entry(m_Entries.find(p_Id));
+				if (l_Entry == m_Entries.end())
+				{
+					return;
+				}
+				if (l_Entry->second.m_Open)
+				{
+					m_Recent.erase(l_Entry->second.m_Recent);
+				}
+				m_Entries.erase(l_Entry);
+			}
+
+			// Records that p_Id's file is open and has just been used, parking
+			// others if that takes the pool over capacity
+			void Touch(const unsigned int& p_Id)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				const auto l_Entry(m_Entries.find(p_Id));
+				if (l_Entry == m_Entries.end())
+				{
+					return;
+				}
+
+				if (l_Entry->second.m_Open)
+				{
+					m_Recent.splice(m_Recent.begin(), m_Recent, l_Entry->second.m_Recent);
+					return;
+				}
+
+				m_Recent.push_front(p_Id);
+				l_Entry->second.m_Open = true;
+				l_Entry->second.m_Recent = m_Recent.begin();
+				Evict(p_Id);
+			}
+
+			const std::size_t OpenCount()
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return m_Recent.size();
+			}
+
+			const std::size_t& Capacity() const noexcept
+			{
+				return m_Capacity;
+			}
+	};
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#ifndef _WIN32
+	#include <sys/stat.h>
+	#include <sys/types.h>
+	#include <unistd.h>
+#else
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <Windows.h>
+#endif
+
+namespace Bluebird
+{
+	// Renames p_From over p_To, replacing it in one step where the platform allows
+	inline const bool RenameOverFile(const std::string& p_From, const std::string& p_To) noexcept
+	{
+#ifdef _WIN32
+		return MoveFileExA(p_From.c_str(), p_To.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		return std::rename(p_From.c_str(), p_To.c_str()) == 0;
+#endif
+	}
+
+	// Sets p_Size to the length of p_Filename, failing if it does not exist
+	inline const bool FileSize(const std::string& p_Filename, unsigned long long& p_Size) noexcept
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA l_Data;
+		if (GetFileAttributesExA(p_Filename.c_str(), GetFileExInfoStandard, &l_Data) == 0)
+		{
+			return false;
+		}
+		p_Size = (static_cast<unsigned long long>(l_Data.nFileSizeHigh) << 32) | l_Data.nFileSizeLow;
+		return true;
+#else
+		struct stat l_Stat;
+		if (::stat(p_Filename.c_str(), &l_Stat) != 0)
+		{
+			return false;
+		}
+		p_Size = static_cast<unsigned long long>(l_Stat.st_size);
+		return true;
+#endif
+	}
+
+	// Cuts p_Filename down to its first p_Size bytes
+	inline const bool TruncateFile(const std::string& p_Filename, const unsigned long long& p_Size) noexcept
+	{
+#ifdef _WIN32
+		HANDLE l_File(CreateFileA(
+			p_Filename.c_str(),
+			GENERIC_WRITE,
+			FILE_SHARE_READ | FILE_SHARE_WRITE,
+			NULL,
+			OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			NULL));
+		if (l_File == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER l_Size;
+		l_Size.QuadPart = static_cast<LONGLONG>(p_Size);
+		const bool l_result(SetFilePointerEx(l_File, l_Size, NULL, FILE_BEGIN) != 0 && SetEndOfFile(l_File) != 0);
+		CloseHandle(l_File);
+		return l_result;
+#else
+		return ::truncate(p_Filename.c_str(), static_cast<off_t>(p_Size)) == 0;
+#endif
+	}
+}
@@ -0,0 +1,505 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#else
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <Windows.h>
+#endif
+
+#include "FilePool.h"
+
+namespace Bluebird
+{
+	// Makes the writes of many files durable from one place, instead of
+	// every write paying for a sync of its own.
+	//
+	// Files register once and mark themselves dirty after each write.  Every
+	// p_Interval, or sooner when someone waits, a flush round takes the set
+	// of dirty files and syncs them: with few dirty files each is
+	// fdatasync'ed (FlushFileBuffers on Windows) by a small pool of worker
+	// threads, and once p_SyncfsThreshold or more are dirty a single syncfs
+	// per file system is issued instead, where the platform has it.
+	// WaitForFlush blocks until a round that started after the call has
+	// finished, so concurrent waiters share one round: a group commit.  A
+	// file whose sync fails is marked dirty again for the next round, and
+	// each waiter is told whether the round it waited on synced everything.
+	// A file is opened by the first round that syncs it and kept open until
+	// it unregisters, so a round does not reopen every file it syncs.  Files
+	// registered with a FilePool have these handles counted against its cap.
+	class FlushScheduler
+	{
+		private:
+
+			// A registered file's own handle, opened by the first round to sync
+			// it and closed once no round is still syncing it.  With a FilePool
+			// the handle is counted by the pool, which may close it while idle;
+			// the next sync opens it again
+			class File
+			{
+				private:
+
+					const std::string	m_Filename;
+					FilePool*			m_Pool;
+					unsigned int		m_PoolId;
+					std::mutex			m_Lock;
+#ifdef _WIN32
+					HANDLE				m_Handle;
+#else
+					int					m_Handle;
+#endif
+
+					File() = delete;
+					File(const File&) = delete;
+
+					inline const bool IsOpen() const noexcept
+					{
+#ifdef _WIN32
+						return m_Handle != INVALID_HANDLE_VALUE;
+#else
+						return m_Handle >= 0;
+#endif
+					}
+
+					void Close() noexcept
+					{
+						if (IsOpen())
+						{
+#ifdef _WIN32
+							CloseHandle(m_Handle);
+							m_Handle = INVALID_HANDLE_VALUE;
+#else
+							::close(m_Handle);
+							m_Handle = -1;
+#endif
+						}
+					}
+
+					// Opens the handle if it is closed and tells the pool it is in
+					// use.  Called with m_Lock held
+					const bool Open() noexcept
+					{
+						if (!IsOpen())
+						{
+#ifdef _WIN32
+							m_Handle = CreateFileA(
+								m_Filename.c_str(),
+								GENERIC_WRITE,
+								FILE_SHARE_READ | FILE_SHARE_WRITE,
+								NULL,
+								OPEN_EXISTING,
+								FILE_ATTRIBUTE_NORMAL,
+								NULL);
+#else
+							m_Handle = ::open(m_Filename.c_str(), O_RDONLY);
+#endif
+							if (!IsOpen())
+							{
+								return false;
+							}
+						}
+
+						if (m_Pool != nullptr)
+						{
+							try
+							{
+								m_Pool->Touch(m_PoolId);
+							}
+							catch (const std::bad_alloc&)
+							{
+								Close();
+								return false;
+							}
+						}
+						return true;
+					}
+
+					// Called by the file pool: closes the handle unless a sync is using it
+					const bool TryPark() noexcept
+					{
+						std::unique_lock<std::mutex> l_Lock(m_Lock, std::try_to_lock);
+						if (!l_Lock.owns_lock())
+						{
+							return false;
+						}
+						Close();
+						return true;
+					}
+
+				public:
+
+					File(const std::string& p_Filename, FilePool* p_Pool)
+						:
+						m_Filename(p_Filename),
+						m_Pool(p_Pool),
+						m_PoolId(0),
+						m_Lock(),
+#ifdef _WIN32
+						m_Handle(INVALID_HANDLE_VALUE)
+#else
+						m_Handle(-1)
+#endif
+					{
+						if (m_Pool != nullptr)
+						{
+							m_PoolId = m_Pool->Register([this]() { return TryPark(); });
+						}
+					}
+
+					~File()
+					{
+						// Once unregistered the pool no longer parks this file
+						if (m_Pool != nullptr)
+						{
+							m_Pool->Unregister(m_PoolId);
+						}
+						Close();
+					}
+
+					const bool Sync() noexcept
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						if (!Open())
+						{
+							return false;
+						}
+#ifdef _WIN32
+						return FlushFileBuffers(m_Handle) != 0;
+#elif defined(__APPLE__)
+						return ::fsync(m_Handle) == 0;
+#else
+						return ::fdatasync(m_Handle) == 0;
+#endif
+					}
+
+#if defined(__linux__)
+					// Syncs the whole file system holding the file, unless it is in p_Synced
+					const bool SyncFileSystem(std::set<dev_t>& p_Synced) noexcept
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						struct stat l_Stat;
+						if (!Open() || ::fstat(m_Handle, &l_Stat) != 0)
+						{
+							return false;
+						}
+						if (p_Synced.count(l_Stat.st_dev) != 0)
+						{
+							return true;
+						}
+						if (::syncfs(m_Handle) != 0)
+						{
+							return false;
+						}
+						p_Synced.insert(l_Stat.st_dev);
+						return true;
+					}
+#endif
+			};
+
+			using FilePtr = std::shared_ptr<File>;
+
+			// A dirty file taken by a round, and whether its sync failed
+			struct Work
+			{
+				unsigned int	m_Id;
+				FilePtr			m_File;
+				bool			m_Failed;
+			};
+
+			// The outcome of a round, kept while anyone waits on it
+			struct RoundResult
+			{
+				unsigned int	m_Waiters;
+				bool			m_Failed;
+			};
+
+			const std::chrono::milliseconds		m_Interval;
+			const std::size_t					m_SyncfsThreshold;
+
+			std::mutex							m_Lock;
+			std::condition_variable				m_Wake;			// Coordinator: a flush is wanted
+			std::condition_variable				m_RoundDone;	// Waiters: a round completed
+			std::condition_variable				m_WorkReady;	// Workers: a round started
+			std::condition_variable				m_WorkDone;		// Coordinator: workers finished
+
+			std::map<unsigned int, FilePtr>		m_Files;
+			std::set<unsigned int>				m_Dirty;
+			unsigned int						m_NextId;
+			bool								m_FlushRequested;
+			bool								m_Stopping;
+
+			unsigned long long					m_RoundsStarted;
+			unsigned long long					m_RoundsCompleted;
+			std::map<unsigned long long, RoundResult>	m_Results;
+
+			std::vector<Work>					m_Work;
+			unsigned long long					m_WorkRound;
+			std::atomic<std::size_t>			m_NextWork;
+			std::size_t							m_WorkersFinished;
+
+			std::thread							m_Coordinator;
+			std::vector<std::thread>			m_Workers;
+
+			FlushScheduler(const FlushScheduler&) = delete;
+
+			// One syncfs per file system holding any of p_Work
+			static void SyncFileSystems(std::vector<Work>& p_Work) noexcept
+			{
+#if defined(__linux__)
+				std::set<dev_t> l_Synced;
+				for (auto& l_Work : p_Work)
+				{
+					l_Work.m_Failed = !l_Work.m_File->SyncFileSystem(l_Synced);
+				}
+#else
+				for (auto& l_Work : p_Work)
+				{
+					l_Work.m_Failed = !l_Work.m_File->Sync();
+				}
+#endif
+			}
+
+			// Marks the files whose sync failed dirty again, unless they have
+			// unregistered since, returning whether any failed.  Called with
+			// m_Lock held
+			const bool RetryFailed(const std::vector<Work>& p_Work)
+			{
+				bool l_Failed(false);
+				for (const auto& l_Work : p_Work)
+				{
+					if (l_Work.m_Failed)
+					{
+						l_Failed = true;
+						const auto l_File(m_Files.find(l_Work.m_Id));
+						if (l_File != m_Files.end() && l_File->second == l_Work.m_File)
+						{
+							m_Dirty.insert(l_Work.m_Id);
+						}
+					}
+				}
+				return l_Failed;
+			}
+
+			void RunWorker()
+			{
+				unsigned long long l_Seen(0);
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				while (true)
+				{
+					// A round already handed out is finished before stopping
+					m_WorkReady.wait(l_Lock, [this, &l_Seen]() { return m_WorkRound != l_Seen || m_Stopping; });
+					if (m_WorkRound == l_Seen)
+					{
+						break;
+					}
+					l_Seen = m_WorkRound;
+					l_Lock.unlock();
+
+					for (std::size_t i(m_NextWork++); i < m_Work.size(); i = m_NextWork++)
+					{
+						m_Work[i].m_Failed = !m_Work[i].m_File->Sync();
+					}
+
+					l_Lock.lock();
+					if (++m_WorkersFinished == m_Workers.size())
+					{
+						m_WorkDone.notify_one();
+					}
+				}
+			}
+
+			void RunCoordinator()
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				while (!m_Stopping)
+				{
+					m_Wake.wait_for(l_Lock, m_Interval, [this]() { return m_FlushRequested || m_Stopping; });
+					m_FlushRequested = false;
+
+					std::vector<Work> l_Work;
+					for (const auto& l_Id : m_Dirty)
+					{
+						const auto l_File(m_Files.find(l_Id));
+						if (l_File != m_Files.end())
+						{
+							l_Work.push_back(Work{ l_Id, l_File->second, false });
+						}
+					}
+					m_Dirty.clear();
+					const unsigned long long l_Round(m_RoundsStarted + 1);
+
+					bool l_Failed(false);
+					if (l_Work.size() >= m_SyncfsThreshold)
+					{
+						++m_RoundsStarted;
+						l_Lock.unlock();
+						SyncFileSystems(l_Work);
+						l_Lock.lock();
+						l_Failed = RetryFailed(l_Work);
+					}
+					else if (!l_Work.empty())
+					{
+						m_Work.swap(l_Work);
+						m_NextWork = 0;
+						m_WorkersFinished = 0;
+						++m_WorkRound;
+						++m_RoundsStarted;
+						m_WorkReady.notify_all();
+						m_WorkDone.wait(l_Lock, [this]() { return m_WorkersFinished == m_Workers.size() || m_Stopping; });
+						if (m_WorkersFinished == m_Workers.size())
+						{
+							l_Failed = RetryFailed(m_Work);
+							m_Work.clear();
+						}
+						else
+						{
+							// Stopping: the workers finish the round on their own
+							l_Failed = true;
+						}
+					}
+					else
+					{
+						++m_RoundsStarted;
+					}
+
+					m_RoundsCompleted = l_Round;
+					const auto l_Result(m_Results.find(l_Round));
+					if (l_Result != m_Results.end())
+					{
+						l_Result->second.m_Failed = l_Failed;
+					}
+					m_RoundDone.notify_all();
+				}
+			}
+
+		public:
+
+			FlushScheduler(
+				const std::chrono::milliseconds& p_Interval = std::chrono::milliseconds(10),
+				const unsigned int& p_Workers = 4,
+				const std::size_t& p_SyncfsThreshold = 256)
+				:
+				m_Interval(p_Interval),
+				m_SyncfsThreshold(std::max<std::size_t>(1, p_SyncfsThreshold)),
+				m_Lock(),
+				m_Wake(),
+				m_RoundDone(),
+				m_WorkReady(),
+				m_WorkDone(),
+				m_Files(),
+				m_Dirty(),
+				m_NextId(0),
+				m_FlushRequested(false),
+				m_Stopping(false),
+				m_RoundsStarted(0),
+				m_RoundsCompleted(0),
+				m_Results(),
+				m_Work(),
+				m_WorkRound(0),
+				m_NextWork(0),
+				m_WorkersFinished(0),
+				m_Coordinator(),
+				m_Workers()
+			{
+				for (unsigned int i(0); i < std::max(1u, p_Workers); ++i)
+				{
+					m_Workers.emplace_back(&FlushScheduler::RunWorker, this);
+				}
+				m_Coordinator = std::thread(&FlushScheduler::RunCoordinator, this);
+			}
+
+			// Finishes a last round for anything still dirty, then stops the threads
+			virtual ~FlushScheduler()
+			{
+				WaitForFlush();
+
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_Stopping = true;
+				}
+				m_Wake.notify_one();
+				m_WorkReady.notify_all();
+				m_WorkDone.notify_one();
+				m_Coordinator.join();
+				for (auto& l_Worker : m_Workers)
+				{
+					l_Worker.join();
+				}
+			}
+
+			// The scheduler shared by the whole process
+			static FlushScheduler& Instance()
+			{
+				static FlushScheduler l_Instance;
+				return l_Instance;
+			}
+
+			// Registers p_Filename, counting its handle in p_Pool if one is given
+			const unsigned int Register(const std::string& p_Filename, FilePool* p_Pool = nullptr)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				m_Files[m_NextId] = std::make_shared<File>(p_Filename, p_Pool);
+				return m_NextId++;
+			}
+
+			// Forgets a file, syncing it first if it is still dirty
+			const bool Unregister(const unsigned int& p_Id)
+			{
+				FilePtr l_File;
+				bool l_Dirty(false);
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					const auto l_Found(m_Files.find(p_Id));
+					if (l_Found == m_Files.end())
+					{
+						return false;
+					}
+					l_File = l_Found->second;
+					l_Dirty = m_Dirty.erase(p_Id) != 0;
+					m_Files.erase(l_Found);
+				}
+				return !l_Dirty || l_File->Sync();
+			}
+
+			void MarkDirty(const unsigned int& p_Id)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				m_Dirty.insert(p_Id);
+			}
+
+			// Blocks until every file marked dirty before the call has been
+			// synced, returning false if the round waited on failed any sync
+			const bool WaitForFlush()
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				const unsigned long long l_Target(m_RoundsStarted + 1);
+				RoundResult& l_Result(m_Results.insert(std::make_pair(l_Target, RoundResult{ 0, false })).first->second);
+				++l_Result.m_Waiters;
+				m_FlushRequested = true;
+				m_Wake.notify_one();
+				m_RoundDone.wait(l_Lock, [this, &l_Target]() { return m_RoundsCompleted >= l_Target || m_Stopping; });
+
+				const bool l_Flushed(m_RoundsCompleted >= l_Target && !l_Result.m_Failed);
+				if (--l_Result.m_Waiters == 0)
+				{
+					m_Results.erase(l_Target);
+				}
+				return l_Flushed;
+			}
+	};
+}
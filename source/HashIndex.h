@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "KeyHash.h"
+#include "MappedFile.h"
+
+namespace Bluebird
+{
+	// Persistent open addressing hash index over the key member K T::* of a
+	// CumulativeWriter<T> log, mapping every key to the latest record holding
+	// it.  In AllRecords mode a postings file additionally links each record
+	// to the previous record with the same key, so every occurrence can be
+	// walked newest first without touching the log.
+	//
+	// Both files are memory mapped and are updated from the writer's append
+	// path.  On open any records appended since the index was last updated are
+	// indexed, and an index that is ahead of its log is rebuilt.  Should the
+	// append path ever hand the index a record past the next one it expects,
+	// it stops answering with MissedRecords rather than leave a hole, and
+	// opening it again catches it up.
+	template<typename T, typename K>
+	class HashIndex
+	{
+		public:
+
+			enum class IndexMode : std::uint32_t
+			{
+				LatestOnly,
+				AllRecords
+			};
+
+			enum class IndexStatus
+			{
+				Unknown,
+				ErrorOpening,
+				ErrorReading,
+				ErrorResizing,
+				MissedRecords,
+				Okay		=	255
+			};
+
+			static const unsigned int c_NoRecord = 0xFFFFFFFF;
+
+		private:
+
+			struct IndexHeader
+			{
+				std::uint32_t	m_Magic;
+				std::uint32_t	m_Version;
+				std::uint32_t	m_KeySize;
+				std::uint32_t	m_Mode;
+				std::uint64_t	m_Capacity;
+				std::uint64_t	m_Used;
+				std::uint64_t	m_IndexedRecords;
+				std::uint64_t	m_Reserved[3];
+			};
+
+			struct Slot
+			{
+				K				m_Key;
+				std::uint32_t	m_Latest;
+				std::uint32_t	m_Occupied;
+			};
+
+			static const std::uint32_t	c_Magic = 0x58444948;		// "HIDX"
+			static const std::uint32_t	c_Version = 1;
+			static const std::uint64_t	c_InitialCapacity = 1024;
+
+			CumulativeWriter<T>&			m_Writer;
+			K T::*							m_Key;
+			const IndexMode					m_Mode;
+			MappedFile						m_Slots;
+			std::unique_ptr<MappedFile>		m_Postings;
+			mutable std::mutex				m_Lock;
+			IndexStatus						m_Status;
+			unsigned int					m_ObserverId;
+			bool							m_Registered;
+
+			HashIndex() = delete;
+			HashIndex(const HashIndex&) = delete;
+
+			IndexHeader* Header() const noexcept
+			{
+				return reinterpret_cast<IndexHeader*>(const_cast<std::uint8_t*>(m_Slots.Data()));
+			}
+
+			Slot* Slots() const noexcept
+			{
+				return reinterpret_cast<Slot*>(const_cast<std::uint8_t*>(m_Slots.Data()) + sizeof(IndexHeader));
+			}
+
+			std::uint32_t* Postings() const noexcept
+			{
+				return reinterpret_cast<std::uint32_t*>(m_Postings->Data());
+			}
+
+			// Linear probe for p_Key, returning its slot or the empty slot it would take
+			Slot* Locate(const K& p_Key) const noexcept
+			{
+				const std::uint64_t l_Mask(Header()->m_Capacity - 1);
+				Slot* l_Slots(Slots());
+				for (std::uint64_t l_Position(KeyHash(p_Key) & l_Mask);; l_Position = (l_Position + 1) & l_Mask)
+				{
+					Slot& l_Slot(l_Slots[l_Position]);
+					if (l_Slot.m_Occupied == 0 || std::memcmp(&l_Slot.m_Key, &p_Key, sizeof(K)) == 0)
+					{
+						return &l_Slot;
+					}
+				}
+			}
+
+			const bool Reset(const std::uint64_t& p_Capacity, const std::uint64_t& p_IndexedRecords) noexcept
+			{
+				if (!m_Slots.Resize(0) || !m_Slots.Resize(sizeof(IndexHeader) + p_Capacity * sizeof(Slot)))
+				{
+					return false;
+				}
+
+				IndexHeader* l_Header(Header());
+				l_Header->m_Magic = c_Magic;
+				l_Header->m_Version = c_Version;
+				l_Header->m_KeySize = sizeof(K);
+				l_Header->m_Mode = static_cast<std::uint32_t>(m_Mode);
+				l_Header->m_Capacity = p_Capacity;
+				l_Header->m_Used = 0;
+				l_Header->m_IndexedRecords = p_IndexedRecords;
+				return true;
+			}
+
+			const bool Grow() noexcept
+			{
+				try
+				{
+					std::vector<Slot> l_Occupied;
+					l_Occupied.reserve(static_cast<std::size_t>(Header()->m_Used));
+					for (std::uint64_t i(0); i < Header()->m_Capacity; ++i)
+					{
+						if (Slots()[i].m_Occupied != 0)
+						{
+							l_Occupied.push_back(Slots()[i]);
+						}
+					}
+
+					// Copied out first, Reset unmaps the header these live in
+					const std::uint64_t l_Capacity(Header()->m_Capacity * 2);
+					const std::uint64_t l_IndexedRecords(Header()->m_IndexedRecords);
+					if (!Reset(l_Capacity, l_IndexedRecords))
+					{
+						return false;
+					}
+					for (const auto& l_Slot : l_Occupied)
+					{
+						*Locate(l_Slot.m_Key) = l_Slot;
+					}
+					Header()->m_Used = l_Occupied.size();
+					return true;
+				}
+				catch (const std::exception&)
+				{
+					return false;
+				}
+			}
+
+			const bool Insert(const K& p_Key, const unsigned int& p_Record) noexcept
+			{
+				if ((Header()->m_Used + 1) * 10 > Header()->m_Capacity * 7 && !Grow())
+				{
+					m_Status = IndexStatus::ErrorResizing;
+					return false;
+				}
+
+				if (m_Mode == IndexMode::AllRecords &&
+					m_Postings->Size() < (static_cast<std::size_t>(p_Record) + 1) * sizeof(std::uint32_t) &&
+					!m_Postings->Resize(std::max<std::size_t>(4096, m_Postings->Size() * 2)))
+				{
+					m_Status = IndexStatus::ErrorResizing;
+					return false;
+				}
+
+				Slot* l_Slot(Locate(p_Key));
+				std::uint32_t l_Previous(c_NoRecord);
+				if (l_Slot->m_Occupied != 0)
+				{
+					l_Previous = l_Slot->m_Latest;
+
+					// Slot pages written back ahead of the header before a crash
+					// already hold this record; linking it again would point it at
+					// itself
+					if (l_Previous >= p_Record)
+					{
+						Header()->m_IndexedRecords = static_cast<std::uint64_t>(p_Record) + 1;
+						return true;
+					}
+				}
+				else
+				{
+					l_Slot->m_Key = p_Key;
+					l_Slot->m_Occupied = 1;
+					++Header()->m_Used;
+				}
+				l_Slot->m_Latest = p_Record;
+
+				if (m_Mode == IndexMode::AllRecords)
+				{
+					Postings()[p_Record] = l_Previous;
+				}
+				Header()->m_IndexedRecords = static_cast<std::uint64_t>(p_Record) + 1;
+				return true;
+			}
+
+		public:
+
+			HashIndex(
+				CumulativeWriter<T>& p_Writer,
+				K T::* p_Key,
+				const std::string& p_Filename,
+				const IndexMode& p_Mode = IndexMode::LatestOnly)
+				:
+				m_Writer(p_Writer),
+				m_Key(p_Key),
+				m_Mode(p_Mode),
+				m_Slots(p_Filename),
+				m_Postings(p_Mode == IndexMode::AllRecords ? new MappedFile(p_Filename + ".post") : nullptr),
+				m_Lock(),
+				m_Status(IndexStatus::Unknown),
+				m_ObserverId(0),
+				m_Registered(false)
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				if (!m_Slots.Valid() || (m_Postings != nullptr && !m_Postings->Valid()))
+				{
+					m_Status = IndexStatus::ErrorOpening;
+					return;
+				}
+
+				const IndexHeader* l_Header(m_Slots.Size() >= sizeof(IndexHeader) ? Header() : nullptr);
+				const bool l_Usable(
+					l_Header != nullptr &&
+					l_Header->m_Magic == c_Magic &&
+					l_Header->m_Version == c_Version &&
+					l_Header->m_KeySize == sizeof(K) &&
+					l_Header->m_Mode == static_cast<std::uint32_t>(m_Mode) &&
+					m_Slots.Size() == sizeof(IndexHeader) + l_Header->m_Capacity * sizeof(Slot) &&
+					l_Header->m_IndexedRecords <= m_Writer.RecordCount() &&
+					(m_Postings == nullptr || m_Postings->Size() >= l_Header->m_IndexedRecords * sizeof(std::uint32_t)));
+				if (!l_Usable && !Reset(c_InitialCapacity, 0))
+				{
+					m_Status = IndexStatus::ErrorResizing;
+					return;
+				}
+
+				m_Status = IndexStatus::Okay;
+				const unsigned int l_Indexed(static_cast<unsigned int>(Header()->m_IndexedRecords));
+				l_Lock.unlock();
+
+				// Indexes every record the log holds beyond what the index has seen
+				m_Registered = m_Writer.AddWriteObserver(
+					[this](const unsigned int& p_RecordIndex, const T& p_Record)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						if (m_Status != IndexStatus::Okay || p_RecordIndex < Header()->m_IndexedRecords)
+						{
+							return;
+						}
+						if (p_RecordIndex > Header()->m_IndexedRecords)
+						{
+							m_Status = IndexStatus::MissedRecords;
+							return;
+						}
+						Insert(p_Record.*m_Key, p_RecordIndex);
+					},
+					l_Indexed,
+					m_ObserverId) == CumulativeWriter<T>::RecordReadStatus::Okay;
+				if (!m_Registered)
+				{
+					l_Lock.lock();
+					m_Status = IndexStatus::ErrorReading;
+				}
+			}
+
+			virtual ~HashIndex()
+			{
+				if (m_Registered)
+				{
+					m_Writer.RemoveWriteObserver(m_ObserverId);
+				}
+				Flush();
+			}
+
+			const IndexStatus& Status() const noexcept
+			{
+				return m_Status;
+			}
+
+			const bool FindLatest(const K& p_Key, unsigned int& p_RecordIndex) const noexcept
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_Status != IndexStatus::Okay)
+				{
+					return false;
+				}
+
+				const Slot* l_Slot(Locate(p_Key));
+				if (l_Slot->m_Occupied == 0)
+				{
+					return false;
+				}
+
+				p_RecordIndex = l_Slot->m_Latest;
+				return true;
+			}
+
+			// Every record index holding p_Key in log order; only the latest in LatestOnly mode
+			const std::vector<unsigned int> FindAll(const K& p_Key) const
+			{
+				std::vector<unsigned int> l_result;
+
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_Status == IndexStatus::Okay)
+				{
+					const Slot* l_Slot(Locate(p_Key));
+					if (l_Slot->m_Occupied != 0)
+					{
+						if (m_Mode == IndexMode::AllRecords)
+						{
+							// Links only ever point back, so a damaged chain still ends
+							const std::size_t l_Postings(m_Postings->Size() / sizeof(std::uint32_t));
+							for (std::uint32_t l_Record(l_Slot->m_Latest); l_Record != c_NoRecord && l_Record < l_Postings;)
+							{
+								l_result.push_back(l_Record);
+								const std::uint32_t l_Next(Postings()[l_Record]);
+								if (l_Next != c_NoRecord && l_Next >= l_Record)
+								{
+									break;
+								}
+								l_Record = l_Next;
+							}
+							std::reverse(l_result.begin(), l_result.end());
+						}
+						else
+						{
+							l_result.push_back(l_Slot->m_Latest);
+						}
+					}
+				}
+
+				return l_result;
+			}
+
+			const typename CumulativeWriter<T>::ReadRecordResult ReadLatest(const K& p_Key) noexcept
+			{
+				unsigned int l_Record(c_NoRecord);
+				if (!FindLatest(p_Key, l_Record))
+				{
+					return std::make_pair(CumulativeWriter<T>::RecordReadStatus::OffsetOutOfRange, typename CumulativeWriter<T>::TPtr(nullptr));
+				}
+
+				return m_Writer.ReadRecord(l_Record);
+			}
+
+			const bool Flush() noexcept
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return m_Slots.Flush() && (m_Postings == nullptr || m_Postings->Flush());
+			}
+	};
+
+	template<typename T, typename K> const unsigned int HashIndex<T, K>::c_NoRecord;
+	template<typename T, typename K> const std::uint32_t HashIndex<T, K>::c_Magic;
+	template<typename T, typename K> const std::uint32_t HashIndex<T, K>::c_Version;
+	template<typename T, typename K> const std::uint64_t HashIndex<T, K>::c_InitialCapacity;
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "FileUtils.h"
+
+namespace Bluebird
+{
+	// A CumulativeWriter<T> whose writes may carry a producer id and sequence
+	// number, so a producer retrying after a timeout cannot append the same
+	// record twice.  Each record is stored with its (producer, sequence) and
+	// the writer keeps the highest sequence written by every producer; a
+	// write at or below that high-water mark is rejected as a duplicate with
+	// one hash lookup.  Producer id 0 means no producer, and is never deduped.
+	//
+	// Every p_CheckpointInterval writes the high-water-mark table is saved to
+	// a checkpoint file along with the number of records it covers, so at
+	// open only the records after the checkpoint are read to bring the table
+	// up to date.  The log remains the source of truth: a lost or stale
+	// checkpoint only means more of the log is read at open.
+	template<typename T>
+	class IdempotentWriter
+	{
+		public:
+
+			struct ProducedRecord
+			{
+				std::uint64_t	m_Producer;
+				std::uint64_t	m_Sequence;
+				T				m_Record;
+			};
+
+			using Writer = CumulativeWriter<ProducedRecord>;
+
+			enum class WriteStatus
+			{
+				Unknown,
+				Duplicate,
+				WriteError,
+				Okay		=	255
+			};
+
+		private:
+
+			struct CheckpointHeader
+			{
+				std::uint32_t	m_Magic;
+				std::uint32_t	m_Version;
+				std::uint64_t	m_Records;
+				std::uint64_t	m_Producers;
+			};
+
+			struct CheckpointEntry
+			{
+				std::uint64_t	m_Producer;
+				std::uint64_t	m_Sequence;
+			};
+
+			static const std::uint32_t	c_Magic = 0x4D574850;		// "PHWM"
+			static const std::uint32_t	c_Version = 1;
+
+			using Table = std::unordered_map<std::uint64_t, std::uint64_t>;
+
+			Writer						m_Writer;
+			const std::string			m_CheckpointFile;
+			const unsigned int			m_CheckpointInterval;
+			Table						m_HighWater;
+			unsigned int				m_SinceCheckpoint;
+			mutable std::mutex			m_Lock;
+			std::mutex					m_CheckpointLock;
+
+			IdempotentWriter() = delete;
+			IdempotentWriter(const IdempotentWriter&) = delete;
+
+			void Apply(const ProducedRecord& p_Record)
+			{
+				if (p_Record.m_Producer != 0)
+				{
+					std::uint64_t& l_Mark(m_HighWater[p_Record.m_Producer]);
+					l_Mark = std::max(l_Mark, p_Record.m_Sequence);
+				}
+			}
+
+			const std::uint64_t LoadCheckpoint()
+			{
+				std::ifstream l_File(m_CheckpointFile, std::ios_base::in | std::ios_base::binary);
+				CheckpointHeader l_Header;
+				if (!l_File.read(reinterpret_cast<char*>(&l_Header), sizeof(l_Header)) ||
+					l_Header.m_Magic != c_Magic ||
+					l_Header.m_Version != c_Version ||
+					l_Header.m_Records > m_Writer.RecordCount())
+				{
+					return 0;
+				}
+
+				std::vector<CheckpointEntry> l_Entries(static_cast<std::size_t>(l_Header.m_Producers));
+				if (!l_Entries.empty() &&
+					!l_File.read(reinterpret_cast<char*>(l_Entries.data()), l_Entries.size() * sizeof(CheckpointEntry)))
+				{
+					return 0;
+				}
+
+				m_HighWater.reserve(l_Entries.size());
+				for (const auto& l_Entry : l_Entries)
+				{
+					m_HighWater[l_Entry.m_Producer] = l_Entry.m_Sequence;
+				}
+				return l_Header.m_Records;
+			}
+
+			// Called with m_Lock held: copies the table, then writes it without the lock
+			void Checkpoint(std::unique_lock<std::mutex>& p_Lock)
+			{
+				m_SinceCheckpoint = 0;
+				const CheckpointHeader l_Header{ c_Magic, c_Version, m_Writer.RecordCount(), m_HighWater.size() };
+				std::vector<CheckpointEntry> l_Entries;
+				l_Entries.reserve(m_HighWater.size());
+				for (const auto& l_Mark : m_HighWater)
+				{
+					l_Entries.push_back(CheckpointEntry{ l_Mark.first, l_Mark.second });
+				}
+				p_Lock.unlock();
+
+				std::lock_guard<std::mutex> l_Checkpoint(m_CheckpointLock);
+				const std::string l_Temporary(m_CheckpointFile + ".tmp");
+				{
+					std::ofstream l_File(l_Temporary, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+					l_File.write(reinterpret_cast<const char*>(&l_Header), sizeof(l_Header));
+					if (!l_Entries.empty())
+					{
+						l_File.write(reinterpret_cast<const char*>(l_Entries.data()), l_Entries.size() * sizeof(CheckpointEntry));
+					}
+					l_File.flush();
+					if (!l_File.good())
+					{
+						return;
+					}
+				}
+				RenameOverFile(l_Temporary, m_CheckpointFile);
+			}
+
+		public:
+
+			IdempotentWriter(
+				const std::string& p_Filename,
+				const std::string& p_CheckpointFilename,
+				const unsigned int& p_CheckpointInterval = 4096)
+				:
+				m_Writer(p_Filename),
+				m_CheckpointFile(p_CheckpointFilename),
+				m_CheckpointInterval(p_CheckpointInterval != 0 ? p_CheckpointInterval : 1),
+				m_HighWater(),
+				m_SinceCheckpoint(0),
+				m_Lock(),
+				m_CheckpointLock()
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				const std::uint64_t l_Next(LoadCheckpoint());
+				if (l_Next < m_Writer.RecordCount())
+				{
+					m_Writer.ForEachRecord(
+						static_cast<unsigned int>(l_Next),
+						m_Writer.RecordCount() - static_cast<unsigned int>(l_Next),
+						[this](const unsigned int&, const ProducedRecord& p_Record)
+						{
+							Apply(p_Record);
+						});
+				}
+			}
+
+			virtual ~IdempotentWriter()
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				if (m_SinceCheckpoint > 0)
+				{
+					Checkpoint(l_Lock);
+				}
+				m_Writer.Close();
+			}
+
+			// A write with no producer, never deduped
+			const WriteStatus Write(const T* p_Record)
+			{
+				return Write(0, 0, p_Record);
+			}
+
+			// Rejected as a duplicate if p_Producer has already written p_Sequence or later
+			const WriteStatus Write(const std::uint64_t& p_Producer, const std::uint64_t& p_Sequence, const T* p_Record)
+			{
+				return WriteRecords(p_Producer, p_Sequence, p_Record, 1);
+			}
+
+			// Writes p_Records with sequences p_FirstSequence onwards, skipping
+			// any at or below p_Producer's high-water mark (a retried batch that
+			// partly landed); Duplicate if every one of them is skipped
+			const WriteStatus WriteRecords(
+				const std::uint64_t& p_Producer,
+				const std::uint64_t& p_FirstSequence,
+				const T* p_Records,
+				const unsigned int& p_Count)
+			{
+				if (p_Count == 0)
+				{
+					return WriteStatus::Okay;
+				}
+
+				std::vector<ProducedRecord> l_Records(p_Count);
+				for (unsigned int i(0); i < p_Count; ++i)
+				{
+					std::memset(&l_Records[i], 0, sizeof(ProducedRecord));
+					l_Records[i].m_Producer = p_Producer;
+					l_Records[i].m_Sequence = p_Producer != 0 ? p_FirstSequence + i : 0;
+					l_Records[i].m_Record = p_Records[i];
+				}
+
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				unsigned int l_Skip(0);
+				if (p_Producer != 0)
+				{
+					const auto l_Mark(m_HighWater.find(p_Producer));
+					if (l_Mark != m_HighWater.end() && l_Mark->second >= p_FirstSequence)
+					{
+						if (l_Mark->second - p_FirstSequence >= p_Count - 1)
+						{
+							return WriteStatus::Duplicate;
+						}
+						l_Skip = static_cast<unsigned int>(l_Mark->second - p_FirstSequence + 1);
+					}
+				}
+
+				if (!m_Writer.WriteRecords(l_Records.data() + l_Skip, p_Count - l_Skip))
+				{
+					return WriteStatus::WriteError;
+				}
+				for (unsigned int i(l_Skip); i < p_Count; ++i)
+				{
+					Apply(l_Records[i]);
+				}
+				if (++m_SinceCheckpoint >= m_CheckpointInterval)
+				{
+					Checkpoint(l_Lock);
+				}
+				return WriteStatus::Okay;
+			}
+
+			// The highest sequence written by p_Producer, 0 if none
+			const std::uint64_t HighWaterMark(const std::uint64_t& p_Producer) const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				const auto l_Mark(m_HighWater.find(p_Producer));
+				return l_Mark != m_HighWater.end() ? l_Mark->second : 0;
+			}
+
+			const std::size_t ProducerCount() const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return m_HighWater.size();
+			}
+
+			// The underlying writer, for reads, observers and flush settings;
+			// records must only be appended through this class
+			Writer& Underlying() noexcept
+			{
+				return m_Writer;
+			}
+	};
+
+	template<typename T> const std::uint32_t IdempotentWriter<T>::c_Magic;
+	template<typename T> const std::uint32_t IdempotentWriter<T>::c_Version;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace Bluebird
+{
+	// Hashes the bytes of a key with FNV-1a followed by a 64 bit finaliser.
+	// Unlike std::hash the result is the same on every platform and run, so
+	// it may be persisted in index files.  Keys with padding bytes must have
+	// them zeroed, as they take part in the hash.
+	template<typename K>
+	const std::uint64_t KeyHash(const K& p_Key) noexcept
+	{
+		static_assert(std::is_trivially_copyable<K>::value, "Hashed keys must be trivially copyable");
+
+		unsigned char l_Bytes[sizeof(K)];
+		std::memcpy(l_Bytes, &p_Key, sizeof(K));
+
+		std::uint64_t l_Hash(14695981039346656037ull);
+		for (std::size_t i(0); i < sizeof(K); ++i)
+		{
+			l_Hash ^= l_Bytes[i];
+			l_Hash *= 1099511628211ull;
+		}
+
+		l_Hash ^= l_Hash >> 33;
+		l_Hash *= 0xFF51AFD7ED558CCDull;
+		l_Hash ^= l_Hash >> 33;
+		l_Hash *= 0xC4CEB9FE1A85EC53ull;
+		l_Hash ^= l_Hash >> 33;
+		return l_Hash;
+	}
+
+	// KeyHash for scalar keys compared with operator== rather than bytewise,
+	// so keys that compare equal hash alike: both floating point zeros hash
+	// as +0.  Other key types may carry padding and are not accepted.
+	template<typename K>
+	const std::uint64_t ValueHash(const K& p_Key) noexcept
+	{
+		static_assert(std::is_arithmetic<K>::value || std::is_enum<K>::value, "Value hashed keys must be arithmetic or enum types");
+
+		return p_Key == K() ? KeyHash(K()) : KeyHash(p_Key);
+	}
+
+	// KeyHash as a hasher for the unordered containers
+	template<typename K>
+	struct KeyHasher
+	{
+		std::size_t operator()(const K& p_Key) const noexcept
+		{
+			return static_cast<std::size_t>(KeyHash(p_Key));
+		}
+	};
+}
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "FileUtils.h"
+#include "KeyHash.h"
+#include "SegmentedLog.h"
+
+namespace Bluebird
+{
+	// Key-value view over a SegmentedLog<T>: holds the latest record for every
+	// value of the key member K T::*, updated as records are appended.
+	//
+	// Every p_CheckpointInterval records a background thread writes the table
+	// to a checkpoint file along with the log position it covers, so a restart
+	// loads the checkpoint and replays only the records after it.  Once a
+	// checkpoint is written, sealed segments older than the checkpoint's
+	// segment are compacted: records superseded by a later record with the
+	// same key are dropped, provided at least p_MinDeadFraction of the segment
+	// would go.  Replaying a compacted log yields the same table.  Once a
+	// segment has been read for compaction the view counts its records as
+	// they are superseded, and only reads it again once enough have been.
+	template<typename T, typename K>
+	class KeyValueView
+	{
+		public:
+
+			enum class ViewStatus
+			{
+				Unknown,
+				ErrorReadingCheckpoint,
+				ErrorReadingLog,
+				Okay		=	255
+			};
+
+		private:
+
+			struct Entry
+			{
+				std::uint32_t	m_Segment;
+				T				m_Value;
+			};
+
+			struct CheckpointHeader
+			{
+				std::uint32_t	m_Magic;
+				std::uint32_t	m_Version;
+				std::uint32_t	m_KeySize;
+				std::uint32_t	m_RecordSize;
+				std::uint32_t	m_Segment;
+				std::uint32_t	m_Record;
+				std::uint64_t	m_Entries;
+			};
+
+			static const std::uint32_t	c_Magic = 0x5043564B;		// "KVCP"
+			static const std::uint32_t	c_Version = 1;
+
+			using Table = std::unordered_map<K, Entry, KeyHasher<K>>;
+
+			SegmentedLog<T>&		m_Log;
+			K T::*					m_Key;
+			const std::string		m_CheckpointFile;
+			const unsigned int		m_CheckpointInterval;
+			const double			m_MinDeadFraction;
+
+			Table					m_Latest;
+			unsigned int			m_CoveredSegment;
+			unsigned int			m_CoveredRecord;
+			unsigned int			m_SinceCheckpoint;
+			ViewStatus				m_Status;
+			std::vector<unsigned int>	m_Dead;		// Per segment, records superseded since it was last read
+			std::vector<char>		m_Counted;		// Per segment, non-zero once m_Dead is exact
+
+			mutable std::mutex		m_Lock;
+			std::condition_variable	m_Wake;
+			bool					m_CheckpointDue;
+			std::atomic<bool>		m_Stopping;
+			unsigned int			m_ObserverId;
+			bool					m_Registered;
+			std::thread				m_Worker;
+
+			KeyValueView() = delete;
+			KeyValueView(const KeyValueView&) = delete;
+
+			// Grows the per segment counts to cover p_Segment
+			void Track(const unsigned int& p_Segment)
+			{
+				if (m_Dead.size() <= p_Segment)
+				{
+					m_Dead.resize(p_Segment + 1, 0);
+					m_Counted.resize(p_Segment + 1, 0);
+				}
+			}
+
+			void Apply(const unsigned int& p_Segment, const unsigned int& p_Record, const T& p_Value)
+			{
+				const auto l_Found(m_Latest.find(p_Value.*m_Key));
+				if (l_Found != m_Latest.end())
+				{
+					Track(l_Found->second.m_Segment);
+					++m_Dead[l_Found->second.m_Segment];
+				}
+				Entry& l_Entry(l_Found != m_Latest.end() ? l_Found->second : m_Latest[p_Value.*m_Key]);
+				l_Entry.m_Segment = p_Segment;
+				l_Entry.m_Value = p_Value;
+				m_CoveredSegment = p_Segment;
+				m_CoveredRecord = p_Record + 1;
+			}
+
+			const bool LoadCheckpoint()
+			{
+				std::ifstream l_File(m_CheckpointFile, std::ios_base::in | std::ios_base::binary);
+				if (!l_File.good())
+				{
+					return true;
+				}
+
+				CheckpointHeader l_Header;
+				if (!l_File.read(reinterpret_cast<char*>(&l_Header), sizeof(l_Header)) ||
+					l_Header.m_Magic != c_Magic ||
+					l_Header.m_Version != c_Version ||
+					l_Header.m_KeySize != sizeof(K) ||
+					l_Header.m_RecordSize != sizeof(T))
+				{
+					return false;
+				}
+
+				std::vector<Entry> l_Entries(static_cast<std::size_t>(l_Header.m_Entries));
+				if (!l_Entries.empty() &&
+					!l_File.read(reinterpret_cast<char*>(l_Entries.data()), l_Entries.size() * sizeof(Entry)))
+				{
+					return false;
+				}
+
+				m_Latest.reserve(l_Entries.size());
+				for (const auto& l_Entry : l_Entries)
+				{
+					m_Latest[l_Entry.m_Value.*m_Key] = l_Entry;
+				}
+				m_CoveredSegment = l_Header.m_Segment;
+				m_CoveredRecord = l_Header.m_Record;
+				return true;
+			}
+
+			const bool WriteCheckpoint(const std::vector<Entry>& p_Entries, const unsigned int& p_Segment, const unsigned int& p_Record) const
+			{
+				const std::string l_Temporary(m_CheckpointFile + ".tmp");
+				{
+					std::ofstream l_File(l_Temporary, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+					const CheckpointHeader l_Header{ c_Magic, c_Version, sizeof(K), sizeof(T), p_Segment, p_Record, p_Entries.size() };
+					l_File.write(reinterpret_cast<const char*>(&l_Header), sizeof(l_Header));
+					l_File.write(reinterpret_cast<const char*>(p_Entries.data()), p_Entries.size() * sizeof(Entry));
+					l_File.flush();
+					if (!l_File.good())
+					{
+						return false;
+					}
+				}
+#ifndef _WIN32
+				sync();
+#endif
+				return RenameOverFile(l_Temporary, m_CheckpointFile);
+			}
+
+			// Rewrites sealed segments below p_Limit without their superseded
+			// records.  Segments are read without the log's lock, which is only
+			// taken to swap one in
+			void Compact(const unsigned int& p_Limit)
+			{
+				std::vector<T> l_Records;
+				std::vector<T> l_Kept;
+				for (unsigned int l_Segment(0); l_Segment < p_Limit && !m_Stopping; ++l_Segment)
+				{
+					if (l_Segment >= m_Log.ActiveSegment())
+					{
+						break;
+					}
+
+					l_Records.resize(m_Log.SegmentRecordCount(l_Segment));
+					{
+						// Not worth reading until enough of it is known to be dead
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						if (l_Segment < m_Counted.size() &&
+							m_Counted[l_Segment] != 0 &&
+							(m_Dead[l_Segment] == 0 || m_Dead[l_Segment] < m_MinDeadFraction * l_Records.size()))
+						{
+							continue;
+						}
+					}
+
+					if (l_Records.empty() ||
+						m_Log.ReadSegmentRecords(l_Segment, 0, static_cast<unsigned int>(l_Records.size()), l_Records.data()) !=
+							SegmentedLog<T>::RecordReadStatus::Okay)
+					{
+						continue;
+					}
+
+					// A record survives if its key's latest record is not in a later
+					// segment and no later record of this segment has the same key
+					std::unordered_map<K, std::size_t, KeyHasher<K>> l_LastInSegment;
+					for (std::size_t i(0); i < l_Records.size(); ++i)
+					{
+						l_LastInSegment[l_Records[i].*m_Key] = i;
+					}
+
+					l_Kept.clear();
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						for (std::size_t i(0); i < l_Records.size(); ++i)
+						{
+							const K& l_Key(l_Records[i].*m_Key);
+							const auto l_Latest(m_Latest.find(l_Key));
+							if (l_LastInSegment[l_Key] == i &&
+								(l_Latest == m_Latest.end() || l_Latest->second.m_Segment <= l_Segment))
+							{
+								l_Kept.push_back(l_Records[i]);
+							}
+						}
+
+						// Kept records superseded from here on are counted afresh
+						Track(l_Segment);
+						m_Dead[l_Segment] = 0;
+						m_Counted[l_Segment] = 1;
+					}
+
+					const std::size_t l_Dead(l_Records.size() - l_Kept.size());
+					bool l_Replaced(false);
+					if (l_Dead > 0 && l_Dead >= m_MinDeadFraction * l_Records.size())
+					{
+						std::lock_guard<std::recursive_mutex> l_LogLock(m_Log.Lock());
+						l_Replaced =
+							m_Log.SegmentRecordCount(l_Segment) == l_Records.size() &&
+							m_Log.ReplaceSegment(l_Segment, l_Kept.data(), static_cast<unsigned int>(l_Kept.size()));
+					}
+					if (!l_Replaced)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						m_Dead[l_Segment] += static_cast<unsigned int>(l_Dead);
+					}
+				}
+			}
+
+			void Run()
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				while (true)
+				{
+					m_Wake.wait(l_Lock, [this]() { return m_CheckpointDue || m_Stopping; });
+					if (!m_CheckpointDue)
+					{
+						break;
+					}
+
+					m_CheckpointDue = false;
+					m_SinceCheckpoint = 0;
+					std::vector<Entry> l_Entries;
+					l_Entries.reserve(m_Latest.size());
+					for (const auto& l_Entry : m_Latest)
+					{
+						l_Entries.push_back(l_Entry.second);
+					}
+					const unsigned int l_Segment(m_CoveredSegment);
+					const unsigned int l_Record(m_CoveredRecord);
+
+					l_Lock.unlock();
+					if (WriteCheckpoint(l_Entries, l_Segment, l_Record))
+					{
+						Compact(l_Segment);
+					}
+					l_Lock.lock();
+				}
+			}
+
+		public:
+
+			KeyValueView(
+				SegmentedLog<T>& p_Log,
+				K T::* p_Key,
+				const std::string& p_CheckpointFile,
+				const unsigned int& p_CheckpointInterval = 1u << 16,
+				const double& p_MinDeadFraction = 0.25)
+				:
+				m_Log(p_Log),
+				m_Key(p_Key),
+				m_CheckpointFile(p_CheckpointFile),
+				m_CheckpointInterval(p_CheckpointInterval != 0 ? p_CheckpointInterval : 1),
+				m_MinDeadFraction(p_MinDeadFraction),
+				m_Latest(),
+				m_CoveredSegment(0),
+				m_CoveredRecord(0),
+				m_SinceCheckpoint(0),
+				m_Status(ViewStatus::Unknown),
+				m_Dead(),
+				m_Counted(),
+				m_Lock(),
+				m_Wake(),
+				m_CheckpointDue(false),
+				m_Stopping(false),
+				m_ObserverId(0),
+				m_Registered(false),
+				m_Worker()
+			{
+				if (!LoadCheckpoint())
+				{
+					m_Latest.clear();
+					m_CoveredSegment = 0;
+					m_CoveredRecord = 0;
+					m_Status = ViewStatus::ErrorReadingCheckpoint;
+				}
+
+				// Replays every record after the covered position on the way in
+				m_Registered = m_Log.AddWriteObserver(
+					[this](const unsigned int& p_Segment, const unsigned int& p_Record, const T& p_Value)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						Apply(p_Segment, p_Record, p_Value);
+						if (++m_SinceCheckpoint >= m_CheckpointInterval)
+						{
+							m_CheckpointDue = true;
+							m_Wake.notify_one();
+						}
+					},
+					m_CoveredSegment,
+					m_CoveredRecord,
+					m_ObserverId) == SegmentedLog<T>::RecordReadStatus::Okay;
+				if (!m_Registered)
+				{
+					m_Status = ViewStatus::ErrorReadingLog;
+				}
+				else if (m_Status == ViewStatus::Unknown)
+				{
+					m_Status = ViewStatus::Okay;
+				}
+				m_Worker = std::thread(&KeyValueView::Run, this);
+			}
+
+			// Stops the background thread after a final checkpoint
+			virtual ~KeyValueView()
+			{
+				if (m_Registered)
+				{
+					m_Log.RemoveObserver(m_ObserverId);
+				}
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_CheckpointDue = m_SinceCheckpoint > 0;
+					m_Stopping = true;
+				}
+				m_Wake.notify_one();
+				m_Worker.join();
+			}
+
+			const ViewStatus& Status() const noexcept
+			{
+				return m_Status;
+			}
+
+			const bool Get(const K& p_Key, T& p_Value) const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				const auto l_Entry(m_Latest.find(p_Key));
+				if (l_Entry == m_Latest.end())
+				{
+					return false;
+				}
+
+				p_Value = l_Entry->second.m_Value;
+				return true;
+			}
+
+			const std::size_t Size() const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return m_Latest.size();
+			}
+
+			// Asks the background thread for a checkpoint (and compaction) now
+			void RequestCheckpoint()
+			{
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_CheckpointDue = true;
+				}
+				m_Wake.notify_one();
+			}
+	};
+
+	template<typename T, typename K> const std::uint32_t KeyValueView<T, K>::c_Magic;
+	template<typename T, typename K> const std::uint32_t KeyValueView<T, K>::c_Version;
+}
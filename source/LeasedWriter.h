@@ -0,0 +1,316 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#ifndef _WIN32
+	#include <sys/file.h>
+#endif
+
+#include "CumulativeWriter.h"
+#include "FileUtils.h"
+#include "MappedFile.h"
+
+namespace Bluebird
+{
+	// A CumulativeWriter<T> that only the holder of a lease may append to, so
+	// a standby process can take over from a failed writer straight away.
+	//
+	// The lease is an exclusive advisory lock on "<file>.lease", which the
+	// operating system drops the moment the holding process dies, so the
+	// standby does not wait for failure detection.  The lease file also holds
+	// a fencing epoch, bumped by every new holder, and the record count the
+	// holder last acknowledged.  Each append first checks that the epoch is
+	// still its own, so a writer that has lost the lease is rejected as
+	// Fenced rather than interleaving with its successor.
+	//
+	// Taking over reads the acknowledged count from the lease file and cuts
+	// off anything the failed writer appended beyond it, instead of scanning
+	// the log to verify its tail.  The count is flushed to the lease file
+	// before an append returns Okay, so it never trails what was acknowledged.
+	template<typename T>
+	class LeasedWriter
+	{
+		public:
+
+			using Writer = CumulativeWriter<T>;
+
+			enum class LeaseStatus
+			{
+				Unknown,
+				HeldElsewhere,
+				LeaseFileError,
+				Okay		=	255
+			};
+
+			enum class WriteStatus
+			{
+				Unknown,
+				NotHeld,
+				Fenced,			// Another process has taken the lease since it was acquired
+				WriteError,
+				Okay		=	255
+			};
+
+		private:
+
+			// Lives in the lease file; a new, zero filled file means epoch 0 and nothing acknowledged
+			struct LeaseHeader
+			{
+				std::uint32_t				m_Magic;
+				std::uint32_t				m_RecordSize;
+				std::atomic<std::uint64_t>	m_Epoch;
+				std::atomic<std::uint64_t>	m_Records;
+			};
+
+			static const std::uint32_t	c_Magic = 0x5345414C;		// "LEAS"
+
+			const std::string			m_Filename;
+			MappedFile					m_LeaseFile;
+			LeaseHeader*				m_Header;
+#ifdef _WIN32
+			HANDLE						m_LockFile;
+#else
+			int							m_LockFile;
+#endif
+			std::uint64_t				m_Epoch;
+			std::unique_ptr<Writer>		m_Writer;
+			std::mutex					m_Lock;
+
+			LeasedWriter() = delete;
+			LeasedWriter(const LeasedWriter&) = delete;
+
+			const bool Lock() noexcept
+			{
+#ifdef _WIN32
+				OVERLAPPED l_Overlapped{ 0 };
+				return LockFileEx(m_LockFile, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &l_Overlapped) != 0;
+#else
+				return ::flock(m_LockFile, LOCK_EX | LOCK_NB) == 0;
+#endif
+			}
+
+			void Unlock() noexcept
+			{
+#ifdef _WIN32
+				OVERLAPPED l_Overlapped{ 0 };
+				UnlockFileEx(m_LockFile, 0, 1, 0, &l_Overlapped);
+#else
+				::flock(m_LockFile, LOCK_UN);
+#endif
+			}
+
+			const bool Fenced() const noexcept
+			{
+				return m_Header->m_Epoch.load() != m_Epoch;
+			}
+
+			// With the lock held: fences the last holder, cuts the log back to
+			// the count it acknowledged and opens it
+			const bool TakeOver(std::uint64_t& p_Epoch)
+			{
+				if (m_Header->m_Magic != c_Magic || m_Header->m_RecordSize != sizeof(T))
+				{
+					// First holder: everything already in the log is acknowledged
+					Writer l_Existing(m_Filename);
+					m_Header->m_Records = l_Existing.RecordCount();
+					m_Header->m_RecordSize = sizeof(T);
+					m_Header->m_Magic = c_Magic;
+				}
+				p_Epoch = m_Header->m_Epoch.load() + 1;
+				m_Header->m_Epoch = p_Epoch;
+				if (!m_LeaseFile.Flush())
+				{
+					return false;
+				}
+
+				const unsigned long long l_Acknowledged(m_Header->m_Records.load() * sizeof(T));
+				unsigned long long l_Size(0);
+				if (FileSize(m_Filename, l_Size) && l_Size > l_Acknowledged && !TruncateFile(m_Filename, l_Acknowledged))
+				{
+					return false;
+				}
+				m_Writer.reset(new Writer(m_Filename));
+				if (m_Writer->RecordCount() < m_Header->m_Records.load())
+				{
+					m_Header->m_Records = m_Writer->RecordCount();
+					return m_LeaseFile.Flush();
+				}
+				return true;
+			}
+
+		public:
+
+			LeasedWriter(const std::string& p_Filename)
+				:
+				m_Filename(p_Filename),
+				m_LeaseFile(p_Filename + ".lease"),
+				m_Header(nullptr),
+#ifdef _WIN32
+				m_LockFile(INVALID_HANDLE_VALUE),
+#else
+				m_LockFile(-1),
+#endif
+				m_Epoch(0),
+				m_Writer(),
+				m_Lock()
+			{
+				if (!m_LeaseFile.Valid() ||
+					(m_LeaseFile.Size() < sizeof(LeaseHeader) && !m_LeaseFile.Resize(sizeof(LeaseHeader))))
+				{
+					return;
+				}
+#ifdef _WIN32
+				m_LockFile = CreateFileA(
+					(p_Filename + ".lease").c_str(),
+					GENERIC_READ | GENERIC_WRITE,
+					FILE_SHARE_READ | FILE_SHARE_WRITE,
+					NULL,
+					OPEN_EXISTING,
+					FILE_ATTRIBUTE_NORMAL,
+					NULL);
+				if (m_LockFile == INVALID_HANDLE_VALUE)
+				{
+					return;
+				}
+#else
+				m_LockFile = ::open((p_Filename + ".lease").c_str(), O_RDWR);
+				if (m_LockFile < 0)
+				{
+					return;
+				}
+#endif
+				m_Header = reinterpret_cast<LeaseHeader*>(m_LeaseFile.Data());
+			}
+
+			virtual ~LeasedWriter()
+			{
+				Release();
+#ifdef _WIN32
+				if (m_LockFile != INVALID_HANDLE_VALUE)
+				{
+					CloseHandle(m_LockFile);
+				}
+#else
+				if (m_LockFile >= 0)
+				{
+					::close(m_LockFile);
+				}
+#endif
+			}
+
+			// Takes the lease if no other process holds it, then opens the log
+			// at the count the last holder acknowledged
+			const LeaseStatus TryAcquire()
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_Header == nullptr)
+				{
+					return LeaseStatus::LeaseFileError;
+				}
+				if (m_Writer != nullptr)
+				{
+					return LeaseStatus::Okay;
+				}
+				if (!Lock())
+				{
+					return LeaseStatus::HeldElsewhere;
+				}
+
+				std::uint64_t l_Epoch(0);
+				if (!TakeOver(l_Epoch))
+				{
+					m_Writer.reset();
+					Unlock();
+					return LeaseStatus::LeaseFileError;
+				}
+				m_Epoch = l_Epoch;
+				return LeaseStatus::Okay;
+			}
+
+			// Retries TryAcquire until it succeeds or p_Timeout passes
+			const LeaseStatus Acquire(
+				const std::chrono::milliseconds& p_Timeout,
+				const std::chrono::milliseconds& p_Poll = std::chrono::milliseconds(10))
+			{
+				const auto l_Deadline(std::chrono::steady_clock::now() + p_Timeout);
+				while (true)
+				{
+					const LeaseStatus l_Status(TryAcquire());
+					if (l_Status != LeaseStatus::HeldElsewhere || std::chrono::steady_clock::now() >= l_Deadline)
+					{
+						return l_Status;
+					}
+					std::this_thread::sleep_for(p_Poll);
+				}
+			}
+
+			void Release() noexcept
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_Writer != nullptr)
+				{
+					m_Writer.reset();
+					Unlock();
+				}
+			}
+
+			const bool HoldsLease() noexcept
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return m_Writer != nullptr && !Fenced();
+			}
+
+			// The fencing epoch this writer acquired the lease at, 0 if never
+			const std::uint64_t& Epoch() const noexcept
+			{
+				return m_Epoch;
+			}
+
+			const WriteStatus Write(const T* p_Record)
+			{
+				return WriteRecords(p_Record, 1);
+			}
+
+			const WriteStatus WriteRecords(const T* p_Records, const unsigned int& p_Count)
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_Writer == nullptr)
+				{
+					return WriteStatus::NotHeld;
+				}
+				if (Fenced())
+				{
+					return WriteStatus::Fenced;
+				}
+				if (!m_Writer->WriteRecords(p_Records, p_Count))
+				{
+					return WriteStatus::WriteError;
+				}
+				m_Header->m_Records = m_Writer->RecordCount();
+				if (!m_LeaseFile.Flush())
+				{
+					return WriteStatus::WriteError;
+				}
+				return WriteStatus::Okay;
+			}
+
+			// Records acknowledged by the current holder, as seen from any process
+			const std::uint64_t AcknowledgedRecords() const noexcept
+			{
+				return m_Header != nullptr ? m_Header->m_Records.load() : 0;
+			}
+
+			// The log itself while the lease is held, for reads; nullptr otherwise
+			Writer* Underlying() noexcept
+			{
+				return m_Writer.get();
+			}
+	};
+
+	template<typename T> const std::uint32_t LeasedWriter<T>::c_Magic;
+}
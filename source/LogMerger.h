@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <type_traits>
+#include <vector>
+
+#include "CumulativeWriter.h"
+
+namespace Bluebird
+{
+	template<typename K>
+	inline const bool KeyLess(const K& p_Left, const K& p_Right, std::false_type)
+	{
+		return p_Left < p_Right;
+	}
+
+	template<typename K>
+	inline const bool KeyLess(const K& p_Left, const K& p_Right, std::true_type)
+	{
+		return std::isnan(p_Right) ? !std::isnan(p_Left) : p_Left < p_Right;
+	}
+
+	// Orders keys by operator<, except that floating point NaNs come after
+	// every other value, so such keys still sort and merge consistently
+	template<typename K>
+	inline const bool KeyLess(const K& p_Left, const K& p_Right)
+	{
+		return KeyLess(p_Left, p_Right, std::is_floating_point<K>());
+	}
+
+	// Merges several CumulativeWriter<T> logs, each already ordered by the key
+	// member K T::*, into one ordered output log.
+	//
+	// A loser tree picks the next record in log2(k) comparisons.  Every input
+	// is double buffered: while the merge consumes one block of p_Readahead
+	// records the next block is read in the background, and the merged output
+	// is appended p_WriteBatch records at a time, again off the merge thread.
+	// Equal keys are taken from the lower numbered input first, and keys are
+	// compared with KeyLess, so NaN keys are expected last in each input.
+	//
+	// A failed read stops the merge where it is and nothing more is appended,
+	// but batches already handed to the output stay there, so on ReadError
+	// the output holds an ordered prefix at most and should be discarded.
+	template<typename T, typename K>
+	class LogMerger
+	{
+		public:
+
+			enum class MergeStatus
+			{
+				Unknown,
+				NoInputs,
+				ReadError,
+				WriteError,
+				Okay		=	255
+			};
+
+		private:
+
+			using ReadStatus = typename CumulativeWriter<T>::RecordReadStatus;
+
+			struct Input
+			{
+				CumulativeWriter<T>*		m_Log;
+				unsigned int				m_NextRead;
+				std::vector<T>				m_Front;
+				std::vector<T>				m_Back;
+				std::size_t					m_Position;
+				std::future<ReadStatus>		m_Pending;
+				bool						m_Exhausted;
+			};
+
+			K T::*				m_Key;
+			const unsigned int	m_Readahead;
+			const unsigned int	m_WriteBatch;
+
+			std::vector<Input>			m_Inputs;
+			std::vector<std::size_t>	m_Tree;
+			bool						m_ReadFailed;
+
+			LogMerger() = delete;
+			LogMerger(const LogMerger&) = delete;
+
+			void StartRead(Input& p_Input)
+			{
+				const unsigned int l_Remaining(p_Input.m_Log->RecordCount() - p_Input.m_NextRead);
+				const unsigned int l_Count(std::min(l_Remaining, m_Readahead));
+				p_Input.m_Back.resize(l_Count);
+				if (l_Count == 0)
+				{
+					return;
+				}
+
+				CumulativeWriter<T>* l_Log(p_Input.m_Log);
+				T* l_Target(p_Input.m_Back.data());
+				const unsigned int l_First(p_Input.m_NextRead);
+				p_Input.m_NextRead += l_Count;
+				p_Input.m_Pending = std::async(
+					std::launch::async,
+					[l_Log, l_First, l_Count, l_Target]()
+					{
+						return l_Log->ReadRecords(l_First, l_Count, l_Target);
+					});
+			}
+
+			// Swaps the block read in the background to the front and queues the next one
+			void Advance(Input& p_Input)
+			{
+				if (!p_Input.m_Pending.valid())
+				{
+					p_Input.m_Exhausted = true;
+					return;
+				}
+
+				if (p_Input.m_Pending.get() != ReadStatus::Okay)
+				{
+					m_ReadFailed = true;
+					p_Input.m_Exhausted = true;
+					return;
+				}
+
+				std::swap(p_Input.m_Front, p_Input.m_Back);
+				p_Input.m_Position = 0;
+				StartRead(p_Input);
+			}
+
+			const T& Head(const std::size_t& p_Input) const
+			{
+				return m_Inputs[p_Input].m_Front[m_Inputs[p_Input].m_Position];
+			}
+
+			const bool Less(const std::size_t& p_Left, const std::size_t& p_Right) const
+			{
+				if (m_Inputs[p_Left].m_Exhausted)
+				{
+					return false;
+				}
+				if (m_Inputs[p_Right].m_Exhausted)
+				{
+					return true;
+				}
+
+				const K& l_Left(Head(p_Left).*m_Key);
+				const K& l_Right(Head(p_Right).*m_Key);
+				if (KeyLess(l_Left, l_Right))
+				{
+					return true;
+				}
+				if (KeyLess(l_Right, l_Left))
+				{
+					return false;
+				}
+				return p_Left < p_Right;
+			}
+
+			// Plays the subtree under p_Node, leaving losers in the internal nodes
+			const std::size_t Build(const std::size_t& p_Node)
+			{
+				const std::size_t l_Leaves(m_Inputs.size());
+				if (p_Node >= l_Leaves)
+				{
+					return p_Node - l_Leaves;
+				}
+
+				const std::size_t l_Left(Build(p_Node * 2));
+				const std::size_t l_Right(Build(p_Node * 2 + 1));
+				if (Less(l_Left, l_Right))
+				{
+					m_Tree[p_Node] = l_Right;
+					return l_Left;
+				}
+				m_Tree[p_Node] = l_Left;
+				return l_Right;
+			}
+
+			// Replays the path from p_Winner's leaf to the root after its head changed
+			void Replay(std::size_t p_Winner)
+			{
+				for (std::size_t l_Node((p_Winner + m_Inputs.size()) / 2); l_Node > 0; l_Node /= 2)
+				{
+					if (Less(m_Tree[l_Node], p_Winner))
+					{
+						std::swap(m_Tree[l_Node], p_Winner);
+					}
+				}
+				m_Tree[0] = p_Winner;
+			}
+
+		public:
+
+			LogMerger(K T::* p_Key, const unsigned int& p_Readahead = 4096, const unsigned int& p_WriteBatch = 4096)
+				:
+				m_Key(p_Key),
+				m_Readahead(std::max(1u, p_Readahead)),
+				m_WriteBatch(std::max(1u, p_WriteBatch)),
+				m_Inputs(),
+				m_Tree(),
+				m_ReadFailed(false)
+			{
+			}
+
+			const MergeStatus Merge(const std::vector<CumulativeWriter<T>*>& p_Inputs, CumulativeWriter<T>& p_Output)
+			{
+				if (p_Inputs.empty())
+				{
+					return MergeStatus::NoInputs;
+				}
+
+				m_ReadFailed = false;
+				m_Inputs.clear();
+				m_Inputs.resize(p_Inputs.size());
+				for (std::size_t i(0); i < p_Inputs.size(); ++i)
+				{
+					m_Inputs[i].m_Log = p_Inputs[i];
+					m_Inputs[i].m_NextRead = 0;
+					m_Inputs[i].m_Position = 0;
+					m_Inputs[i].m_Exhausted = false;
+					StartRead(m_Inputs[i]);
+				}
+				for (auto& l_Input : m_Inputs)
+				{
+					Advance(l_Input);
+				}
+
+				m_Tree.assign(m_Inputs.size(), 0);
+				m_Tree[0] = m_Inputs.size() > 1 ? Build(1) : 0;
+
+				std::vector<T> l_Output;
+				std::vector<T> l_Flushing;
+				std::future<bool> l_PendingWrite;
+				bool l_WriteFailed(false);
+				l_Output.reserve(m_WriteBatch);
+
+				while (!m_ReadFailed && !m_Inputs[m_Tree[0]].m_Exhausted)
+				{
+					const std::size_t l_Winner(m_Tree[0]);
+					Input& l_Input(m_Inputs[l_Winner]);
+					l_Output.push_back(l_Input.m_Front[l_Input.m_Position]);
+
+					if (++l_Input.m_Position == l_Input.m_Front.size())
+					{
+						Advance(l_Input);
+						if (m_ReadFailed)
+						{
+							break;
+						}
+					}
+					Replay(l_Winner);
+
+					if (l_Output.size() == m_WriteBatch)
+					{
+						if (l_PendingWrite.valid() && !l_PendingWrite.get())
+						{
+							l_WriteFailed = true;
+							break;
+						}
+
+						std::swap(l_Output, l_Flushing);
+						l_Output.clear();
+						l_PendingWrite = std::async(
+							std::launch::async,
+							[&p_Output, &l_Flushing]()
+							{
+								return p_Output.WriteRecords(l_Flushing.data(), static_cast<unsigned int>(l_Flushing.size()));
+							});
+					}
+				}
+
+				if (l_PendingWrite.valid() && !l_PendingWrite.get())
+				{
+					l_WriteFailed = true;
+				}
+				if (!l_WriteFailed && !m_ReadFailed && !p_Output.WriteRecords(l_Output.data(), static_cast<unsigned int>(l_Output.size())))
+				{
+					l_WriteFailed = true;
+				}
+
+				// Drain any reads still in flight before the buffers go away
+				for (auto& l_Input : m_Inputs)
+				{
+					if (l_Input.m_Pending.valid())
+					{
+						l_Input.m_Pending.wait();
+					}
+				}
+
+				if (m_ReadFailed)
+				{
+					return MergeStatus::ReadError;
+				}
+				return l_WriteFailed ? MergeStatus::WriteError : MergeStatus::Okay;
+			}
+	};
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#else
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <Windows.h>
+#endif
+
+namespace Bluebird
+{
+	// A whole file mapped into memory, shared with the file so stores through
+	// Data() reach the file.  Writable mappings create the file if needed and
+	// can be resized, which remaps it, so pointers into Data() do not survive
+	// a Resize.
+	class MappedFile
+	{
+		private:
+
+			std::string		m_Filename;
+			const bool		m_ReadOnly;
+#ifdef _WIN32
+			HANDLE			m_File;
+			HANDLE			m_Mapping;
+#else
+			int				m_File;
+#endif
+			std::uint8_t*	m_Data;
+			std::size_t		m_Size;
+
+			MappedFile() = delete;
+			MappedFile(const MappedFile&) = delete;
+
+			void Unmap() noexcept
+			{
+				if (m_Data != nullptr)
+				{
+#ifdef _WIN32
+					UnmapViewOfFile(m_Data);
+					CloseHandle(m_Mapping);
+					m_Mapping = NULL;
+#else
+					munmap(m_Data, m_Size);
+#endif
+					m_Data = nullptr;
+				}
+			}
+
+			const bool Map() noexcept
+			{
+				if (m_Size == 0)
+				{
+					return true;
+				}
+
+#ifdef _WIN32
+				const unsigned long long l_Size(m_Size);
+				m_Mapping = CreateFileMappingA(
+					m_File,
+					NULL,
+					m_ReadOnly ? PAGE_READONLY : PAGE_READWRITE,
+					static_cast<DWORD>(l_Size >> 32),
+					static_cast<DWORD>(l_Size & 0xFFFFFFFF),
+					NULL);
+				if (m_Mapping == NULL)
+				{
+					return false;
+				}
+
+				m_Data = static_cast<std::uint8_t*>(MapViewOfFile(
+					m_Mapping,
+					m_ReadOnly ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS,
+					0,
+					0,
+					m_Size));
+				if (m_Data == nullptr)
+				{
+					CloseHandle(m_Mapping);
+					m_Mapping = NULL;
+					return false;
+				}
+#else
+				void* l_Data(mmap(
+					nullptr,
+					m_Size,
+					m_ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE,
+					MAP_SHARED,
+					m_File,
+					0));
+				if (l_Data == MAP_FAILED)
+				{
+					return false;
+				}
+				m_Data = static_cast<std::uint8_t*>(l_Data);
+#endif
+				return true;
+			}
+
+		public:
+
+			MappedFile(const std::string& p_Filename, const bool& p_ReadOnly = false)
+				:
+				m_Filename(p_Filename),
+				m_ReadOnly(p_ReadOnly),
+#ifdef _WIN32
+				m_File(INVALID_HANDLE_VALUE),
+				m_Mapping(NULL),
+#else
+				m_File(-1),
+#endif
+				m_Data(nullptr),
+				m_Size(0)
+			{
+#ifdef _WIN32
+				m_File = CreateFileA(
+					m_Filename.c_str(),
+					m_ReadOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+					FILE_SHARE_READ | FILE_SHARE_WRITE,
+					NULL,
+					m_ReadOnly ? OPEN_EXISTING : OPEN_ALWAYS,
+					FILE_ATTRIBUTE_NORMAL,
+					NULL);
+				LARGE_INTEGER l_FileSize;
+				if (m_File != INVALID_HANDLE_VALUE && GetFileSizeEx(m_File, &l_FileSize) != 0)
+				{
+					m_Size = static_cast<std::size_t>(l_FileSize.QuadPart);
+				}
+#else
+				m_File = open(m_Filename.c_str(), m_ReadOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+				struct stat l_Stat;
+				if (m_File >= 0 && fstat(m_File, &l_Stat) == 0)
+				{
+					m_Size = static_cast<std::size_t>(l_Stat.st_size);
+				}
+#endif
+				if (Valid() && !Map())
+				{
+					Close();
+				}
+			}
+
+			virtual ~MappedFile()
+			{
+				Close();
+			}
+
+			const bool Valid() const noexcept
+			{
+#ifdef _WIN32
+				return m_File != INVALID_HANDLE_VALUE;
+#else
+				return m_File >= 0;
+#endif
+			}
+
+			const std::string& Filename() const noexcept
+			{
+				return m_Filename;
+			}
+
+			const std::size_t& Size() const noexcept
+			{
+				return m_Size;
+			}
+
+			std::uint8_t* Data() noexcept
+			{
+				return m_Data;
+			}
+
+			const std::uint8_t* Data() const noexcept
+			{
+				return m_Data;
+			}
+
+			// Grows or shrinks the file to p_Size bytes and remaps it, new bytes read as zero
+			const bool Resize(const std::size_t& p_Size) noexcept
+			{
+				if (!Valid() || m_ReadOnly)
+				{
+					return false;
+				}
+
+				Unmap();
+#ifdef _WIN32
+				LARGE_INTEGER l_Size;
+				l_Size.QuadPart = static_cast<LONGLONG>(p_Size);
+				if (SetFilePointerEx(m_File, l_Size, NULL, FILE_BEGIN) == 0 ||
+					SetEndOfFile(m_File) == 0)
+				{
+					Map();
+					return false;
+				}
+#else
+				if (ftruncate(m_File, static_cast<off_t>(p_Size)) != 0)
+				{
+					Map();
+					return false;
+				}
+#endif
+				m_Size = p_Size;
+				return Map();
+			}
+
+			// Writes dirty pages of the mapping back to the file
+			const bool Flush() noexcept
+			{
+				if (m_Data == nullptr || m_ReadOnly)
+				{
+					return Valid();
+				}
+#ifdef _WIN32
+				return FlushViewOfFile(m_Data, m_Size) != 0 && FlushFileBuffers(m_File) != 0;
+#else
+				return msync(m_Data, m_Size, MS_SYNC) == 0;
+#endif
+			}
+
+			void Close() noexcept
+			{
+				Unmap();
+#ifdef _WIN32
+				if (m_File != INVALID_HANDLE_VALUE)
+				{
+					CloseHandle(m_File);
+					m_File = INVALID_HANDLE_VALUE;
+				}
+#else
+				if (m_File >= 0)
+				{
+					close(m_File);
+					m_File = -1;
+				}
+#endif
+				m_Size = 0;
+			}
+	};
+}
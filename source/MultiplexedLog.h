@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CumulativeWriter.h"
+
+namespace Bluebird
+{
+	// Many logical streams of T appended to one physical CumulativeWriter, so
+	// a single write, and a single sync, can carry records for any number of
+	// streams.  Each physical record is tagged with its stream id and an
+	// in-memory index maps every stream to its physical record positions;
+	// the index is rebuilt by scanning the physical file on open.
+	//
+	// A background thread copies each stream's records, every p_Interval,
+	// into a view file of its own ("<file>.stream.000042"), so reading a
+	// stream is a sequential read of its view rather than a gather across the
+	// physical file.  Records not yet in a view are read from the physical
+	// file.  Views are only a cache: at open a view holding more records than
+	// its stream has was not built from this physical file and is rebuilt
+	// from it, though view contents are not otherwise checked against it.
+	// View handles go through the process FilePool so thousands of streams
+	// do not mean thousands of open files.
+	template<typename T>
+	class MultiplexedLog
+	{
+		public:
+
+			struct StreamRecord
+			{
+				std::uint32_t	m_Stream;
+				std::uint32_t	m_Reserved;
+				T				m_Record;
+			};
+
+			using Physical = CumulativeWriter<StreamRecord>;
+			using View = CumulativeWriter<T>;
+			using RecordReadStatus = typename View::RecordReadStatus;
+
+		private:
+
+			struct Stream
+			{
+				std::vector<unsigned int>	m_Positions;		// Physical index of every record in the stream
+				unsigned int				m_Materialized;		// Records [0, m_Materialized) are in m_View
+				std::unique_ptr<View>		m_View;
+			};
+
+			static const unsigned int	c_ScanRecords = 4096;
+
+			const std::string						m_Filename;
+			const std::chrono::milliseconds			m_Interval;
+			Physical								m_Physical;
+			std::map<unsigned int, Stream>			m_Streams;
+			mutable std::mutex						m_Lock;
+			std::mutex								m_MaterializeLock;
+			std::condition_variable					m_Wake;
+			bool									m_Stopping;
+			std::thread								m_Worker;
+
+			MultiplexedLog() = delete;
+			MultiplexedLog(const MultiplexedLog&) = delete;
+
+			Stream& OpenStream(const unsigned int& p_Stream)
+			{
+				Stream& l_Stream(m_Streams[p_Stream]);
+				if (l_Stream.m_View == nullptr)
+				{
+					l_Stream.m_Materialized = 0;
+					l_Stream.m_View.reset(new View(ViewFilename(p_Stream)));
+					l_Stream.m_View->UseFilePool();
+				}
+				return l_Stream;
+			}
+
+			void Index(const unsigned int& p_First, const StreamRecord* p_Records, const unsigned int& p_Count)
+			{
+				for (unsigned int i(0); i < p_Count; ++i)
+				{
+					OpenStream(p_Records[i].m_Stream).m_Positions.push_back(p_First + i);
+				}
+			}
+
+			const bool BuildIndex()
+			{
+				std::vector<StreamRecord> l_Block(c_ScanRecords);
+				const unsigned int l_Total(m_Physical.RecordCount());
+				for (unsigned int l_First(0); l_First < l_Total; l_First += c_ScanRecords)
+				{
+					const unsigned int l_Count(std::min(c_ScanRecords, l_Total - l_First));
+					if (m_Physical.ReadRecords(l_First, l_Count, l_Block.data()) != Physical::RecordReadStatus::Okay)
+					{
+						return false;
+					}
+					Index(l_First, l_Block.data(), l_Count);
+				}
+
+				// A view longer than its stream was not built from this file
+				for (auto& l_Stream : m_Streams)
+				{
+					const unsigned int l_Viewed(l_Stream.second.m_View->RecordCount());
+					if (l_Viewed > l_Stream.second.m_Positions.size())
+					{
+						l_Stream.second.m_View->Close();
+						std::remove(ViewFilename(l_Stream.first).c_str());
+						l_Stream.second.m_View.reset(new View(ViewFilename(l_Stream.first)));
+						l_Stream.second.m_View->UseFilePool();
+					}
+					l_Stream.second.m_Materialized = l_Stream.second.m_View->RecordCount();
+				}
+				return true;
+			}
+
+			void Run()
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				while (!m_Stopping)
+				{
+					m_Wake.wait_for(l_Lock, m_Interval, [this]() { return m_Stopping; });
+					l_Lock.unlock();
+					Materialize();
+					l_Lock.lock();
+				}
+			}
+
+		public:
+
+			MultiplexedLog(const std::string& p_Filename, const std::chrono::milliseconds& p_Interval = std::chrono::milliseconds(100))
+				:
+				m_Filename(p_Filename),
+				m_Interval(p_Interval),
+				m_Physical(p_Filename),
+				m_Streams(),
+				m_Lock(),
+				m_MaterializeLock(),
+				m_Wake(),
+				m_Stopping(false),
+				m_Worker()
+			{
+				if (!BuildIndex())
+				{
+					m_Physical.Close();
+				}
+				m_Worker = std::thread(&MultiplexedLog::Run, this);
+			}
+
+			virtual ~MultiplexedLog()
+			{
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_Stopping = true;
+				}
+				m_Wake.notify_one();
+				m_Worker.join();
+				m_Physical.Close();
+			}
+
+			const std::string ViewFilename(const unsigned int& p_Stream) const
+			{
+				std::ostringstream l_Name;
+				l_Name << m_Filename << ".stream." << std::setw(6) << std::setfill('0') << p_Stream;
+				return l_Name.str();
+			}
+
+			// False if the physical file could not be opened or indexed
+			const bool Valid() const noexcept
+			{
+				return m_Physical.FileStreamValid();
+			}
+
+			const bool Write(const unsigned int& p_Stream, const T* p_Record)
+			{
+				return WriteRecords(p_Stream, p_Record, 1);
+			}
+
+			const bool WriteRecords(const unsigned int& p_Stream, const T* p_Records, const unsigned int& p_Count)
+			{
+				std::vector<unsigned int> l_Streams(p_Count, p_Stream);
+				return WriteMany(l_Streams.data(), p_Records, p_Count);
+			}
+
+			// Appends p_Records[i] to stream p_Streams[i] for every i, all in one
+			// physical write
+			const bool WriteMany(const unsigned int* p_Streams, const T* p_Records, const unsigned int& p_Count)
+			{
+				if (p_Count == 0)
+				{
+					return true;
+				}
+
+				std::vector<StreamRecord> l_Tagged(p_Count);
+				for (unsigned int i(0); i < p_Count; ++i)
+				{
+					l_Tagged[i].m_Stream = p_Streams[i];
+					l_Tagged[i].m_Reserved = 0;
+					l_Tagged[i].m_Record = p_Records[i];
+				}
+
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				const unsigned int l_First(m_Physical.RecordCount());
+				if (!m_Physical.WriteRecords(l_Tagged.data(), p_Count))
+				{
+					return false;
+				}
+				Index(l_First, l_Tagged.data(), p_Count);
+				return true;
+			}
+
+			const std::vector<unsigned int> Streams() const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				std::vector<unsigned int> l_result;
+				for (const auto& l_Stream : m_Streams)
+				{
+					l_result.push_back(l_Stream.first);
+				}
+				return l_result;
+			}
+
+			const unsigned int StreamRecordCount(const unsigned int& p_Stream) const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				const auto l_Stream(m_Streams.find(p_Stream));
+				return l_Stream != m_Streams.end() ? static_cast<unsigned int>(l_Stream->second.m_Positions.size()) : 0;
+			}
+
+			// Reads records [p_First, p_First + p_Count) of one stream: those
+			// already materialized from its view, the rest from the physical file
+			const RecordReadStatus ReadStream(const unsigned int& p_Stream, const unsigned int& p_First, const unsigned int& p_Count, T* p_Out)
+			{
+				View* l_View(nullptr);
+				unsigned int l_FromView(0);
+				std::vector<unsigned int> l_Positions;
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					const auto l_Stream(m_Streams.find(p_Stream));
+					if (l_Stream == m_Streams.end() ||
+						static_cast<unsigned long long>(p_First) + p_Count > l_Stream->second.m_Positions.size())
+					{
+						return RecordReadStatus::OffsetOutOfRange;
+					}
+
+					l_View = l_Stream->second.m_View.get();
+					l_FromView = std::min(p_Count, l_Stream->second.m_Materialized > p_First ? l_Stream->second.m_Materialized - p_First : 0);
+					l_Positions.assign(
+						l_Stream->second.m_Positions.begin() + p_First + l_FromView,
+						l_Stream->second.m_Positions.begin() + p_First + p_Count);
+				}
+
+				if (l_FromView > 0)
+				{
+					const RecordReadStatus l_Status(l_View->ReadRecords(p_First, l_FromView, p_Out));
+					if (l_Status != RecordReadStatus::Okay)
+					{
+						return l_Status;
+					}
+				}
+
+				if (!l_Positions.empty())
+				{
+					std::vector<StreamRecord> l_Tagged(l_Positions.size());
+					const auto l_Status(m_Physical.ReadMany(l_Positions.data(), l_Positions.size(), l_Tagged.data(), 1));
+					if (l_Status != Physical::RecordReadStatus::Okay)
+					{
+						return static_cast<RecordReadStatus>(l_Status);
+					}
+					for (std::size_t i(0); i < l_Tagged.size(); ++i)
+					{
+						p_Out[l_FromView + i] = l_Tagged[i].m_Record;
+					}
+				}
+				return RecordReadStatus::Okay;
+			}
+
+			// Copies every stream's new records into its view; the background
+			// thread calls this every p_Interval
+			const bool Materialize()
+			{
+				std::lock_guard<std::mutex> l_Pass(m_MaterializeLock);
+
+				struct Pending
+				{
+					unsigned int				m_Stream;
+					View*						m_View;
+					std::vector<unsigned int>	m_Positions;
+				};
+				std::vector<Pending> l_Pending;
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					for (auto& l_Stream : m_Streams)
+					{
+						if (l_Stream.second.m_Materialized < l_Stream.second.m_Positions.size())
+						{
+							l_Pending.push_back(Pending{
+								l_Stream.first,
+								l_Stream.second.m_View.get(),
+								std::vector<unsigned int>(
+									l_Stream.second.m_Positions.begin() + l_Stream.second.m_Materialized,
+									l_Stream.second.m_Positions.end()) });
+						}
+					}
+				}
+
+				// Every stream's new records come from one gather of the physical file
+				std::vector<unsigned int> l_Positions;
+				for (const auto& l_Stream : l_Pending)
+				{
+					l_Positions.insert(l_Positions.end(), l_Stream.m_Positions.begin(), l_Stream.m_Positions.end());
+				}
+				std::vector<StreamRecord> l_Tagged(l_Positions.size());
+				if (!l_Positions.empty() &&
+					m_Physical.ReadMany(l_Positions.data(), l_Positions.size(), l_Tagged.data(), 1) != Physical::RecordReadStatus::Okay)
+				{
+					return false;
+				}
+
+				bool l_result(true);
+				std::vector<T> l_Records;
+				std::size_t l_Next(0);
+				for (auto& l_Stream : l_Pending)
+				{
+					const unsigned int l_Count(static_cast<unsigned int>(l_Stream.m_Positions.size()));
+					l_Records.resize(l_Count);
+					for (unsigned int i(0); i < l_Count; ++i)
+					{
+						l_Records[i] = l_Tagged[l_Next++].m_Record;
+					}
+					if (!l_Stream.m_View->WriteRecords(l_Records.data(), l_Count))
+					{
+						l_result = false;
+						continue;
+					}
+
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_Streams[l_Stream.m_Stream].m_Materialized += l_Count;
+				}
+				return l_result;
+			}
+	};
+
+	template<typename T> const unsigned int MultiplexedLog<T>::c_ScanRecords;
+}
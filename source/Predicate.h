@@ -0,0 +1,494 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "RecordField.h"
+#include "ZoneMaps.h"
+
+// A predicate operand naming member Member of record type Type, e.g.
+// BLUEBIRD_FIELD(Something, X) > 5 && BLUEBIRD_FIELD(Something, Z) == 7
+#define BLUEBIRD_FIELD(Type, Member) ::Bluebird::Field<Type, decltype(Type::Member), &Type::Member>()
+
+namespace Bluebird
+{
+	// Predicates are built as expression templates, so a whole predicate is
+	// one type whose evaluation inlines into straight line code.  Every node
+	// can be evaluated three ways:
+	//
+	//	Evaluate(record)				- a single record
+	//	Evaluate(records, count, mask)	- up to c_KernelRecords records, writing
+	//									  0 or 1 per record with no branches, so
+	//									  the compiler can vectorise the loops
+	//	MayMatch(zone)					- false only when no record in a block
+	//									  with that Zone can match
+	namespace Predicates
+	{
+		const std::size_t c_KernelRecords(256);
+
+		// How Exact compares a field of type A with an operand of type B
+		template<typename A, typename B>
+		struct ExactKind : std::integral_constant<int,
+			std::is_same<A, B>::value ? 0 :
+			std::is_same<A, bool>::value || std::is_same<B, bool>::value ? 3 :
+			std::is_integral<A>::value && std::is_integral<B>::value ? 1 : 2>
+		{
+		};
+
+		// Comparisons of a field value with an operand that are exact for
+		// every pair of values, where converting the operand to the field's
+		// type would turn 5.5 into 5 or -1 into a huge unsigned
+		template<typename A, typename B, int c_Kind = ExactKind<A, B>::value>
+		struct Exact;
+
+		// The same type: the built in operators
+		template<typename A, typename B>
+		struct Exact<A, B, 0>
+		{
+			static const bool Less(const A& p_Left, const B& p_Right) noexcept { return p_Left < p_Right; }
+			static const bool Greater(const A& p_Left, const B& p_Right) noexcept { return p_Left > p_Right; }
+			static const bool Equal(const A& p_Left, const B& p_Right) noexcept { return p_Left == p_Right; }
+		};
+
+		// Two integers: a negative signed value is below every unsigned one,
+		// and otherwise both are compared as unsigned
+		template<typename A, typename B>
+		struct Exact<A, B, 1>
+		{
+			template<typename S, typename U>
+			static const bool SignedLess(const S& p_Signed, const U& p_Unsigned) noexcept
+			{
+				return p_Signed < 0 || static_cast<typename std::make_unsigned<S>::type>(p_Signed) < p_Unsigned;
+			}
+
+			template<typename S, typename U>
+			static const bool SignedGreater(const S& p_Signed, const U& p_Unsigned) noexcept
+			{
+				return p_Signed > 0 && static_cast<typename std::make_unsigned<S>::type>(p_Signed) > p_Unsigned;
+			}
+
+			template<typename S, typename U>
+			static const bool SignedEqual(const S& p_Signed, const U& p_Unsigned) noexcept
+			{
+				return p_Signed >= 0 && static_cast<typename std::make_unsigned<S>::type>(p_Signed) == p_Unsigned;
+			}
+
+			static const bool Less(const A& p_Left, const B& p_Right, std::true_type, std::false_type) noexcept { return SignedLess(p_Left, p_Right); }
+			static const bool Less(const A& p_Left, const B& p_Right, std::false_type, std::true_type) noexcept { return SignedGreater(p_Right, p_Left); }
+			template<typename X> static const bool Less(const A& p_Left, const B& p_Right, X, X) noexcept { return p_Left < p_Right; }
+
+			static const bool Greater(const A& p_Left, const B& p_Right, std::true_type, std::false_type) noexcept { return SignedGreater(p_Left, p_Right); }
+			static const bool Greater(const A& p_Left, const B& p_Right, std::false_type, std::true_type) noexcept { return SignedLess(p_Right, p_Left); }
+			template<typename X> static const bool Greater(const A& p_Left, const B& p_Right, X, X) noexcept { return p_Left > p_Right; }
+
+			static const bool Equal(const A& p_Left, const B& p_Right, std::true_type, std::false_type) noexcept { return SignedEqual(p_Left, p_Right); }
+			static const bool Equal(const A& p_Left, const B& p_Right, std::false_type, std::true_type) noexcept { return SignedEqual(p_Right, p_Left); }
+			template<typename X> static const bool Equal(const A& p_Left, const B& p_Right, X, X) noexcept { return p_Left == p_Right; }
+
+			using SignedA = std::integral_constant<bool, std::is_signed<A>::value>;
+			using SignedB = std::integral_constant<bool, std::is_signed<B>::value>;
+
+			static const bool Less(const A& p_Left, const B& p_Right) noexcept { return Less(p_Left, p_Right, SignedA(), SignedB()); }
+			static const bool Greater(const A& p_Left, const B& p_Right) noexcept { return Greater(p_Left, p_Right, SignedA(), SignedB()); }
+			static const bool Equal(const A& p_Left, const B& p_Right) noexcept { return Equal(p_Left, p_Right, SignedA(), SignedB()); }
+		};
+
+		// A floating point value on either side: both are widened to a
+		// floating type holding every value of each exactly.  double holds
+		// every 32 bit integer; a 64 bit integer needs long double with a 64
+		// bit mantissa (x87 extended precision), so where long double is no
+		// wider than double such comparisons are refused at compile time
+		template<typename A, typename B>
+		struct Exact<A, B, 2>
+		{
+			static const bool c_WideIntegers =
+				(std::is_integral<A>::value && sizeof(A) > 4) ||
+				(std::is_integral<B>::value && sizeof(B) > 4);
+
+			static_assert(
+				!c_WideIntegers || std::numeric_limits<long double>::digits >= 64,
+				"Comparing a 64 bit integer with a floating point value needs a long double with a 64 bit mantissa");
+
+			using Wide = typename std::conditional<
+				c_WideIntegers ||
+				std::is_same<A, long double>::value ||
+				std::is_same<B, long double>::value,
+				long double,
+				double>::type;
+
+			static const bool Less(const A& p_Left, const B& p_Right) noexcept { return static_cast<Wide>(p_Left) < static_cast<Wide>(p_Right); }
+			static const bool Greater(const A& p_Left, const B& p_Right) noexcept { return static_cast<Wide>(p_Left) > static_cast<Wide>(p_Right); }
+			static const bool Equal(const A& p_Left, const B& p_Right) noexcept { return static_cast<Wide>(p_Left) == static_cast<Wide>(p_Right); }
+		};
+
+		// A bool against another type: the bool compares as the int 0 or 1
+		template<typename A, typename B>
+		struct Exact<A, B, 3>
+		{
+			using IntA = typename std::conditional<std::is_same<A, bool>::value, int, A>::type;
+			using IntB = typename std::conditional<std::is_same<B, bool>::value, int, B>::type;
+
+			static const bool Less(const A& p_Left, const B& p_Right) noexcept { return Exact<IntA, IntB>::Less(p_Left, p_Right); }
+			static const bool Greater(const A& p_Left, const B& p_Right) noexcept { return Exact<IntA, IntB>::Greater(p_Left, p_Right); }
+			static const bool Equal(const A& p_Left, const B& p_Right) noexcept { return Exact<IntA, IntB>::Equal(p_Left, p_Right); }
+		};
+
+		struct Less
+		{
+			template<typename M, typename V> static const bool Apply(const M& p_Value, const V& p_Operand) noexcept { return Exact<M, V>::Less(p_Value, p_Operand); }
+			template<typename M, typename V> static const bool MayMatch(const M& p_Min, const M&, const V& p_Operand) noexcept { return Exact<M, V>::Less(p_Min, p_Operand); }
+		};
+
+		struct LessEqual
+		{
+			template<typename M, typename V> static const bool Apply(const M& p_Value, const V& p_Operand) noexcept { return Exact<M, V>::Less(p_Value, p_Operand) | Exact<M, V>::Equal(p_Value, p_Operand); }
+			template<typename M, typename V> static const bool MayMatch(const M& p_Min, const M&, const V& p_Operand) noexcept { return Apply(p_Min, p_Operand); }
+		};
+
+		struct Greater
+		{
+			template<typename M, typename V> static const bool Apply(const M& p_Value, const V& p_Operand) noexcept { return Exact<M, V>::Greater(p_Value, p_Operand); }
+			template<typename M, typename V> static const bool MayMatch(const M&, const M& p_Max, const V& p_Operand) noexcept { return Exact<M, V>::Greater(p_Max, p_Operand); }
+		};
+
+		struct GreaterEqual
+		{
+			template<typename M, typename V> static const bool Apply(const M& p_Value, const V& p_Operand) noexcept { return Exact<M, V>::Greater(p_Value, p_Operand) | Exact<M, V>::Equal(p_Value, p_Operand); }
+			template<typename M, typename V> static const bool MayMatch(const M&, const M& p_Max, const V& p_Operand) noexcept { return Apply(p_Max, p_Operand); }
+		};
+
+		struct Equal
+		{
+			template<typename M, typename V> static const bool Apply(const M& p_Value, const V& p_Operand) noexcept { return Exact<M, V>::Equal(p_Value, p_Operand); }
+			template<typename M, typename V> static const bool MayMatch(const M& p_Min, const M& p_Max, const V& p_Operand) noexcept
+			{
+				return LessEqual::Apply(p_Min, p_Operand) && GreaterEqual::Apply(p_Max, p_Operand);
+			}
+		};
+
+		struct NotEqual
+		{
+			template<typename M, typename V> static const bool Apply(const M& p_Value, const V& p_Operand) noexcept { return !Exact<M, V>::Equal(p_Value, p_Operand); }
+			template<typename M, typename V> static const bool MayMatch(const M& p_Min, const M& p_Max, const V& p_Operand) noexcept
+			{
+				// NaNs are not reflected in the bounds, so a float block always may match
+				return std::is_floating_point<M>::value || !(Exact<M, V>::Equal(p_Min, p_Operand) && Exact<M, V>::Equal(p_Max, p_Operand));
+			}
+		};
+	}
+
+	// Base of every predicate node, so the operators below only apply to predicates
+	template<typename E>
+	struct Expression
+	{
+		const E& Self() const noexcept
+		{
+			return static_cast<const E&>(*this);
+		}
+	};
+
+	// Compares field P with an operand kept in its own type V, so the
+	// comparison is exact even where V does not convert to M exactly
+	template<typename T, typename M, M T::* P, typename Op, typename V>
+	class Comparison : public Expression<Comparison<T, M, P, Op, V>>
+	{
+		static_assert(std::is_arithmetic<V>::value, "Predicate operands must be arithmetic");
+
+		private:
+
+			V	m_Operand;
+
+		public:
+
+			explicit Comparison(const V& p_Operand)
+				:
+				m_Operand(p_Operand)
+			{
+			}
+
+			const bool Evaluate(const T& p_Record) const noexcept
+			{
+				return Op::Apply(p_Record.*P, m_Operand);
+			}
+
+			void Evaluate(const T* p_Records, const std::size_t& p_Count, std::uint8_t* p_Mask) const noexcept
+			{
+				const V l_Operand(m_Operand);
+				for (std::size_t i(0); i < p_Count; ++i)
+				{
+					p_Mask[i] = static_cast<std::uint8_t>(Op::Apply(p_Records[i].*P, l_Operand));
+				}
+			}
+
+			const bool MayMatch(const Zone& p_Zone) const noexcept
+			{
+				M l_Min;
+				M l_Max;
+				return !p_Zone.Bounds(Offset(), l_Min, l_Max) || Op::MayMatch(l_Min, l_Max, m_Operand);
+			}
+
+			static const std::size_t Offset()
+			{
+				static const std::size_t l_Offset(MakeRecordField("", P).m_Offset);
+				return l_Offset;
+			}
+	};
+
+	template<typename L, typename R>
+	class Conjunction : public Expression<Conjunction<L, R>>
+	{
+		private:
+
+			L	m_Left;
+			R	m_Right;
+
+		public:
+
+			Conjunction(const L& p_Left, const R& p_Right)
+				:
+				m_Left(p_Left),
+				m_Right(p_Right)
+			{
+			}
+
+			template<typename T>
+			const bool Evaluate(const T& p_Record) const noexcept
+			{
+				return m_Left.Evaluate(p_Record) & m_Right.Evaluate(p_Record);
+			}
+
+			template<typename T>
+			void Evaluate(const T* p_Records, const std::size_t& p_Count, std::uint8_t* p_Mask) const noexcept
+			{
+				std::uint8_t l_Right[Predicates::c_KernelRecords];
+				m_Left.Evaluate(p_Records, p_Count, p_Mask);
+				m_Right.Evaluate(p_Records, p_Count, l_Right);
+				for (std::size_t i(0); i < p_Count; ++i)
+				{
+					p_Mask[i] &= l_Right[i];
+				}
+			}
+
+			const bool MayMatch(const Zone& p_Zone) const noexcept
+			{
+				return m_Left.MayMatch(p_Zone) && m_Right.MayMatch(p_Zone);
+			}
+	};
+
+	template<typename L, typename R>
+	class Disjunction : public Expression<Disjunction<L, R>>
+	{
+		private:
+
+			L	m_Left;
+			R	m_Right;
+
+		public:
+
+			Disjunction(const L& p_Left, const R& p_Right)
+				:
+				m_Left(p_Left),
+				m_Right(p_Right)
+			{
+			}
+
+			template<typename T>
+			const bool Evaluate(const T& p_Record) const noexcept
+			{
+				return m_Left.Evaluate(p_Record) | m_Right.Evaluate(p_Record);
+			}
+
+			template<typename T>
+			void Evaluate(const T* p_Records, const std::size_t& p_Count, std::uint8_t* p_Mask) const noexcept
+			{
+				std::uint8_t l_Right[Predicates::c_KernelRecords];
+				m_Left.Evaluate(p_Records, p_Count, p_Mask);
+				m_Right.Evaluate(p_Records, p_Count, l_Right);
+				for (std::size_t i(0); i < p_Count; ++i)
+				{
+					p_Mask[i] |= l_Right[i];
+				}
+			}
+
+			const bool MayMatch(const Zone& p_Zone) const noexcept
+			{
+				return m_Left.MayMatch(p_Zone) || m_Right.MayMatch(p_Zone);
+			}
+	};
+
+	template<typename E>
+	class Negation : public Expression<Negation<E>>
+	{
+		private:
+
+			E	m_Inner;
+
+		public:
+
+			explicit Negation(const E& p_Inner)
+				:
+				m_Inner(p_Inner)
+			{
+			}
+
+			template<typename T>
+			const bool Evaluate(const T& p_Record) const noexcept
+			{
+				return !m_Inner.Evaluate(p_Record);
+			}
+
+			template<typename T>
+			void Evaluate(const T* p_Records, const std::size_t& p_Count, std::uint8_t* p_Mask) const noexcept
+			{
+				m_Inner.Evaluate(p_Records, p_Count, p_Mask);
+				for (std::size_t i(0); i < p_Count; ++i)
+				{
+					p_Mask[i] ^= 1;
+				}
+			}
+
+			// Bounds only say what a block may hold, not what it must, so a
+			// negation can never rule a block out
+			const bool MayMatch(const Zone&) const noexcept
+			{
+				return true;
+			}
+	};
+
+	// A field of T used as the left hand side of a comparison
+	template<typename T, typename M, M T::* P>
+	struct Field
+	{
+		static_assert(std::is_arithmetic<M>::value, "Predicate fields must be arithmetic");
+	};
+
+	template<typename T, typename M, M T::* P, typename V>
+	const Comparison<T, M, P, Predicates::Less, V> operator<(const Field<T, M, P>&, const V& p_Operand)
+	{
+		return Comparison<T, M, P, Predicates::Less, V>(p_Operand);
+	}
+
+	template<typename T, typename M, M T::* P, typename V>
+	const Comparison<T, M, P, Predicates::LessEqual, V> operator<=(const Field<T, M, P>&, const V& p_Operand)
+	{
+		return Comparison<T, M, P, Predicates::LessEqual, V>(p_Operand);
+	}
+
+	template<typename T, typename M, M T::* P, typename V>
+	const Comparison<T, M, P, Predicates::Greater, V> operator>(const Field<T, M, P>&, const V& p_Operand)
+	{
+		return Comparison<T, M, P, Predicates::Greater, V>(p_Operand);
+	}
+
+	template<typename T, typename M, M T::* P, typename V>
+	const Comparison<T, M, P, Predicates::GreaterEqual, V> operator>=(const Field<T, M, P>&, const V& p_Operand)
+	{
+		return Comparison<T, M, P, Predicates::GreaterEqual, V>(p_Operand);
+	}
+
+	template<typename T, typename M, M T::* P, typename V>
+	const Comparison<T, M, P, Predicates::Equal, V> operator==(const Field<T, M, P>&, const V& p_Operand)
+	{
+		return Comparison<T, M, P, Predicates::Equal, V>(p_Operand);
+	}
+
+	template<typename T, typename M, M T::* P, typename V>
+	const Comparison<T, M, P, Predicates::NotEqual, V> operator!=(const Field<T, M, P>&, const V& p_Operand)
+	{
+		return Comparison<T, M, P, Predicates::NotEqual, V>(p_Operand);
+	}
+
+	template<typename L, typename R>
+	const Conjunction<L, R> operator&&(const Expression<L>& p_Left, const Expression<R>& p_Right)
+	{
+		return Conjunction<L, R>(p_Left.Self(), p_Right.Self());
+	}
+
+	template<typename L, typename R>
+	const Disjunction<L, R> operator||(const Expression<L>& p_Left, const Expression<R>& p_Right)
+	{
+		return Disjunction<L, R>(p_Left.Self(), p_Right.Self());
+	}
+
+	template<typename E>
+	const Negation<E> operator!(const Expression<E>& p_Inner)
+	{
+		return Negation<E>(p_Inner.Self());
+	}
+
+	enum class ScanStatus
+	{
+		Unknown,
+		OffsetOutOfRange,
+		ReadError,
+		Okay		=	255
+	};
+
+	// Appends every record of [p_First, p_First + p_Count) matching
+	// p_Predicate to p_Out, in log order.  With zone maps, blocks whose zone
+	// rules the predicate out are skipped without being read; the rest are
+	// read a block at a time and filtered by the predicate's mask kernel.
+	template<typename T, typename E>
+	const ScanStatus ScanWhere(
+		CumulativeWriter<T>& p_Writer,
+		const ZoneMaps<T>* p_Zones,
+		const unsigned int& p_First,
+		const unsigned int& p_Count,
+		const Expression<E>& p_Predicate,
+		std::vector<T>& p_Out)
+	{
+		const unsigned int l_Written(p_Writer.LockedRecordCount());
+		if (p_First > l_Written || p_Count > l_Written - p_First)
+		{
+			return ScanStatus::OffsetOutOfRange;
+		}
+
+		const E& l_Predicate(p_Predicate.Self());
+		const unsigned int l_BlockRecords(p_Zones != nullptr ? p_Zones->BlockRecords() : 4096u);
+		const unsigned int l_End(p_First + p_Count);
+
+		Zone l_Zone;
+		std::vector<T> l_Block;
+		std::uint8_t l_Mask[Predicates::c_KernelRecords];
+		for (unsigned int l_Next(p_First); l_Next < l_End;)
+		{
+			const unsigned int l_BlockIndex(l_Next / l_BlockRecords);
+			const unsigned int l_BlockEnd(std::min(l_End, (l_BlockIndex + 1) * l_BlockRecords));
+			if (p_Zones != nullptr && p_Zones->BlockZone(l_BlockIndex, l_Zone) && !l_Predicate.MayMatch(l_Zone))
+			{
+				l_Next = l_BlockEnd;
+				continue;
+			}
+
+			l_Block.resize(l_BlockEnd - l_Next);
+			if (p_Writer.ReadRecords(l_Next, static_cast<unsigned int>(l_Block.size()), l_Block.data()) !=
+				CumulativeWriter<T>::RecordReadStatus::Okay)
+			{
+				return ScanStatus::ReadError;
+			}
+
+			for (std::size_t l_Chunk(0); l_Chunk < l_Block.size(); l_Chunk += Predicates::c_KernelRecords)
+			{
+				const std::size_t l_Records(std::min(Predicates::c_KernelRecords, l_Block.size() - l_Chunk));
+				l_Predicate.Evaluate(l_Block.data() + l_Chunk, l_Records, l_Mask);
+
+				// Branch free compaction: every record is copied, only matches advance the output
+				std::size_t l_Kept(p_Out.size());
+				p_Out.resize(l_Kept + l_Records);
+				for (std::size_t i(0); i < l_Records; ++i)
+				{
+					p_Out[l_Kept] = l_Block[l_Chunk + i];
+					l_Kept += l_Mask[i];
+				}
+				p_Out.resize(l_Kept);
+			}
+			l_Next = l_BlockEnd;
+		}
+		return ScanStatus::Okay;
+	}
+}
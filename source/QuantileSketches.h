@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CumulativeWriter.h"
+
+namespace Bluebird
+{
+	// Fixed size, mergeable quantile sketch with relative error guarantees
+	// (the log bucketed scheme of DDSketch).  Values land in buckets whose
+	// bounds grow geometrically by c_Gamma, so any quantile is returned within
+	// about 1% of the true value; merging two sketches adds their buckets.
+	// Being a plain fixed size struct it can be stored as a record of a
+	// CumulativeWriter.
+	//
+	// NaNs and infinities are not added, only counted in m_NonFinite.
+	// Magnitudes past the last bucket (about 2e13) are added to it and
+	// counted in m_Clamped; quantiles among them are only bounded by m_Max.
+	struct QuantileSketch
+	{
+		static const int	c_Buckets = 2048;
+		static const int	c_MinIndex = -512;			// Magnitudes below gamma^-512 count as zero
+
+		std::uint64_t		m_Count;
+		std::uint64_t		m_Zero;
+		std::uint64_t		m_NonFinite;
+		std::uint64_t		m_Clamped;
+		double				m_Min;
+		double				m_Max;
+		std::uint64_t		m_Positive[c_Buckets];
+		std::uint64_t		m_Negative[c_Buckets];
+
+		static const double Gamma() noexcept
+		{
+			return 1.0202020202020203;					// (1 + 0.01) / (1 - 0.01)
+		}
+
+		static const double LogGamma() noexcept
+		{
+			return std::log(Gamma());
+		}
+
+		void Clear() noexcept
+		{
+			m_Count = 0;
+			m_Zero = 0;
+			m_NonFinite = 0;
+			m_Clamped = 0;
+			m_Min = 0;
+			m_Max = 0;
+			std::fill(m_Positive, m_Positive + c_Buckets, 0);
+			std::fill(m_Negative, m_Negative + c_Buckets, 0);
+		}
+
+		// False, adding nothing, for a NaN or an infinity
+		const bool Add(const double& p_Value) noexcept
+		{
+			if (!std::isfinite(p_Value))
+			{
+				++m_NonFinite;
+				return false;
+			}
+
+			m_Min = m_Count == 0 ? p_Value : std::min(m_Min, p_Value);
+			m_Max = m_Count == 0 ? p_Value : std::max(m_Max, p_Value);
+			++m_Count;
+
+			// The bucket is worked out in double so it is range checked before any cast
+			const double l_Magnitude(std::fabs(p_Value));
+			const double l_Index(l_Magnitude > 0 ? std::ceil(std::log(l_Magnitude) / LogGamma()) - c_MinIndex : -1);
+			if (l_Index < 0)
+			{
+				++m_Zero;
+			}
+			else
+			{
+				std::uint64_t* l_Buckets(p_Value > 0 ? m_Positive : m_Negative);
+				if (l_Index >= c_Buckets)
+				{
+					++m_Clamped;
+					l_Buckets[c_Buckets - 1] += 1;
+				}
+				else
+				{
+					l_Buckets[static_cast<int>(l_Index)] += 1;
+				}
+			}
+			return true;
+		}
+
+		void Merge(const QuantileSketch& p_Other) noexcept
+		{
+			m_NonFinite += p_Other.m_NonFinite;
+			if (p_Other.m_Count == 0)
+			{
+				return;
+			}
+
+			m_Min = m_Count == 0 ? p_Other.m_Min : std::min(m_Min, p_Other.m_Min);
+			m_Max = m_Count == 0 ? p_Other.m_Max : std::max(m_Max, p_Other.m_Max);
+			m_Count += p_Other.m_Count;
+			m_Zero += p_Other.m_Zero;
+			m_Clamped += p_Other.m_Clamped;
+			for (int i(0); i < c_Buckets; ++i)
+			{
+				m_Positive[i] += p_Other.m_Positive[i];
+				m_Negative[i] += p_Other.m_Negative[i];
+			}
+		}
+
+		// Value at quantile p_Quantile in [0, 1]; zero for an empty sketch
+		const double Quantile(const double& p_Quantile) const noexcept
+		{
+			if (m_Count == 0)
+			{
+				return 0;
+			}
+
+			const std::uint64_t l_Rank(static_cast<std::uint64_t>(
+				std::max(0.0, std::min(1.0, p_Quantile)) * static_cast<double>(m_Count - 1)));
+			auto l_Representative = [](const int& p_Index)
+			{
+				return 2.0 * std::pow(Gamma(), p_Index + c_MinIndex) / (Gamma() + 1.0);
+			};
+
+			double l_result(m_Max);
+			std::uint64_t l_Seen(0);
+			bool l_Found(false);
+			for (int i(c_Buckets - 1); i >= 0 && !l_Found; --i)
+			{
+				l_Seen += m_Negative[i];
+				if (l_Seen > l_Rank)
+				{
+					l_result = -l_Representative(i);
+					l_Found = true;
+				}
+			}
+			if (!l_Found && (l_Seen += m_Zero) > l_Rank)
+			{
+				l_result = 0;
+				l_Found = true;
+			}
+			for (int i(0); i < c_Buckets && !l_Found; ++i)
+			{
+				l_Seen += m_Positive[i];
+				if (l_Seen > l_Rank)
+				{
+					l_result = l_Representative(i);
+					l_Found = true;
+				}
+			}
+
+			return std::max(m_Min, std::min(m_Max, l_result));
+		}
+	};
+
+	// Maintains a QuantileSketch of one field for every block of p_BlockRecords
+	// records of a CumulativeWriter<T>.  Completed blocks are appended to a
+	// sketch log beside the data, the block being filled is kept in memory,
+	// and percentile queries over a record range merge the sketches of the
+	// blocks it covers, reading records only for partial blocks at its ends.
+	// If the log cannot be read back at open every query reads raw records.
+	template<typename T>
+	class QuantileSketches
+	{
+		private:
+
+			CumulativeWriter<T>&							m_Writer;
+			std::function<double(const T&)>					m_Field;
+			const std::string								m_Filename;
+			const unsigned int								m_BlockRecords;
+			std::unique_ptr<CumulativeWriter<QuantileSketch>>	m_Sketches;
+			std::unique_ptr<QuantileSketch>					m_Open;
+			unsigned int									m_OpenFirst;
+			unsigned int									m_OpenRecords;		// Added to m_Open, non-finite ones included
+			mutable std::mutex								m_Lock;
+			unsigned int									m_ObserverId;
+			bool											m_Registered;
+
+			QuantileSketches() = delete;
+			QuantileSketches(const QuantileSketches&) = delete;
+
+			// Adds records [p_First, p_First + p_Count) to p_Sketch straight from the log
+			const bool AddRecords(const unsigned int& p_First, const unsigned int& p_Count, QuantileSketch& p_Sketch)
+			{
+				return m_Writer.ForEachRecord(
+					p_First,
+					p_Count,
+					[this, &p_Sketch](const unsigned int&, const T& p_Record)
+					{
+						p_Sketch.Add(m_Field(p_Record));
+					}) == CumulativeWriter<T>::RecordReadStatus::Okay;
+			}
+
+		public:
+
+			template<typename M>
+			QuantileSketches(
+				CumulativeWriter<T>& p_Writer,
+				M T::* p_Member,
+				const std::string& p_SketchFilename,
+				const unsigned int& p_BlockRecords = 65536)
+				:
+				m_Writer(p_Writer),
+				m_Field([p_Member](const T& p_Record) { return static_cast<double>(p_Record.*p_Member); }),
+				m_Filename(p_SketchFilename),
+				m_BlockRecords(p_BlockRecords != 0 ? p_BlockRecords : 1),
+				m_Sketches(new CumulativeWriter<QuantileSketch>(p_SketchFilename)),
+				m_Open(new QuantileSketch()),
+				m_OpenFirst(0),
+				m_OpenRecords(0),
+				m_Lock(),
+				m_ObserverId(0),
+				m_Registered(false)
+			{
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+
+					// More sketches than complete blocks means the sketches are not for this log
+					if (m_Sketches->RecordCount() > m_Writer.RecordCount() / m_BlockRecords || m_Sketches->WasCorruptAtLoad())
+					{
+						m_Sketches.reset();
+						std::remove(m_Filename.c_str());
+						m_Sketches.reset(new CumulativeWriter<QuantileSketch>(m_Filename));
+					}
+					m_OpenFirst = m_Sketches->RecordCount() * m_BlockRecords;
+				}
+
+				// Sketches any blocks completed since the last one on the way in
+				m_Registered = m_Writer.AddWriteObserver(
+					[this](const unsigned int& p_RecordIndex, const T& p_Record)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						m_Open->Add(m_Field(p_Record));
+						++m_OpenRecords;
+						if (p_RecordIndex + 1 == m_OpenFirst + m_BlockRecords)
+						{
+							m_Sketches->Write(m_Open.get());
+							m_Open->Clear();
+							m_OpenFirst += m_BlockRecords;
+							m_OpenRecords = 0;
+						}
+					},
+					m_OpenFirst,
+					m_ObserverId) == CumulativeWriter<T>::RecordReadStatus::Okay;
+			}
+
+			virtual ~QuantileSketches()
+			{
+				if (m_Registered)
+				{
+					m_Writer.RemoveWriteObserver(m_ObserverId);
+				}
+			}
+
+			// Merged sketch of records [p_First, p_First + p_Count)
+			const bool Sketch(const unsigned int& p_First, const unsigned int& p_Count, QuantileSketch& p_Sketch)
+			{
+				p_Sketch.Clear();
+				if (p_First > m_Writer.RecordCount() || p_Count > m_Writer.RecordCount() - p_First)
+				{
+					return false;
+				}
+				if (!m_Registered)
+				{
+					return AddRecords(p_First, p_Count, p_Sketch);
+				}
+
+				std::unique_ptr<QuantileSketch> l_Open(new QuantileSketch());
+				unsigned int l_OpenFirst(0);
+				unsigned int l_OpenEnd(0);
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					*l_Open = *m_Open;
+					l_OpenFirst = m_OpenFirst;
+					l_OpenEnd = m_OpenFirst + m_OpenRecords;
+				}
+
+				const unsigned int l_End(p_First + p_Count);
+				const unsigned int l_FirstBlock((p_First + m_BlockRecords - 1) / m_BlockRecords);
+				const unsigned int l_EndBlock(std::min(l_End, l_OpenFirst) / m_BlockRecords);
+				if (l_FirstBlock >= l_EndBlock)
+				{
+					// No whole block inside the range, unless it spans the whole open block
+					if (p_First == l_OpenFirst && l_End >= l_OpenEnd)
+					{
+						p_Sketch = *l_Open;
+						return AddRecords(l_OpenEnd, l_End - l_OpenEnd, p_Sketch);
+					}
+					return AddRecords(p_First, p_Count, p_Sketch);
+				}
+
+				if (!AddRecords(p_First, l_FirstBlock * m_BlockRecords - p_First, p_Sketch))
+				{
+					return false;
+				}
+
+				std::vector<QuantileSketch> l_Blocks;
+				for (unsigned int l_Block(l_FirstBlock); l_Block < l_EndBlock;)
+				{
+					l_Blocks.resize(std::min(l_EndBlock - l_Block, 32u));
+					if (m_Sketches->ReadRecords(l_Block, static_cast<unsigned int>(l_Blocks.size()), l_Blocks.data()) !=
+						CumulativeWriter<QuantileSketch>::RecordReadStatus::Okay)
+					{
+						return false;
+					}
+					for (const auto& l_Sketch : l_Blocks)
+					{
+						p_Sketch.Merge(l_Sketch);
+					}
+					l_Block += static_cast<unsigned int>(l_Blocks.size());
+				}
+
+				// The tail is either the open block, when the range covers all of it, or raw records
+				const unsigned int l_TailFirst(l_EndBlock * m_BlockRecords);
+				if (l_TailFirst == l_OpenFirst && l_End >= l_OpenEnd)
+				{
+					p_Sketch.Merge(*l_Open);
+					return AddRecords(l_OpenEnd, l_End - l_OpenEnd, p_Sketch);
+				}
+				return AddRecords(l_TailFirst, l_End - l_TailFirst, p_Sketch);
+			}
+
+			// Value at p_Quantile (e.g. 0.99) of the field over records [p_First, p_First + p_Count)
+			const bool Quantile(const unsigned int& p_First, const unsigned int& p_Count, const double& p_Quantile, double& p_Result)
+			{
+				std::unique_ptr<QuantileSketch> l_Sketch(new QuantileSketch());
+				if (!Sketch(p_First, p_Count, *l_Sketch))
+				{
+					return false;
+				}
+				p_Result = l_Sketch->Quantile(p_Quantile);
+				return true;
+			}
+	};
+}
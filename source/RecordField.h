@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#endif
+
+namespace Bluebird
+{
+	// The scalar types a record field may be described as, for the utilities
+	// which need to address a field of T by offset rather than by name
+	enum class FieldType
+	{
+		Int8,
+		UInt8,
+		Int16,
+		UInt16,
+		Int32,
+		UInt32,
+		Int64,
+		UInt64,
+		Float32,
+		Float64
+	};
+
+	// Maps an arithmetic member type onto its FieldType by size and signedness
+	template<typename M>
+	constexpr FieldType FieldTypeOf() noexcept
+	{
+		static_assert(std::is_arithmetic<M>::value, "Record fields must be arithmetic");
+		static_assert(sizeof(M) == 1 || sizeof(M) == 2 || sizeof(M) == 4 || sizeof(M) == 8, "Unsupported field width");
+
+		return std::is_floating_point<M>::value
+			? (sizeof(M) == 4 ? FieldType::Float32 : FieldType::Float64)
+			: sizeof(M) == 1 ? (std::is_signed<M>::value ? FieldType::Int8 : FieldType::UInt8)
+			: sizeof(M) == 2 ? (std::is_signed<M>::value ? FieldType::Int16 : FieldType::UInt16)
+			: sizeof(M) == 4 ? (std::is_signed<M>::value ? FieldType::Int32 : FieldType::UInt32)
+			: (std::is_signed<M>::value ? FieldType::Int64 : FieldType::UInt64);
+	}
+
+	inline const std::size_t FieldTypeWidth(const FieldType& p_Type) noexcept
+	{
+		switch (p_Type)
+		{
+			case FieldType::Int8:
+			case FieldType::UInt8:
+				return 1;
+			case FieldType::Int16:
+			case FieldType::UInt16:
+				return 2;
+			case FieldType::Int32:
+			case FieldType::UInt32:
+			case FieldType::Float32:
+				return 4;
+			default:
+				return 8;
+		}
+	}
+
+	// Describes one scalar member of a record: its name, where it sits in
+	// the record and what it holds
+	struct RecordField
+	{
+		std::string		m_Name;
+		std::size_t		m_Offset;
+		std::size_t		m_Width;
+		FieldType		m_Type;
+	};
+
+	using RecordFields = std::vector<RecordField>;
+
+	// Builds a RecordField from a pointer to member, e.g.
+	// MakeRecordField("X", &Something::X)
+	template<typename T, typename M>
+	const RecordField MakeRecordField(const std::string& p_Name, M T::* p_Member)
+	{
+		const T l_Probe{};
+		const std::size_t l_Offset(
+			static_cast<std::size_t>(
+				reinterpret_cast<const char*>(&(l_Probe.*p_Member)) -
+				reinterpret_cast<const char*>(&l_Probe)));
+
+		return RecordField{ p_Name, l_Offset, sizeof(M), FieldTypeOf<M>() };
+	}
+
+	// Copies one field out of p_Rows consecutive records into a packed column
+	inline void GatherColumn(
+		const std::uint8_t* p_Records,
+		const std::size_t& p_RecordSize,
+		const std::size_t& p_Rows,
+		const RecordField& p_Field,
+		std::uint8_t* p_Column) noexcept
+	{
+		std::size_t l_Row(0);
+#if defined(__AVX2__)
+		// Strided records are gathered 8 (or 4) lanes at a time, provided the
+		// record stride can be expressed in whole elements of the field
+		if (p_Field.m_Width == 4 && p_RecordSize % 4 == 0 && p_Field.m_Offset % 4 == 0 &&
+			p_Rows * (p_RecordSize / 4) < 0x7FFFFFFF)
+		{
+			const int l_Stride(static_cast<int>(p_RecordSize / 4));
+			const int* l_Base(reinterpret_cast<const int*>(p_Records + p_Field.m_Offset));
+			const __m256i l_Lanes(_mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(l_Stride)));
+			for (; l_Row + 8 <= p_Rows; l_Row += 8)
+			{
+				const __m256i l_Index(_mm256_add_epi32(l_Lanes, _mm256_set1_epi32(static_cast<int>(l_Row) * l_Stride)));
+				_mm256_storeu_si256(
+					reinterpret_cast<__m256i*>(p_Column + l_Row * 4),
+					_mm256_i32gather_epi32(l_Base, l_Index, 4));
+			}
+		}
+		else if (p_Field.m_Width == 8 && p_RecordSize % 8 == 0 && p_Field.m_Offset % 8 == 0 &&
+			p_Rows * (p_RecordSize / 8) < 0x7FFFFFFF)
+		{
+			const int l_Stride(static_cast<int>(p_RecordSize / 8));
+			const long long* l_Base(reinterpret_cast<const long long*>(p_Records + p_Field.m_Offset));
+			const __m128i l_Lanes(_mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(l_Stride)));
+			for (; l_Row + 4 <= p_Rows; l_Row += 4)
+			{
+				const __m128i l_Index(_mm_add_epi32(l_Lanes, _mm_set1_epi32(static_cast<int>(l_Row) * l_Stride)));
+				_mm256_storeu_si256(
+					reinterpret_cast<__m256i*>(p_Column + l_Row * 8),
+					_mm256_i32gather_epi64(l_Base, l_Index, 8));
+			}
+		}
+#endif
+		for (; l_Row < p_Rows; ++l_Row)
+		{
+			std::memcpy(
+				p_Column + l_Row * p_Field.m_Width,
+				p_Records + l_Row * p_RecordSize + p_Field.m_Offset,
+				p_Field.m_Width);
+		}
+	}
+}
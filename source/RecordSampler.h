@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#include "CumulativeWriter.h"
+
+namespace Bluebird
+{
+	// Draws uniform random samples of the records of a CumulativeWriter<T>,
+	// either from a whole range or a fixed number from each time bucket of it.
+	//
+	// The record count of a range is known up front, so rather than stream
+	// every record through a reservoir the sample indices are chosen directly
+	// (Floyd's algorithm, O(K) for K samples), sorted, and read with
+	// CumulativeWriter::ReadMany, which coalesces nearby indices into single
+	// positional reads.
+	template<typename T>
+	class RecordSampler
+	{
+		public:
+
+			using TimeFunction = std::function<long long(const T& p_Record)>;
+
+			enum class SampleStatus
+			{
+				Unknown,
+				OffsetOutOfRange,
+				ReadError,
+				OutOfTimeOrder,
+				TooManyBuckets,
+				Okay		=	255
+			};
+
+		private:
+
+			static const unsigned int	c_MaxBuckets = 1u << 20;		// Most time buckets one call returns
+
+			CumulativeWriter<T>&	m_Writer;
+			std::mt19937_64			m_Random;
+
+			RecordSampler() = delete;
+			RecordSampler(const RecordSampler&) = delete;
+
+			// p_Count distinct indices from [p_First, p_First + p_Range) in ascending order
+			const std::vector<unsigned int> ChooseIndices(const unsigned int& p_First, const unsigned int& p_Range, const unsigned int& p_Count)
+			{
+				std::vector<unsigned int> l_result;
+				if (p_Count >= p_Range)
+				{
+					l_result.resize(p_Range);
+					for (unsigned int i(0); i < p_Range; ++i)
+					{
+						l_result[i] = p_First + i;
+					}
+					return l_result;
+				}
+
+				std::unordered_set<unsigned int> l_Chosen;
+				l_Chosen.reserve(p_Count);
+				for (unsigned int j(p_Range - p_Count); j < p_Range; ++j)
+				{
+					const unsigned int l_Candidate(std::uniform_int_distribution<unsigned int>(0, j)(m_Random));
+					l_Chosen.insert(l_Chosen.count(l_Candidate) == 0 ? l_Candidate : j);
+				}
+
+				l_result.reserve(p_Count);
+				for (const auto& l_Index : l_Chosen)
+				{
+					l_result.push_back(p_First + l_Index);
+				}
+				std::sort(l_result.begin(), l_result.end());
+				return l_result;
+			}
+
+			// Appends the records at p_Indices to p_Out, in the same order
+			const bool ReadIndices(const std::vector<unsigned int>& p_Indices, std::vector<T>& p_Out)
+			{
+				const std::size_t l_Existing(p_Out.size());
+				p_Out.resize(l_Existing + p_Indices.size());
+				if (m_Writer.ReadMany(p_Indices.data(), p_Indices.size(), p_Out.data() + l_Existing) !=
+					CumulativeWriter<T>::RecordReadStatus::Okay)
+				{
+					p_Out.resize(l_Existing);
+					return false;
+				}
+				return true;
+			}
+
+			// First record in [p_First, p_End) whose time is at or after p_Time; records are in time order
+			const bool LowerBoundByTime(unsigned int p_First, unsigned int p_End, const TimeFunction& p_Time, const long long& p_Target, unsigned int& p_Result)
+			{
+				T l_Record;
+				while (p_First < p_End)
+				{
+					const unsigned int l_Middle(p_First + (p_End - p_First) / 2);
+					if (m_Writer.ReadRecords(l_Middle, 1, &l_Record) != CumulativeWriter<T>::RecordReadStatus::Okay)
+					{
+						return false;
+					}
+					if (p_Time(l_Record) < p_Target)
+					{
+						p_First = l_Middle + 1;
+					}
+					else
+					{
+						p_End = l_Middle;
+					}
+				}
+				p_Result = p_First;
+				return true;
+			}
+
+		public:
+
+			RecordSampler(CumulativeWriter<T>& p_Writer, const std::uint64_t& p_Seed = std::random_device()())
+				:
+				m_Writer(p_Writer),
+				m_Random(p_Seed)
+			{
+			}
+
+			// Up to p_Samples records chosen uniformly without replacement from
+			// [p_First, p_First + p_Count), in log order
+			const SampleStatus Sample(const unsigned int& p_First, const unsigned int& p_Count, const unsigned int& p_Samples, std::vector<T>& p_Out)
+			{
+				p_Out.clear();
+				if (p_First > m_Writer.RecordCount() || p_Count > m_Writer.RecordCount() - p_First)
+				{
+					return SampleStatus::OffsetOutOfRange;
+				}
+
+				p_Out.reserve(std::min(p_Samples, p_Count));
+				return ReadIndices(ChooseIndices(p_First, p_Count, p_Samples), p_Out) ? SampleStatus::Okay : SampleStatus::ReadError;
+			}
+
+			// Up to p_Samples records from each p_BucketWidth wide time bucket of
+			// [p_First, p_First + p_Count), starting at the first record's time.
+			// Records must be written in time order; bucket boundaries are found
+			// by binary search, so only the sampled records and O(log N) probes
+			// per bucket are read.  p_Buckets[b] holds bucket b in log order.
+			// A bucket found starting before the one already sampled gives
+			// OutOfTimeOrder, and a range spanning more than c_MaxBuckets
+			// buckets gives TooManyBuckets.
+			const SampleStatus SampleByTime(
+				const unsigned int& p_First,
+				const unsigned int& p_Count,
+				const TimeFunction& p_Time,
+				const long long& p_BucketWidth,
+				const unsigned int& p_Samples,
+				std::vector<std::vector<T>>& p_Buckets)
+			{
+				p_Buckets.clear();
+				if (p_First > m_Writer.RecordCount() || p_Count > m_Writer.RecordCount() - p_First || p_BucketWidth <= 0)
+				{
+					return SampleStatus::OffsetOutOfRange;
+				}
+				if (p_Count == 0)
+				{
+					return SampleStatus::Okay;
+				}
+
+				T l_Record;
+				if (m_Writer.ReadRecords(p_First, 1, &l_Record) != CumulativeWriter<T>::RecordReadStatus::Okay)
+				{
+					return SampleStatus::ReadError;
+				}
+				const long long l_Start(p_Time(l_Record));
+				const unsigned int l_End(p_First + p_Count);
+
+				// Gather every bucket's indices first so they are all read in one ReadMany
+				std::vector<unsigned int> l_Indices;
+				std::vector<std::size_t> l_BucketSizes;
+				for (unsigned int l_BucketFirst(p_First); l_BucketFirst < l_End;)
+				{
+					if (m_Writer.ReadRecords(l_BucketFirst, 1, &l_Record) != CumulativeWriter<T>::RecordReadStatus::Okay)
+					{
+						return SampleStatus::ReadError;
+					}
+
+					// Skip straight to the bucket holding l_BucketFirst, leaving empty
+					// buckets before it.  Offsets are unsigned so no difference of
+					// times can overflow
+					const long long l_Time(p_Time(l_Record));
+					if (l_Time < l_Start)
+					{
+						return SampleStatus::OutOfTimeOrder;
+					}
+					const unsigned long long l_Width(static_cast<unsigned long long>(p_BucketWidth));
+					const unsigned long long l_Bucket((static_cast<unsigned long long>(l_Time) - static_cast<unsigned long long>(l_Start)) / l_Width);
+					if (l_Bucket < l_BucketSizes.size())
+					{
+						return SampleStatus::OutOfTimeOrder;
+					}
+					if (l_Bucket >= c_MaxBuckets)
+					{
+						return SampleStatus::TooManyBuckets;
+					}
+					l_BucketSizes.resize(static_cast<std::size_t>(l_Bucket), 0);
+
+					// A bucket ending past the latest representable time runs to l_End
+					const unsigned long long l_Room(static_cast<unsigned long long>(std::numeric_limits<long long>::max()) - static_cast<unsigned long long>(l_Start));
+					unsigned int l_BucketEnd(l_End);
+					if (l_Bucket + 1 <= l_Room / l_Width &&
+						!LowerBoundByTime(
+							l_BucketFirst + 1,
+							l_End,
+							p_Time,
+							static_cast<long long>(static_cast<unsigned long long>(l_Start) + (l_Bucket + 1) * l_Width),
+							l_BucketEnd))
+					{
+						return SampleStatus::ReadError;
+					}
+
+					const std::vector<unsigned int> l_Chosen(ChooseIndices(l_BucketFirst, l_BucketEnd - l_BucketFirst, p_Samples));
+					l_Indices.insert(l_Indices.end(), l_Chosen.begin(), l_Chosen.end());
+					l_BucketSizes.push_back(l_Chosen.size());
+					l_BucketFirst = l_BucketEnd;
+				}
+
+				std::vector<T> l_Records;
+				l_Records.reserve(l_Indices.size());
+				if (!ReadIndices(l_Indices, l_Records))
+				{
+					return SampleStatus::ReadError;
+				}
+
+				p_Buckets.resize(l_BucketSizes.size());
+				std::size_t l_Next(0);
+				for (std::size_t b(0); b < l_BucketSizes.size(); ++b)
+				{
+					p_Buckets[b].assign(l_Records.begin() + l_Next, l_Records.begin() + l_Next + l_BucketSizes[b]);
+					l_Next += l_BucketSizes[b];
+				}
+				return SampleStatus::Okay;
+			}
+	};
+
+	template<typename T> const unsigned int RecordSampler<T>::c_MaxBuckets;
+}
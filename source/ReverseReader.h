@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <vector>
+
+#include "CumulativeWriter.h"
+
+namespace Bluebird
+{
+	// Walks a CumulativeWriter<T> from its newest record back to its oldest.
+	//
+	// Records are read in blocks of p_BlockRecords, one read per block, and
+	// double buffered: while the caller works through one block the block
+	// before it in the file is read in the background.  The end is fixed at
+	// the record count when the reader is made, so records appended during
+	// the walk are not seen.
+	//
+	//	for (const auto& l_Record : ReverseReader<T>(l_Writer)) ...
+	template<typename T>
+	class ReverseReader
+	{
+		public:
+
+			using ReadStatus = typename CumulativeWriter<T>::RecordReadStatus;
+
+			class Iterator
+			{
+				public:
+
+					using iterator_category = std::input_iterator_tag;
+					using value_type = T;
+					using difference_type = std::ptrdiff_t;
+					using pointer = const T*;
+					using reference = const T&;
+
+				private:
+
+					ReverseReader*	m_Reader;
+
+				public:
+
+					explicit Iterator(ReverseReader* p_Reader)
+						:
+						m_Reader(p_Reader)
+					{
+						if (m_Reader != nullptr && !m_Reader->Advance())
+						{
+							m_Reader = nullptr;
+						}
+					}
+
+					const T& operator*() const
+					{
+						return m_Reader->Current();
+					}
+
+					const T* operator->() const
+					{
+						return &m_Reader->Current();
+					}
+
+					Iterator& operator++()
+					{
+						if (!m_Reader->Advance())
+						{
+							m_Reader = nullptr;
+						}
+						return *this;
+					}
+
+					const bool operator==(const Iterator& p_Other) const noexcept
+					{
+						return m_Reader == p_Other.m_Reader;
+					}
+
+					const bool operator!=(const Iterator& p_Other) const noexcept
+					{
+						return m_Reader != p_Other.m_Reader;
+					}
+			};
+
+		private:
+
+			CumulativeWriter<T>&		m_Writer;
+			const unsigned int			m_BlockRecords;
+			unsigned int				m_NextRead;			// Records [0, m_NextRead) are still to be read
+			std::vector<T>				m_Front;
+			std::vector<T>				m_Back;
+			std::size_t					m_Position;			// Records left in m_Front
+			unsigned int				m_FrontFirst;
+			unsigned int				m_BackFirst;
+			std::future<ReadStatus>		m_Pending;
+			ReadStatus					m_Status;
+
+			ReverseReader() = delete;
+			ReverseReader(const ReverseReader&) = delete;
+
+			void StartRead()
+			{
+				const unsigned int l_Count(std::min(m_NextRead, m_BlockRecords));
+				if (l_Count == 0)
+				{
+					return;
+				}
+
+				m_NextRead -= l_Count;
+				m_BackFirst = m_NextRead;
+				m_Back.resize(l_Count);
+
+				CumulativeWriter<T>* l_Writer(&m_Writer);
+				T* l_Target(m_Back.data());
+				const unsigned int l_First(m_NextRead);
+				m_Pending = std::async(
+					std::launch::async,
+					[l_Writer, l_First, l_Count, l_Target]()
+					{
+						return l_Writer->ReadRecords(l_First, l_Count, l_Target);
+					});
+			}
+
+		public:
+
+			ReverseReader(CumulativeWriter<T>& p_Writer, const unsigned int& p_BlockRecords = 4096)
+				:
+				m_Writer(p_Writer),
+				m_BlockRecords(p_BlockRecords != 0 ? p_BlockRecords : 1),
+				m_NextRead(p_Writer.RecordCount()),
+				m_Front(),
+				m_Back(),
+				m_Position(0),
+				m_FrontFirst(0),
+				m_BackFirst(0),
+				m_Pending(),
+				m_Status(ReadStatus::Okay)
+			{
+				StartRead();
+			}
+
+			virtual ~ReverseReader()
+			{
+				if (m_Pending.valid())
+				{
+					m_Pending.wait();
+				}
+			}
+
+			// Steps to the next older record; false once the start of the log
+			// is passed or a read fails (see Status)
+			const bool Advance()
+			{
+				if (m_Position > 0)
+				{
+					--m_Position;
+					return true;
+				}
+
+				if (!m_Pending.valid())
+				{
+					return false;
+				}
+
+				m_Status = m_Pending.get();
+				if (m_Status != ReadStatus::Okay)
+				{
+					return false;
+				}
+
+				std::swap(m_Front, m_Back);
+				m_FrontFirst = m_BackFirst;
+				m_Position = m_Front.size() - 1;
+				StartRead();
+				return true;
+			}
+
+			const T& Current() const noexcept
+			{
+				return m_Front[m_Position];
+			}
+
+			// Log index of the current record
+			const unsigned int CurrentIndex() const noexcept
+			{
+				return m_FrontFirst + static_cast<unsigned int>(m_Position);
+			}
+
+			const ReadStatus& Status() const noexcept
+			{
+				return m_Status;
+			}
+
+			Iterator begin()
+			{
+				return Iterator(this);
+			}
+
+			Iterator end()
+			{
+				return Iterator(nullptr);
+			}
+	};
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "FileUtils.h"
+#include "SegmentedLog.h"
+
+namespace Bluebird
+{
+	// Position of a scan over a SegmentedLog<T>: the next record to deliver
+	// is record m_Block * m_BlockRecords + m_Index of segment m_Segment, and
+	// the scan ends at record m_SnapshotRecords of segment m_SnapshotSegment,
+	// the end of the log when the scan began, so a resumed scan covers the
+	// same records as the original.
+	//
+	// m_SegmentSize is the size of m_Segment when the cursor was taken.  If a
+	// sealed segment has been compacted since, positions inside it have
+	// moved and the scan restarts that segment, delivering its surviving
+	// records again rather than skipping any.  The snapshot segment was still
+	// being appended to, so once sealed it counts as compacted when it holds
+	// neither that size nor a full segment; its snapshot end no longer
+	// applies either, and every surviving record is delivered.
+	struct ScanCursor
+	{
+		std::uint32_t	m_Magic;
+		std::uint32_t	m_Version;
+		std::uint32_t	m_BlockRecords;
+		std::uint32_t	m_Segment;
+		std::uint32_t	m_Block;
+		std::uint32_t	m_Index;
+		std::uint32_t	m_SegmentSize;
+		std::uint32_t	m_SnapshotSegment;
+		std::uint32_t	m_SnapshotRecords;
+		std::uint32_t	m_Reserved;
+
+		static const std::uint32_t	c_Magic = 0x52435343;		// "CSCR"
+		static const std::uint32_t	c_Version = 1;
+
+		const std::string Serialize() const
+		{
+			return std::string(reinterpret_cast<const char*>(this), sizeof(ScanCursor));
+		}
+
+		// False, leaving p_Cursor untouched, if p_Bytes is not a serialized cursor
+		static const bool Deserialize(const std::string& p_Bytes, ScanCursor& p_Cursor) noexcept
+		{
+			ScanCursor l_Cursor;
+			if (p_Bytes.size() != sizeof(ScanCursor))
+			{
+				return false;
+			}
+			std::memcpy(&l_Cursor, p_Bytes.data(), sizeof(ScanCursor));
+			if (l_Cursor.m_Magic != c_Magic || l_Cursor.m_Version != c_Version || l_Cursor.m_BlockRecords == 0)
+			{
+				return false;
+			}
+			p_Cursor = l_Cursor;
+			return true;
+		}
+
+		// Writes the cursor to p_Filename, replacing any earlier one in a single rename
+		const bool Save(const std::string& p_Filename) const
+		{
+			const std::string l_Temporary(p_Filename + ".tmp");
+			{
+				std::ofstream l_File(l_Temporary, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+				const std::string l_Bytes(Serialize());
+				l_File.write(l_Bytes.data(), l_Bytes.size());
+				l_File.flush();
+				if (!l_File.good())
+				{
+					return false;
+				}
+			}
+#ifndef _WIN32
+			sync();
+#endif
+			return RenameOverFile(l_Temporary, p_Filename);
+		}
+
+		static const bool Load(const std::string& p_Filename, ScanCursor& p_Cursor)
+		{
+			std::ifstream l_File(p_Filename, std::ios_base::in | std::ios_base::binary);
+			std::string l_Bytes(sizeof(ScanCursor), '\0');
+			if (!l_File.read(&l_Bytes[0], l_Bytes.size()))
+			{
+				return false;
+			}
+			return Deserialize(l_Bytes, p_Cursor);
+		}
+	};
+
+	// Reads a SegmentedLog<T> a block at a time from a ScanCursor, which can
+	// be saved after each block and handed to a new scanner to carry on
+	// after a restart without rescanning what was already processed.
+	template<typename T>
+	class SegmentScanner
+	{
+		public:
+
+			enum class ScanStatus
+			{
+				Unknown,
+				EndOfScan,
+				ReadError,
+				Okay		=	255
+			};
+
+		private:
+
+			SegmentedLog<T>&	m_Log;
+			ScanCursor			m_Cursor;
+			ScanCursor			m_BlockStart;
+
+			SegmentScanner() = delete;
+			SegmentScanner(const SegmentScanner&) = delete;
+
+		public:
+
+			// A cursor at the start of p_Log, with the snapshot taken now
+			static const ScanCursor Begin(SegmentedLog<T>& p_Log, const unsigned int& p_BlockRecords = 4096)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(p_Log.Lock());
+				ScanCursor l_Cursor;
+				std::memset(&l_Cursor, 0, sizeof(l_Cursor));
+				l_Cursor.m_Magic = ScanCursor::c_Magic;
+				l_Cursor.m_Version = ScanCursor::c_Version;
+				l_Cursor.m_BlockRecords = p_BlockRecords != 0 ? p_BlockRecords : 1;
+				l_Cursor.m_SegmentSize = p_Log.SegmentRecordCount(0);
+				l_Cursor.m_SnapshotSegment = p_Log.ActiveSegment();
+				l_Cursor.m_SnapshotRecords = p_Log.SegmentRecordCount(l_Cursor.m_SnapshotSegment);
+				return l_Cursor;
+			}
+
+			SegmentScanner(SegmentedLog<T>& p_Log, const ScanCursor& p_Cursor)
+				:
+				m_Log(p_Log),
+				m_Cursor(p_Cursor),
+				m_BlockStart(p_Cursor)
+			{
+			}
+
+			// Where the scan will carry on from, once the last block returned is processed
+			const ScanCursor& Cursor() const noexcept
+			{
+				return m_Cursor;
+			}
+
+			// Where the scan would carry on from had only the first p_Consumed
+			// records of the last block returned been processed
+			const ScanCursor CursorAfter(const std::size_t& p_Consumed) const noexcept
+			{
+				ScanCursor l_Cursor(m_BlockStart);
+				const std::uint32_t l_Position(l_Cursor.m_Block * l_Cursor.m_BlockRecords + l_Cursor.m_Index + static_cast<std::uint32_t>(p_Consumed));
+				l_Cursor.m_Block = l_Position / l_Cursor.m_BlockRecords;
+				l_Cursor.m_Index = l_Position % l_Cursor.m_BlockRecords;
+				return l_Cursor;
+			}
+
+			// Reads from the cursor to the end of its block (or of the snapshot)
+			// into p_Records and moves the cursor past them
+			const ScanStatus Next(std::vector<T>& p_Records)
+			{
+				p_Records.clear();
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Log.Lock());
+				while (true)
+				{
+					if (m_Cursor.m_Segment > m_Cursor.m_SnapshotSegment || m_Cursor.m_Segment >= m_Log.SegmentCount())
+					{
+						return ScanStatus::EndOfScan;
+					}
+
+					const unsigned int l_Size(m_Log.SegmentRecordCount(m_Cursor.m_Segment));
+					if (l_Size != m_Cursor.m_SegmentSize && m_Cursor.m_Segment < m_Log.ActiveSegment() &&
+						(m_Cursor.m_Segment < m_Cursor.m_SnapshotSegment || l_Size != m_Log.SegmentRecords()))
+					{
+						m_Cursor.m_Block = 0;
+						m_Cursor.m_Index = 0;
+						m_Cursor.m_SegmentSize = l_Size;
+						if (m_Cursor.m_Segment == m_Cursor.m_SnapshotSegment)
+						{
+							m_Cursor.m_SnapshotRecords = l_Size;
+						}
+					}
+
+					const unsigned int l_End(m_Cursor.m_Segment == m_Cursor.m_SnapshotSegment
+						? std::min(l_Size, m_Cursor.m_SnapshotRecords)
+						: l_Size);
+					const unsigned int l_First(m_Cursor.m_Block * m_Cursor.m_BlockRecords + m_Cursor.m_Index);
+					if (l_First >= l_End)
+					{
+						if (m_Cursor.m_Segment == m_Cursor.m_SnapshotSegment)
+						{
+							return ScanStatus::EndOfScan;
+						}
+						++m_Cursor.m_Segment;
+						m_Cursor.m_Block = 0;
+						m_Cursor.m_Index = 0;
+						m_Cursor.m_SegmentSize = m_Log.SegmentRecordCount(m_Cursor.m_Segment);
+						continue;
+					}
+
+					const unsigned int l_BlockEnd(std::min(l_End, (m_Cursor.m_Block + 1) * m_Cursor.m_BlockRecords));
+					p_Records.resize(l_BlockEnd - l_First);
+					if (m_Log.ReadSegmentRecords(m_Cursor.m_Segment, l_First, static_cast<unsigned int>(p_Records.size()), p_Records.data()) !=
+						SegmentedLog<T>::RecordReadStatus::Okay)
+					{
+						p_Records.clear();
+						return ScanStatus::ReadError;
+					}
+
+					m_BlockStart = m_Cursor;
+					m_Cursor.m_Block = (l_First + static_cast<unsigned int>(p_Records.size())) / m_Cursor.m_BlockRecords;
+					m_Cursor.m_Index = (l_First + static_cast<unsigned int>(p_Records.size())) % m_Cursor.m_BlockRecords;
+					return ScanStatus::Okay;
+				}
+			}
+	};
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "FileUtils.h"
+#include "KeyHash.h"
+#include "MappedFile.h"
+#include "SegmentedLog.h"
+
+namespace Bluebird
+{
+	// Split block Bloom filter: every key sets one bit in each of the eight
+	// 64 bit words of a single 64 byte block, so a probe touches one cache line
+	namespace BlockedBloom
+	{
+		const std::size_t	c_BlockBytes(64);
+		const std::size_t	c_WordsPerBlock(8);
+		const std::uint32_t	c_Salts[c_WordsPerBlock] =
+		{
+			0x47B6137Bu, 0x44974D91u, 0x8824AD5Bu, 0xA2B7289Du,
+			0x705495C7u, 0x2DF1424Bu, 0x9EFC4947u, 0x5C6BFB31u
+		};
+
+		inline const std::size_t BlockOf(const std::uint64_t& p_Hash, const std::size_t& p_Blocks) noexcept
+		{
+			return static_cast<std::size_t>(((p_Hash >> 32) * p_Blocks) >> 32);
+		}
+
+		inline const std::uint64_t BitOf(const std::uint64_t& p_Hash, const std::size_t& p_Word) noexcept
+		{
+			return static_cast<std::uint64_t>(1) << ((static_cast<std::uint32_t>(p_Hash) * c_Salts[p_Word]) >> 26);
+		}
+
+		inline void Insert(std::uint64_t* p_Blocks, const std::size_t& p_BlockCount, const std::uint64_t& p_Hash) noexcept
+		{
+			std::uint64_t* l_Block(p_Blocks + BlockOf(p_Hash, p_BlockCount) * c_WordsPerBlock);
+			for (std::size_t i(0); i < c_WordsPerBlock; ++i)
+			{
+				l_Block[i] |= BitOf(p_Hash, i);
+			}
+		}
+
+		inline const bool MayContain(const std::uint64_t* p_Blocks, const std::size_t& p_BlockCount, const std::uint64_t& p_Hash) noexcept
+		{
+			const std::uint64_t* l_Block(p_Blocks + BlockOf(p_Hash, p_BlockCount) * c_WordsPerBlock);
+			for (std::size_t i(0); i < c_WordsPerBlock; ++i)
+			{
+				if ((l_Block[i] & BitOf(p_Hash, i)) == 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	// Keeps a blocked Bloom filter over the key member K T::* for every sealed
+	// segment of a SegmentedLog<T>, so key lookups only read segments that
+	// may hold the key.
+	//
+	// Segment files are plain record arrays, so each filter lives beside its
+	// segment in "<segment>.bloom" rather than in a footer; the files are
+	// memory mapped read only once built.  Filters are built by a background
+	// thread as segments are sealed, and at open for any sealed segment that
+	// lacks one.  Until its filter exists a segment is always probed.  Each
+	// filter records how many records its segment held, and one that no
+	// longer matches, as after compaction, is dropped and built again.
+	//
+	// Keys are hashed by value (ValueHash) since lookups compare them with
+	// operator==, so they are limited to arithmetic and enum types.
+	template<typename T, typename K>
+	class SegmentBloomFilters
+	{
+		static_assert(std::is_arithmetic<K>::value || std::is_enum<K>::value, "Bloom filter keys must be arithmetic or enum types");
+
+		private:
+
+			struct FilterHeader
+			{
+				std::uint32_t	m_Magic;
+				std::uint32_t	m_Version;
+				std::uint32_t	m_KeySize;
+				std::uint32_t	m_Records;			// Records in the segment when built
+				std::uint64_t	m_Blocks;
+				std::uint64_t	m_Keys;
+				std::uint8_t	m_Padding[32];
+			};
+
+			static const std::uint32_t	c_Magic = 0x464D4C42;		// "BLMF"
+			static const std::uint32_t	c_Version = 2;
+
+			SegmentedLog<T>&							m_Log;
+			K T::*										m_Key;
+			const unsigned int							m_BitsPerKey;
+			mutable std::vector<std::unique_ptr<MappedFile>>	m_Filters;
+			mutable std::mutex							m_Lock;
+			mutable std::condition_variable				m_Wake;
+			mutable std::deque<unsigned int>			m_Pending;
+			bool										m_Stopping;
+			unsigned int								m_ObserverId;
+			std::thread									m_Worker;
+
+			SegmentBloomFilters() = delete;
+			SegmentBloomFilters(const SegmentBloomFilters&) = delete;
+
+			const std::string FilterFilename(const unsigned int& p_Segment) const
+			{
+				return m_Log.SegmentFilename(p_Segment) + ".bloom";
+			}
+
+			// Maps the filter of p_Segment if it exists, is well formed and covers
+			// p_Records records
+			std::unique_ptr<MappedFile> OpenFilter(const unsigned int& p_Segment, const unsigned int& p_Records) const
+			{
+				std::unique_ptr<MappedFile> l_Filter(new MappedFile(FilterFilename(p_Segment), true));
+				if (!l_Filter->Valid() || l_Filter->Size() < sizeof(FilterHeader))
+				{
+					return nullptr;
+				}
+
+				const FilterHeader* l_Header(reinterpret_cast<const FilterHeader*>(l_Filter->Data()));
+				if (l_Header->m_Magic != c_Magic ||
+					l_Header->m_Version != c_Version ||
+					l_Header->m_KeySize != sizeof(K) ||
+					l_Header->m_Records != p_Records ||
+					l_Header->m_Blocks == 0 ||
+					l_Filter->Size() != sizeof(FilterHeader) + l_Header->m_Blocks * BlockedBloom::c_BlockBytes)
+				{
+					return nullptr;
+				}
+				return l_Filter;
+			}
+
+			const bool BuildFilter(const unsigned int& p_Segment)
+			{
+				std::vector<std::uint64_t> l_Hashes;
+				const unsigned int l_Records(m_Log.SegmentRecordCount(p_Segment));
+				if (m_Log.ForEachSegmentRecord(
+						p_Segment,
+						0,
+						l_Records,
+						[this, &l_Hashes](const unsigned int&, const T& p_Record)
+						{
+							l_Hashes.push_back(ValueHash(p_Record.*m_Key));
+						}) != SegmentedLog<T>::RecordReadStatus::Okay)
+				{
+					return false;
+				}
+
+				const std::size_t l_Blocks(std::max<std::size_t>(
+					1,
+					(l_Hashes.size() * m_BitsPerKey + BlockedBloom::c_BlockBytes * 8 - 1) / (BlockedBloom::c_BlockBytes * 8)));
+				std::vector<std::uint64_t> l_Bits(l_Blocks * BlockedBloom::c_WordsPerBlock, 0);
+				for (const auto& l_Hash : l_Hashes)
+				{
+					BlockedBloom::Insert(l_Bits.data(), l_Blocks, l_Hash);
+				}
+
+				FilterHeader l_Header;
+				std::memset(&l_Header, 0, sizeof(l_Header));
+				l_Header.m_Magic = c_Magic;
+				l_Header.m_Version = c_Version;
+				l_Header.m_KeySize = sizeof(K);
+				l_Header.m_Records = l_Records;
+				l_Header.m_Blocks = l_Blocks;
+				l_Header.m_Keys = l_Hashes.size();
+
+				const std::string l_Filename(FilterFilename(p_Segment));
+				const std::string l_Temporary(l_Filename + ".tmp");
+				{
+					std::ofstream l_File(l_Temporary, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+					l_File.write(reinterpret_cast<const char*>(&l_Header), sizeof(l_Header));
+					l_File.write(reinterpret_cast<const char*>(l_Bits.data()), l_Bits.size() * sizeof(std::uint64_t));
+					l_File.flush();
+					if (!l_File.good())
+					{
+						return false;
+					}
+				}
+				if (!RenameOverFile(l_Temporary, l_Filename))
+				{
+					return false;
+				}
+
+				std::unique_ptr<MappedFile> l_Filter(OpenFilter(p_Segment, l_Records));
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (m_Filters.size() <= p_Segment)
+				{
+					m_Filters.resize(p_Segment + 1);
+				}
+				m_Filters[p_Segment] = std::move(l_Filter);
+				return true;
+			}
+
+			void Run()
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				while (true)
+				{
+					m_Wake.wait(l_Lock, [this]() { return !m_Pending.empty() || m_Stopping; });
+					if (m_Stopping)
+					{
+						break;
+					}
+
+					const unsigned int l_Segment(m_Pending.front());
+					m_Pending.pop_front();
+					l_Lock.unlock();
+					BuildFilter(l_Segment);
+					l_Lock.lock();
+				}
+			}
+
+		public:
+
+			SegmentBloomFilters(SegmentedLog<T>& p_Log, K T::* p_Key, const unsigned int& p_BitsPerKey = 10)
+				:
+				m_Log(p_Log),
+				m_Key(p_Key),
+				m_BitsPerKey(std::max(1u, p_BitsPerKey)),
+				m_Filters(),
+				m_Lock(),
+				m_Wake(),
+				m_Pending(),
+				m_Stopping(false),
+				m_ObserverId(0),
+				m_Worker()
+			{
+				std::lock_guard<std::recursive_mutex> l_LogLock(m_Log.Lock());
+				const unsigned int l_Active(m_Log.ActiveSegment());
+				m_Filters.resize(l_Active);
+				for (unsigned int l_Segment(0); l_Segment < l_Active; ++l_Segment)
+				{
+					m_Filters[l_Segment] = OpenFilter(l_Segment, m_Log.SegmentRecordCount(l_Segment));
+					if (m_Filters[l_Segment] == nullptr)
+					{
+						m_Pending.push_back(l_Segment);
+					}
+				}
+
+				m_ObserverId = m_Log.AddSealObserver(
+					[this](const unsigned int& p_Segment)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						m_Pending.push_back(p_Segment);
+						m_Wake.notify_one();
+					});
+				m_Worker = std::thread(&SegmentBloomFilters::Run, this);
+			}
+
+			virtual ~SegmentBloomFilters()
+			{
+				m_Log.RemoveObserver(m_ObserverId);
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_Stopping = true;
+				}
+				m_Wake.notify_one();
+				m_Worker.join();
+			}
+
+			// False only when p_Segment's filter rules p_Key out.  A filter built
+			// before its segment was rewritten is dropped and queued for rebuilding.
+			const bool MayContain(const unsigned int& p_Segment, const K& p_Key) const
+			{
+				// Read before taking m_Lock, which seal observers take under the log's lock
+				const unsigned int l_Records(m_Log.SegmentRecordCount(p_Segment));
+
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (p_Segment >= m_Filters.size() || m_Filters[p_Segment] == nullptr)
+				{
+					return true;
+				}
+
+				const MappedFile& l_Filter(*m_Filters[p_Segment]);
+				const FilterHeader* l_Header(reinterpret_cast<const FilterHeader*>(l_Filter.Data()));
+				if (l_Header->m_Records != l_Records)
+				{
+					m_Filters[p_Segment].reset();
+					m_Pending.push_back(p_Segment);
+					m_Wake.notify_one();
+					return true;
+				}
+				return BlockedBloom::MayContain(
+					reinterpret_cast<const std::uint64_t*>(l_Filter.Data() + sizeof(FilterHeader)),
+					static_cast<std::size_t>(l_Header->m_Blocks),
+					ValueHash(p_Key));
+			}
+
+			// The latest record with p_Key, probing segments newest first and
+			// skipping those whose filter rules the key out
+			const bool FindLatest(const K& p_Key, unsigned int& p_Segment, unsigned int& p_Record, T& p_Value) const
+			{
+				std::vector<T> l_Block;
+				for (unsigned int l_Segment(m_Log.SegmentCount()); l_Segment > 0; --l_Segment)
+				{
+					if (!MayContain(l_Segment - 1, p_Key))
+					{
+						continue;
+					}
+
+					// Scan the segment backwards a block at a time
+					for (unsigned int l_End(m_Log.SegmentRecordCount(l_Segment - 1)); l_End > 0;)
+					{
+						const unsigned int l_First(l_End > 4096u ? l_End - 4096u : 0);
+						l_Block.resize(l_End - l_First);
+						if (m_Log.ReadSegmentRecords(l_Segment - 1, l_First, l_End - l_First, l_Block.data()) !=
+							SegmentedLog<T>::RecordReadStatus::Okay)
+						{
+							return false;
+						}
+						for (unsigned int i(l_End - l_First); i > 0; --i)
+						{
+							if (l_Block[i - 1].*m_Key == p_Key)
+							{
+								p_Segment = l_Segment - 1;
+								p_Record = l_First + i - 1;
+								p_Value = l_Block[i - 1];
+								return true;
+							}
+						}
+						l_End = l_First;
+					}
+				}
+				return false;
+			}
+	};
+
+	template<typename T, typename K> const std::uint32_t SegmentBloomFilters<T, K>::c_Magic;
+	template<typename T, typename K> const std::uint32_t SegmentBloomFilters<T, K>::c_Version;
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "FileUtils.h"
+
+namespace Bluebird
+{
+	// A log split over a sequence of CumulativeWriter<T> segment files named
+	// "<base>.000000", "<base>.000001" and so on.  Appends go to the last
+	// (active) segment; once it holds p_SegmentRecords records it is sealed
+	// and a new one is started.  Sealed segments are never appended to again,
+	// though they may be rewritten wholesale, e.g. by compaction, through
+	// ReplaceSegment.
+	//
+	// Records are addressed by (segment, record within segment).
+	template<typename T>
+	class SegmentedLog
+	{
+		public:
+
+			using Segment = CumulativeWriter<T>;
+			using RecordReadStatus = typename Segment::RecordReadStatus;
+
+			// Called for every appended record, in order, under the log's lock
+			using WriteObserver = std::function<void(const unsigned int& p_Segment, const unsigned int& p_RecordIndex, const T& p_Record)>;
+
+			// Called with the id of a segment once it has been sealed, under the log's lock
+			using SealObserver = std::function<void(const unsigned int& p_Segment)>;
+
+		private:
+
+			const std::string							m_BaseName;
+			const unsigned int							m_SegmentRecords;
+			std::vector<std::unique_ptr<Segment>>		m_Segments;
+			mutable std::recursive_mutex				m_Lock;
+			std::map<unsigned int, WriteObserver>		m_WriteObservers;
+			std::map<unsigned int, SealObserver>		m_SealObservers;
+			unsigned int								m_NextObserverId;
+
+			SegmentedLog() = delete;
+			SegmentedLog(const SegmentedLog&) = delete;
+
+			Segment& Active() noexcept
+			{
+				return *m_Segments.back();
+			}
+
+			void Roll()
+			{
+				const unsigned int l_Sealed(static_cast<unsigned int>(m_Segments.size() - 1));
+				m_Segments.emplace_back(new Segment(SegmentFilename(l_Sealed + 1)));
+				for (auto& l_Observer : m_SealObservers)
+				{
+					l_Observer.second(l_Sealed);
+				}
+			}
+
+			void NotifyWriteObservers(const unsigned int& p_FirstRecord, const T* p_Records, const unsigned int& p_Count) noexcept
+			{
+				const unsigned int l_Segment(ActiveSegment());
+				for (auto& l_Observer : m_WriteObservers)
+				{
+					try
+					{
+						for (unsigned int i(0); i < p_Count; ++i)
+						{
+							l_Observer.second(l_Segment, p_FirstRecord + i, p_Records[i]);
+						}
+					}
+					catch (const std::exception&)
+					{
+					}
+				}
+			}
+
+		public:
+
+			SegmentedLog(const std::string& p_BaseName, const unsigned int& p_SegmentRecords = 1u << 20)
+				:
+				m_BaseName(p_BaseName),
+				m_SegmentRecords(p_SegmentRecords != 0 ? p_SegmentRecords : 1),
+				m_Segments(),
+				m_Lock(),
+				m_WriteObservers(),
+				m_SealObservers(),
+				m_NextObserverId(0)
+			{
+				// Existing segments are numbered contiguously from zero
+				for (unsigned int l_Segment(0);; ++l_Segment)
+				{
+					const std::string l_Filename(SegmentFilename(l_Segment));
+					std::ifstream l_Probe(l_Filename);
+					if (!l_Probe.good() && l_Segment > 0)
+					{
+						break;
+					}
+					l_Probe.close();
+					m_Segments.emplace_back(new Segment(l_Filename));
+				}
+			}
+
+			virtual ~SegmentedLog()
+			{
+				Close();
+			}
+
+			const std::string SegmentFilename(const unsigned int& p_Segment) const
+			{
+				std::ostringstream l_Name;
+				l_Name << m_BaseName << "." << std::setw(6) << std::setfill('0') << p_Segment;
+				return l_Name.str();
+			}
+
+			const std::string& BaseName() const noexcept
+			{
+				return m_BaseName;
+			}
+
+			const unsigned int& SegmentRecords() const noexcept
+			{
+				return m_SegmentRecords;
+			}
+
+			const unsigned int SegmentCount() const
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				return static_cast<unsigned int>(m_Segments.size());
+			}
+
+			// Segments below the active one are sealed
+			const unsigned int ActiveSegment() const
+			{
+				return SegmentCount() - 1;
+			}
+
+			const unsigned int SegmentRecordCount(const unsigned int& p_Segment) const
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				return p_Segment < m_Segments.size() ? m_Segments[p_Segment]->RecordCount() : 0;
+			}
+
+			const unsigned long long RecordCount() const
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				unsigned long long l_result(0);
+				for (const auto& l_Segment : m_Segments)
+				{
+					l_result += l_Segment->RecordCount();
+				}
+				return l_result;
+			}
+
+			const RecordReadStatus ReadSegmentRecords(
+				const unsigned int& p_Segment,
+				const unsigned int& p_FirstRecord,
+				const unsigned int& p_Count,
+				T* p_Out)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				if (p_Segment >= m_Segments.size())
+				{
+					return RecordReadStatus::OffsetOutOfRange;
+				}
+				return m_Segments[p_Segment]->ReadRecords(p_FirstRecord, p_Count, p_Out);
+			}
+
+			// Reads p_Count records of p_Segment from p_FirstRecord a block at a
+			// time, calling p_Visit(index, record) for each
+			template<typename V>
+			const RecordReadStatus ForEachSegmentRecord(
+				const unsigned int& p_Segment,
+				const unsigned int& p_FirstRecord,
+				const unsigned int& p_Count,
+				V p_Visit)
+			{
+				return Segment::VisitRecords(
+					p_FirstRecord,
+					p_Count,
+					[this, &p_Segment](const unsigned int& p_First, const unsigned int& p_Records, T* p_Out)
+					{
+						return ReadSegmentRecords(p_Segment, p_First, p_Records, p_Out);
+					},
+					p_Visit);
+			}
+
+			const bool Write(const T* p_Record)
+			{
+				return WriteRecords(p_Record, 1);
+			}
+
+			// Appends p_Count records, sealing and starting segments as they fill
+			const bool WriteRecords(const T* p_Records, const unsigned int& p_Count)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				unsigned int l_Written(0);
+				while (l_Written < p_Count)
+				{
+					if (Active().RecordCount() >= m_SegmentRecords)
+					{
+						Roll();
+					}
+
+					const unsigned int l_First(Active().RecordCount());
+					const unsigned int l_Count(std::min(p_Count - l_Written, m_SegmentRecords - l_First));
+					if (!Active().WriteRecords(p_Records + l_Written, l_Count))
+					{
+						return false;
+					}
+
+					NotifyWriteObservers(l_First, p_Records + l_Written, l_Count);
+					l_Written += l_Count;
+
+					if (Active().RecordCount() >= m_SegmentRecords)
+					{
+						Roll();
+					}
+				}
+
+				return true;
+			}
+
+			// Atomically swaps the contents of a sealed segment for p_Records
+			const bool ReplaceSegment(const unsigned int& p_Segment, const T* p_Records, const unsigned int& p_Count)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				if (p_Segment >= ActiveSegment())
+				{
+					return false;
+				}
+
+				const std::string l_Filename(SegmentFilename(p_Segment));
+				const std::string l_Replacement(l_Filename + ".tmp");
+				std::remove(l_Replacement.c_str());
+				{
+					Segment l_Writer(l_Replacement);
+					if (!l_Writer.WriteRecords(p_Records, p_Count))
+					{
+						return false;
+					}
+				}
+
+				m_Segments[p_Segment]->Close();
+				const bool l_Renamed(RenameOverFile(l_Replacement, l_Filename));
+				m_Segments[p_Segment].reset(new Segment(l_Filename));
+				return l_Renamed;
+			}
+
+			// The log's lock, for callers that must see segments unchanged across several calls
+			std::recursive_mutex& Lock() const noexcept
+			{
+				return m_Lock;
+			}
+
+			const unsigned int AddWriteObserver(const WriteObserver& p_Observer)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				m_WriteObservers[m_NextObserverId] = p_Observer;
+				return m_NextObserverId++;
+			}
+
+			// Feeds p_Observer every record from p_Record of p_Segment on and then
+			// registers it, all under the log's lock, so it sees each record
+			// exactly once.  Nothing is registered unless the catch-up succeeds
+			const RecordReadStatus AddWriteObserver(
+				const WriteObserver& p_Observer,
+				const unsigned int& p_Segment,
+				const unsigned int& p_Record,
+				unsigned int& p_ObserverId)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				const unsigned int l_FromSegment(p_Segment);
+				const unsigned int l_FromRecord(p_Record);
+				for (unsigned int l_Segment(l_FromSegment); l_Segment < m_Segments.size(); ++l_Segment)
+				{
+					const unsigned int l_First(l_Segment == l_FromSegment ? l_FromRecord : 0);
+					const unsigned int l_Count(m_Segments[l_Segment]->RecordCount());
+					if (l_First > l_Count)
+					{
+						return RecordReadStatus::OffsetOutOfRange;
+					}
+
+					const RecordReadStatus l_resultCode(ForEachSegmentRecord(
+						l_Segment,
+						l_First,
+						l_Count - l_First,
+						[&p_Observer, &l_Segment](const unsigned int& p_Index, const T& p_Value)
+						{
+							p_Observer(l_Segment, p_Index, p_Value);
+						}));
+					if (l_resultCode != RecordReadStatus::Okay)
+					{
+						return l_resultCode;
+					}
+				}
+
+				try
+				{
+					m_WriteObservers[m_NextObserverId] = p_Observer;
+				}
+				catch (const std::bad_alloc&)
+				{
+					return RecordReadStatus::BadMemoryAlloc;
+				}
+				p_ObserverId = m_NextObserverId++;
+				return RecordReadStatus::Okay;
+			}
+
+			const unsigned int AddSealObserver(const SealObserver& p_Observer)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				m_SealObservers[m_NextObserverId] = p_Observer;
+				return m_NextObserverId++;
+			}
+
+			void RemoveObserver(const unsigned int& p_ObserverId)
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				m_WriteObservers.erase(p_ObserverId);
+				m_SealObservers.erase(p_ObserverId);
+			}
+
+			void Close() noexcept
+			{
+				std::lock_guard<std::recursive_mutex> l_Lock(m_Lock);
+				for (auto& l_Segment : m_Segments)
+				{
+					l_Segment->Close();
+				}
+			}
+	};
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "FileUtils.h"
+#include "MappedFile.h"
+
+namespace Bluebird
+{
+	// A log of T that several processes append to at once.
+	//
+	// Next to the log a small control file ("<file>.tail") is mapped into
+	// every process, holding two shared counters: the tail, the number of
+	// record slots handed out, and the commit watermark, the number of
+	// records written in full with none missing before them.  An append
+	// reserves its slots with one atomic fetch_add on the tail, writes its
+	// records straight into that range with a positional write (syncing it
+	// unless p_Sync is false), then waits for the watermark to reach the
+	// start of its range and moves it to the end.  Appends from different
+	// processes never overlap and need no lock, and readers only see records
+	// below the watermark, so never a hole.
+	//
+	// The control file outlives the processes.  If one dies part way through
+	// an append the watermark stops short of its range and appends after it
+	// cannot publish; an append that sees the watermark stand still for
+	// p_Wait gives up and marks the log broken in every process, as does a
+	// write error, and an open that waits p_Wait on a first process which
+	// never finished setting the counters fails.  Once every process has
+	// closed the log, Recover cuts it back to the watermark and removes the
+	// control file.
+	template<typename T>
+	class SharedAppendLog
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Shared log records must be trivially copyable");
+
+		public:
+
+			enum class AppendStatus
+			{
+				Unknown,
+				NotOpen,
+				WriteError,
+				Broken,			// An append here or in another process failed; see Recover
+				Okay		=	255
+			};
+
+		private:
+
+			// Lives in the control file; a new, zero filled file is uninitialized
+			struct Control
+			{
+				std::atomic<std::uint32_t>	m_State;			// c_Uninitialized, c_Initializing or c_Ready
+				std::uint32_t				m_RecordSize;
+				std::atomic<std::uint32_t>	m_Broken;
+				std::uint32_t				m_Reserved;
+				std::atomic<std::uint64_t>	m_Tail;
+				std::atomic<std::uint64_t>	m_Committed;
+			};
+
+			static const std::uint32_t	c_Uninitialized = 0;
+			static const std::uint32_t	c_Initializing = 1;
+			static const std::uint32_t	c_Ready = 2;
+
+			const std::string		m_Filename;
+			MappedFile				m_ControlFile;
+			Control*				m_Control;
+			const bool				m_Sync;
+			const std::chrono::milliseconds	m_Wait;
+#ifdef _WIN32
+			HANDLE					m_File;
+#else
+			int						m_File;
+#endif
+
+			SharedAppendLog() = delete;
+			SharedAppendLog(const SharedAppendLog&) = delete;
+
+			static const std::string ControlFilename(const std::string& p_Filename)
+			{
+				return p_Filename + ".tail";
+			}
+
+			const std::uint64_t FileRecords() const noexcept
+			{
+#ifdef _WIN32
+				LARGE_INTEGER l_Size;
+				return GetFileSizeEx(m_File, &l_Size) != 0 ? static_cast<std::uint64_t>(l_Size.QuadPart) / sizeof(T) : 0;
+#else
+				struct stat l_Stat;
+				return fstat(m_File, &l_Stat) == 0 ? static_cast<std::uint64_t>(l_Stat.st_size) / sizeof(T) : 0;
+#endif
+			}
+
+			const bool WriteAt(const std::uint64_t& p_Offset, const void* p_Data, const std::size_t& p_Length) noexcept
+			{
+#ifdef _WIN32
+				OVERLAPPED l_Overlapped{ 0 };
+				l_Overlapped.Offset = static_cast<DWORD>(p_Offset);
+				l_Overlapped.OffsetHigh = static_cast<DWORD>(p_Offset >> 32);
+				DWORD l_Written(0);
+				return WriteFile(m_File, p_Data, static_cast<DWORD>(p_Length), &l_Written, &l_Overlapped) != 0 &&
+					l_Written == p_Length &&
+					(!m_Sync || FlushFileBuffers(m_File) != 0);
+#else
+				if (::pwrite(m_File, p_Data, p_Length, static_cast<off_t>(p_Offset)) != static_cast<ssize_t>(p_Length))
+				{
+					return false;
+				}
+	#if defined(__APPLE__)
+				return !m_Sync || ::fsync(m_File) == 0;
+	#else
+				return !m_Sync || ::fdatasync(m_File) == 0;
+	#endif
+#endif
+			}
+
+			const bool ReadAt(const std::uint64_t& p_Offset, void* p_Data, const std::size_t& p_Length) const noexcept
+			{
+#ifdef _WIN32
+				OVERLAPPED l_Overlapped{ 0 };
+				l_Overlapped.Offset = static_cast<DWORD>(p_Offset);
+				l_Overlapped.OffsetHigh = static_cast<DWORD>(p_Offset >> 32);
+				DWORD l_Read(0);
+				return ReadFile(m_File, p_Data, static_cast<DWORD>(p_Length), &l_Read, &l_Overlapped) != 0 && l_Read == p_Length;
+#else
+				return ::pread(m_File, p_Data, p_Length, static_cast<off_t>(p_Offset)) == static_cast<ssize_t>(p_Length);
+#endif
+			}
+
+			// The first process in sets the counters from the log's length; the
+			// rest wait for it, giving up after m_Wait
+			const bool Attach()
+			{
+				if (m_ControlFile.Size() < sizeof(Control) && !m_ControlFile.Resize(sizeof(Control)))
+				{
+					return false;
+				}
+				m_Control = reinterpret_cast<Control*>(m_ControlFile.Data());
+				if (!m_Control->m_Tail.is_lock_free())
+				{
+					m_Control = nullptr;
+					return false;
+				}
+
+				std::uint32_t l_State(c_Uninitialized);
+				if (m_Control->m_State.compare_exchange_strong(l_State, c_Initializing))
+				{
+					const std::uint64_t l_Records(FileRecords());
+					m_Control->m_RecordSize = sizeof(T);
+					m_Control->m_Tail = l_Records;
+					m_Control->m_Committed = l_Records;
+					m_Control->m_State = c_Ready;
+				}
+				const auto l_Deadline(std::chrono::steady_clock::now() + m_Wait);
+				while (m_Control->m_State.load() != c_Ready)
+				{
+					if (std::chrono::steady_clock::now() >= l_Deadline)
+					{
+						m_Control->m_Broken = 1;
+						m_Control = nullptr;
+						return false;
+					}
+					std::this_thread::yield();
+				}
+				if (m_Control->m_RecordSize != sizeof(T))
+				{
+					m_Control = nullptr;
+					return false;
+				}
+				return true;
+			}
+
+		public:
+
+			SharedAppendLog(
+				const std::string& p_Filename,
+				const bool& p_Sync = true,
+				const std::chrono::milliseconds& p_Wait = std::chrono::milliseconds(5000))
+				:
+				m_Filename(p_Filename),
+				m_ControlFile(ControlFilename(p_Filename)),
+				m_Control(nullptr),
+				m_Sync(p_Sync),
+				m_Wait(p_Wait),
+#ifdef _WIN32
+				m_File(INVALID_HANDLE_VALUE)
+#else
+				m_File(-1)
+#endif
+			{
+#ifdef _WIN32
+				m_File = CreateFileA(
+					m_Filename.c_str(),
+					GENERIC_READ | GENERIC_WRITE,
+					FILE_SHARE_READ | FILE_SHARE_WRITE,
+					NULL,
+					OPEN_ALWAYS,
+					FILE_ATTRIBUTE_NORMAL,
+					NULL);
+				const bool l_Opened(m_File != INVALID_HANDLE_VALUE);
+#else
+				m_File = ::open(m_Filename.c_str(), O_RDWR | O_CREAT, 0644);
+				const bool l_Opened(m_File >= 0);
+#endif
+				if (l_Opened && m_ControlFile.Valid())
+				{
+					Attach();
+				}
+			}
+
+			virtual ~SharedAppendLog()
+			{
+				Close();
+			}
+
+			void Close() noexcept
+			{
+				m_Control = nullptr;
+				m_ControlFile.Close();
+#ifdef _WIN32
+				if (m_File != INVALID_HANDLE_VALUE)
+				{
+					CloseHandle(m_File);
+					m_File = INVALID_HANDLE_VALUE;
+				}
+#else
+				if (m_File >= 0)
+				{
+					::close(m_File);
+					m_File = -1;
+				}
+#endif
+			}
+
+			const bool Valid() const noexcept
+			{
+				return m_Control != nullptr;
+			}
+
+			// Records below the commit watermark, visible to every process
+			const std::uint64_t RecordCount() const noexcept
+			{
+				return m_Control != nullptr ? m_Control->m_Committed.load(std::memory_order_acquire) : 0;
+			}
+
+			// Appends p_Count records as one contiguous range, setting p_First
+			// to the index of the first once it is visible to every process
+			const AppendStatus Append(const T* p_Records, const unsigned int& p_Count, std::uint64_t* p_First = nullptr) noexcept
+			{
+				if (m_Control == nullptr)
+				{
+					return AppendStatus::NotOpen;
+				}
+				if (m_Control->m_Broken.load() != 0)
+				{
+					return AppendStatus::Broken;
+				}
+				if (p_Count == 0)
+				{
+					return AppendStatus::Okay;
+				}
+
+				const std::uint64_t l_Start(m_Control->m_Tail.fetch_add(p_Count));
+				if (!WriteAt(l_Start * sizeof(T), p_Records, static_cast<std::size_t>(p_Count) * sizeof(T)))
+				{
+					m_Control->m_Broken = 1;
+					return AppendStatus::WriteError;
+				}
+
+				// Publish in reservation order so the watermark never passes a hole;
+				// a watermark that stops moving means an earlier append died
+				std::uint64_t l_Seen(m_Control->m_Committed.load(std::memory_order_acquire));
+				auto l_Deadline(std::chrono::steady_clock::now() + m_Wait);
+				while (l_Seen != l_Start)
+				{
+					if (m_Control->m_Broken.load() != 0)
+					{
+						return AppendStatus::Broken;
+					}
+					std::this_thread::yield();
+					const std::uint64_t l_Committed(m_Control->m_Committed.load(std::memory_order_acquire));
+					if (l_Committed != l_Seen)
+					{
+						l_Seen = l_Committed;
+						l_Deadline = std::chrono::steady_clock::now() + m_Wait;
+					}
+					else if (std::chrono::steady_clock::now() >= l_Deadline)
+					{
+						m_Control->m_Broken = 1;
+						return AppendStatus::Broken;
+					}
+				}
+				m_Control->m_Committed.store(l_Start + p_Count, std::memory_order_release);
+
+				if (p_First != nullptr)
+				{
+					*p_First = l_Start;
+				}
+				return AppendStatus::Okay;
+			}
+
+			const AppendStatus Write(const T* p_Record) noexcept
+			{
+				return Append(p_Record, 1);
+			}
+
+			// Reads committed records [p_First, p_First + p_Count)
+			const bool ReadRecords(const std::uint64_t& p_First, const unsigned int& p_Count, T* p_Out) const noexcept
+			{
+				if (m_Control == nullptr || p_First + p_Count > RecordCount())
+				{
+					return false;
+				}
+				return p_Count == 0 || ReadAt(p_First * sizeof(T), p_Out, static_cast<std::size_t>(p_Count) * sizeof(T));
+			}
+
+			// With no process holding the log open: cuts it back to the commit
+			// watermark, dropping torn or unpublished appends, and removes the
+			// control file so the next open starts clean
+			static const bool Recover(const std::string& p_Filename)
+			{
+				{
+					MappedFile l_ControlFile(ControlFilename(p_Filename));
+					if (!l_ControlFile.Valid())
+					{
+						return false;
+					}
+					if (l_ControlFile.Size() >= sizeof(Control))
+					{
+						const Control* l_Control(reinterpret_cast<const Control*>(l_ControlFile.Data()));
+						if (l_Control->m_State.load() == c_Ready &&
+							!TruncateFile(p_Filename, l_Control->m_Committed.load() * l_Control->m_RecordSize))
+						{
+							return false;
+						}
+					}
+				}
+				return std::remove(ControlFilename(p_Filename).c_str()) == 0;
+			}
+	};
+
+	template<typename T> const std::uint32_t SharedAppendLog<T>::c_Uninitialized;
+	template<typename T> const std::uint32_t SharedAppendLog<T>::c_Initializing;
+	template<typename T> const std::uint32_t SharedAppendLog<T>::c_Ready;
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "FileUtils.h"
+
+namespace Bluebird
+{
+	// Folds every record appended to a CumulativeWriter<T> into a state S and
+	// appends a checkpoint of that state to a second log every p_Interval
+	// records.  The state as of any record, or as of any time when records
+	// carry one, is then rebuilt from the nearest checkpoint at or before it,
+	// replaying fewer than p_Interval records.
+	//
+	// S is persisted as raw bytes so must be trivially copyable, and the fold
+	// must be deterministic.  Any records written since the last checkpoint
+	// are folded at open; if they cannot be read the state stops at the last
+	// record folded.  Checkpoint i is always record i of the checkpoint file,
+	// so at open the file is cut back to its last checkpoint that is whole
+	// and within the log.
+	template<typename T, typename S>
+	class StateCheckpoints
+	{
+		static_assert(std::is_trivially_copyable<S>::value, "Checkpointed state must be trivially copyable");
+
+		public:
+
+			using FoldFunction = std::function<void(S& p_State, const T& p_Record)>;
+			using TimeFunction = std::function<long long(const T& p_Record)>;
+
+			enum class StateStatus
+			{
+				Unknown,
+				OffsetOutOfRange,
+				ReadError,
+				Okay		=	255
+			};
+
+		private:
+
+			// The state after folding the first m_Records records of the log
+			struct Checkpoint
+			{
+				std::uint64_t	m_Records;
+				std::int64_t	m_Time;
+				S				m_State;
+			};
+
+			using Checkpoints = CumulativeWriter<Checkpoint>;
+
+			CumulativeWriter<T>&			m_Writer;
+			const std::string				m_Filename;
+			std::unique_ptr<Checkpoints>	m_Checkpoints;
+			const FoldFunction				m_Fold;
+			const TimeFunction				m_Time;
+			const unsigned int				m_Interval;
+
+			std::vector<std::uint64_t>		m_CheckpointRecords;
+			std::vector<std::int64_t>		m_CheckpointTimes;
+			S								m_State;
+			std::uint64_t					m_Folded;
+			std::int64_t					m_LastTime;
+			bool							m_Appending;		// False if a bad tail could not be cut off
+			mutable std::mutex				m_Lock;
+			unsigned int					m_ObserverId;
+			bool							m_Registered;
+
+			StateCheckpoints() = delete;
+			StateCheckpoints(const StateCheckpoints&) = delete;
+
+			void Fold(const T& p_Record)
+			{
+				m_Fold(m_State, p_Record);
+				++m_Folded;
+				if (m_Time)
+				{
+					m_LastTime = m_Time(p_Record);
+				}
+
+				if (m_Appending && m_Folded % m_Interval == 0)
+				{
+					const Checkpoint l_Checkpoint{ m_Folded, m_LastTime, m_State };
+					if (m_Checkpoints->Write(&l_Checkpoint))
+					{
+						m_CheckpointRecords.push_back(m_Folded);
+						m_CheckpointTimes.push_back(m_LastTime);
+					}
+				}
+			}
+
+			// Loads checkpoint p_Index, or the initial state for the position before the first
+			const bool LoadCheckpoint(const std::size_t& p_Index, S& p_State, std::uint64_t& p_Records)
+			{
+				if (p_Index == 0)
+				{
+					p_State = S{};
+					p_Records = 0;
+					return true;
+				}
+
+				const auto l_Loaded(m_Checkpoints->ReadRecord(static_cast<unsigned int>(p_Index - 1)));
+				if (l_Loaded.first != Checkpoints::RecordReadStatus::Okay || l_Loaded.second == nullptr)
+				{
+					return false;
+				}
+				p_State = l_Loaded.second->m_State;
+				p_Records = l_Loaded.second->m_Records;
+				return true;
+			}
+
+			// Folds records [p_From, p_To) up to the first one p_Continue refuses
+			const bool Replay(S& p_State, const std::uint64_t& p_From, const std::uint64_t& p_To, const std::function<bool(const T&)>& p_Continue)
+			{
+				bool l_Continue(true);
+				return m_Writer.ForEachRecord(
+					static_cast<unsigned int>(p_From),
+					static_cast<unsigned int>(p_To - p_From),
+					[this, &p_State, &p_Continue, &l_Continue](const unsigned int&, const T& p_Record)
+					{
+						l_Continue = l_Continue && p_Continue(p_Record);
+						if (l_Continue)
+						{
+							m_Fold(p_State, p_Record);
+						}
+					}) == CumulativeWriter<T>::RecordReadStatus::Okay;
+			}
+
+		public:
+
+			StateCheckpoints(
+				CumulativeWriter<T>& p_Writer,
+				const std::string& p_CheckpointFilename,
+				const FoldFunction& p_Fold,
+				const unsigned int& p_Interval,
+				const TimeFunction& p_Time = TimeFunction())
+				:
+				m_Writer(p_Writer),
+				m_Filename(p_CheckpointFilename),
+				m_Checkpoints(new Checkpoints(p_CheckpointFilename)),
+				m_Fold(p_Fold),
+				m_Time(p_Time),
+				m_Interval(p_Interval != 0 ? p_Interval : 1),
+				m_CheckpointRecords(),
+				m_CheckpointTimes(),
+				m_State{},
+				m_Folded(0),
+				m_LastTime(0),
+				m_Appending(true),
+				m_Lock(),
+				m_ObserverId(0),
+				m_Registered(false)
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+
+				// Checkpoints past the end of the log (the log lost a torn final
+				// write) or out of order are cut off with anything after them, as
+				// is a torn checkpoint, so new ones land at the index they are
+				// looked up by
+				const unsigned int l_Checkpoints(m_Checkpoints->RecordCount());
+				unsigned int l_Valid(0);
+				for (; l_Valid < l_Checkpoints; ++l_Valid)
+				{
+					const auto l_Loaded(m_Checkpoints->ReadRecord(l_Valid));
+					if (l_Loaded.first != Checkpoints::RecordReadStatus::Okay ||
+						l_Loaded.second->m_Records > m_Writer.RecordCount() ||
+						l_Loaded.second->m_Records <= m_Folded)
+					{
+						break;
+					}
+					m_CheckpointRecords.push_back(l_Loaded.second->m_Records);
+					m_CheckpointTimes.push_back(l_Loaded.second->m_Time);
+					m_State = l_Loaded.second->m_State;
+					m_Folded = l_Loaded.second->m_Records;
+					m_LastTime = l_Loaded.second->m_Time;
+				}
+				if (l_Valid < l_Checkpoints || m_Checkpoints->WasCorruptAtLoad())
+				{
+					m_Checkpoints.reset();
+					m_Appending = TruncateFile(m_Filename, static_cast<unsigned long long>(l_Valid) * sizeof(Checkpoint));
+					m_Checkpoints.reset(new Checkpoints(m_Filename));
+				}
+
+				const unsigned int l_Folded(static_cast<unsigned int>(m_Folded));
+				l_Lock.unlock();
+
+				// Folds whatever was written after the last checkpoint on the way in
+				m_Registered = m_Writer.AddWriteObserver(
+					[this](const unsigned int& p_RecordIndex, const T& p_Record)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						if (p_RecordIndex == m_Folded)
+						{
+							Fold(p_Record);
+						}
+					},
+					l_Folded,
+					m_ObserverId) == CumulativeWriter<T>::RecordReadStatus::Okay;
+			}
+
+			virtual ~StateCheckpoints()
+			{
+				if (m_Registered)
+				{
+					m_Writer.RemoveWriteObserver(m_ObserverId);
+				}
+			}
+
+			const S CurrentState() const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return m_State;
+			}
+
+			// The state after folding records 0 to p_Record inclusive
+			const StateStatus StateAtRecord(const unsigned int& p_Record, S& p_State)
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				if (p_Record >= m_Folded)
+				{
+					return StateStatus::OffsetOutOfRange;
+				}
+
+				const std::uint64_t l_Target(static_cast<std::uint64_t>(p_Record) + 1);
+				const std::size_t l_Index(static_cast<std::size_t>(
+					std::upper_bound(m_CheckpointRecords.begin(), m_CheckpointRecords.end(), l_Target) - m_CheckpointRecords.begin()));
+				S l_State;
+				std::uint64_t l_From(0);
+				if (!LoadCheckpoint(l_Index, l_State, l_From))
+				{
+					return StateStatus::ReadError;
+				}
+				l_Lock.unlock();
+
+				if (!Replay(l_State, l_From, l_Target, [](const T&) { return true; }))
+				{
+					return StateStatus::ReadError;
+				}
+				p_State = l_State;
+				return StateStatus::Okay;
+			}
+
+			// The state after folding every record whose time is at or before
+			// p_Time; records must be written in time order
+			const StateStatus StateAtTime(const long long& p_Time, S& p_State)
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+				if (!m_Time)
+				{
+					return StateStatus::OffsetOutOfRange;
+				}
+
+				const std::size_t l_Index(static_cast<std::size_t>(
+					std::upper_bound(m_CheckpointTimes.begin(), m_CheckpointTimes.end(), static_cast<std::int64_t>(p_Time)) - m_CheckpointTimes.begin()));
+				S l_State;
+				std::uint64_t l_From(0);
+				if (!LoadCheckpoint(l_Index, l_State, l_From))
+				{
+					return StateStatus::ReadError;
+				}
+
+				// The next checkpoint is already past p_Time, so nothing from it on is folded
+				const std::uint64_t l_To(l_Index < m_CheckpointRecords.size() ? m_CheckpointRecords[l_Index] : m_Folded);
+				l_Lock.unlock();
+
+				const TimeFunction& l_TimeOf(m_Time);
+				if (!Replay(l_State, l_From, l_To, [&l_TimeOf, &p_Time](const T& p_Record) { return l_TimeOf(p_Record) <= p_Time; }))
+				{
+					return StateStatus::ReadError;
+				}
+				p_State = l_State;
+				return StateStatus::Okay;
+			}
+	};
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "Predicate.h"
+
+namespace Bluebird
+{
+	namespace Tagged
+	{
+		// Position of U in Types...; does not compile if U is not one of them
+		template<typename U, typename... Types>
+		struct IndexOf;
+
+		template<typename U, typename... Rest>
+		struct IndexOf<U, U, Rest...> : std::integral_constant<std::uint16_t, 0>
+		{
+		};
+
+		template<typename U, typename First, typename... Rest>
+		struct IndexOf<U, First, Rest...> : std::integral_constant<std::uint16_t, 1 + IndexOf<U, Rest...>::value>
+		{
+		};
+
+		// Size and alignment of the largest of Types..., and whether all can be copied as bytes
+		template<typename... Types>
+		struct Largest;
+
+		template<typename Last>
+		struct Largest<Last>
+		{
+			static const std::size_t c_Size = sizeof(Last);
+			static const std::size_t c_Align = alignof(Last);
+			static const bool c_Trivial = std::is_trivially_copyable<Last>::value;
+		};
+
+		template<typename First, typename... Rest>
+		struct Largest<First, Rest...>
+		{
+			static const std::size_t c_Size = sizeof(First) > Largest<Rest...>::c_Size ? sizeof(First) : Largest<Rest...>::c_Size;
+			static const std::size_t c_Align = alignof(First) > Largest<Rest...>::c_Align ? alignof(First) : Largest<Rest...>::c_Align;
+			static const bool c_Trivial = std::is_trivially_copyable<First>::value && Largest<Rest...>::c_Trivial;
+		};
+	}
+
+	// One record of a log holding any of Types...: a type tag, the size of
+	// the value, and the value itself in a slot as big as the largest type.
+	// A CumulativeWriter<TaggedRecord<A, B, C>> keeps every event type in one
+	// file, so a batch mixing types is one write and one sync.
+	//
+	//	using Event = TaggedRecord<Order, Fill, Cancel>;
+	//	const Event l_Batch[] = { Event::Make(l_Order), Event::Make(l_Fill) };
+	//	l_Writer.WriteRecords(l_Batch, 2);
+	template<typename... Types>
+	struct TaggedRecord
+	{
+		static_assert(sizeof...(Types) > 0 && sizeof...(Types) <= 64, "A tagged record holds between 1 and 64 types");
+		static_assert(Tagged::Largest<Types...>::c_Trivial, "Tagged record types must be trivially copyable");
+
+		static const std::size_t	c_DataSize = Tagged::Largest<Types...>::c_Size;
+
+		std::uint16_t	m_Type;
+		std::uint16_t	m_Size;
+		std::uint32_t	m_Reserved;
+		alignas(Tagged::Largest<Types...>::c_Align) unsigned char m_Data[c_DataSize];
+
+		template<typename U>
+		static const std::uint16_t TypeOf() noexcept
+		{
+			return Tagged::IndexOf<U, Types...>::value;
+		}
+
+		template<typename U>
+		static const TaggedRecord Make(const U& p_Value) noexcept
+		{
+			TaggedRecord l_result;
+			std::memset(&l_result, 0, sizeof(l_result));
+			l_result.m_Type = TypeOf<U>();
+			l_result.m_Size = static_cast<std::uint16_t>(sizeof(U));
+			std::memcpy(l_result.m_Data, &p_Value, sizeof(U));
+			return l_result;
+		}
+
+		template<typename U>
+		const bool Is() const noexcept
+		{
+			return m_Type == TypeOf<U>() && m_Size == sizeof(U);
+		}
+
+		// False, leaving p_Value untouched, if the record does not hold a U
+		template<typename U>
+		const bool Get(U& p_Value) const noexcept
+		{
+			if (!Is<U>())
+			{
+				return false;
+			}
+			std::memcpy(&p_Value, m_Data, sizeof(U));
+			return true;
+		}
+	};
+
+	// Keeps a bitmap of the types present in every block of p_BlockRecords
+	// records of a tagged log, so a scan for one type skips blocks that hold
+	// none of it without reading them.  As with ZoneMaps, completed blocks
+	// are appended to a sidecar file and loaded at open, and the block being
+	// filled is kept in memory.  If the log cannot be read to bring the
+	// bitmaps up to date at open, none are offered and every block is read.
+	template<typename... Types>
+	class TypeBitmaps
+	{
+		public:
+
+			using Record = TaggedRecord<Types...>;
+
+		private:
+
+			struct FileHeader
+			{
+				std::uint32_t	m_Magic;
+				std::uint32_t	m_Version;
+				std::uint32_t	m_RecordSize;
+				std::uint32_t	m_BlockRecords;
+				std::uint32_t	m_TypeCount;
+				std::uint32_t	m_Reserved;
+			};
+
+			static const std::uint32_t	c_Magic = 0x50414D54;		// "TMAP"
+			static const std::uint32_t	c_Version = 1;
+
+			CumulativeWriter<Record>&	m_Writer;
+			const std::string			m_Filename;
+			const unsigned int			m_BlockRecords;
+			std::vector<std::uint64_t>	m_Blocks;			// One bitmap per completed block
+			std::uint64_t				m_Open;
+			unsigned int				m_OpenRecords;
+			std::ofstream				m_File;
+			bool						m_Usable;
+			mutable std::mutex			m_Lock;
+			unsigned int				m_ObserverId;
+			bool						m_Registered;
+
+			TypeBitmaps() = delete;
+			TypeBitmaps(const TypeBitmaps&) = delete;
+
+			static const std::uint64_t Bit(const Record& p_Record) noexcept
+			{
+				return p_Record.m_Type < sizeof...(Types) ? std::uint64_t(1) << p_Record.m_Type : 0;
+			}
+
+			const bool Load()
+			{
+				std::ifstream l_File(m_Filename, std::ios_base::in | std::ios_base::binary);
+				FileHeader l_Header;
+				if (!l_File.read(reinterpret_cast<char*>(&l_Header), sizeof(l_Header)) ||
+					l_Header.m_Magic != c_Magic ||
+					l_Header.m_Version != c_Version ||
+					l_Header.m_RecordSize != sizeof(Record) ||
+					l_Header.m_BlockRecords != m_BlockRecords ||
+					l_Header.m_TypeCount != sizeof...(Types))
+				{
+					return false;
+				}
+
+				std::uint64_t l_Bitmap(0);
+				while (l_File.read(reinterpret_cast<char*>(&l_Bitmap), sizeof(l_Bitmap)))
+				{
+					m_Blocks.push_back(l_Bitmap);
+				}
+				return true;
+			}
+
+			const bool Rewrite()
+			{
+				m_File.close();
+				m_File.open(m_Filename, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+				const FileHeader l_Header{ c_Magic, c_Version, sizeof(Record), m_BlockRecords, sizeof...(Types), 0 };
+				m_File.write(reinterpret_cast<const char*>(&l_Header), sizeof(l_Header));
+				if (!m_Blocks.empty())
+				{
+					m_File.write(reinterpret_cast<const char*>(m_Blocks.data()), m_Blocks.size() * sizeof(std::uint64_t));
+				}
+				m_File.flush();
+				return m_File.good();
+			}
+
+			void AppendBlock(const std::uint64_t& p_Bitmap)
+			{
+				m_Blocks.push_back(p_Bitmap);
+				m_File.write(reinterpret_cast<const char*>(&p_Bitmap), sizeof(p_Bitmap));
+				m_File.flush();
+			}
+
+		public:
+
+			TypeBitmaps(
+				CumulativeWriter<Record>& p_Writer,
+				const std::string& p_Filename,
+				const unsigned int& p_BlockRecords = 4096)
+				:
+				m_Writer(p_Writer),
+				m_Filename(p_Filename),
+				m_BlockRecords(p_BlockRecords != 0 ? p_BlockRecords : 1),
+				m_Blocks(),
+				m_Open(0),
+				m_OpenRecords(0),
+				m_File(),
+				m_Usable(true),
+				m_Lock(),
+				m_ObserverId(0),
+				m_Registered(false)
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+
+				// Blocks past the end of the log mean the sidecar belongs to another log
+				if (!Load() || m_Blocks.size() > m_Writer.RecordCount() / m_BlockRecords)
+				{
+					m_Blocks.clear();
+				}
+				Rewrite();
+				const unsigned int l_Mapped(static_cast<unsigned int>(m_Blocks.size()) * m_BlockRecords);
+				l_Lock.unlock();
+
+				// Maps the blocks written since the sidecar was last updated on the way in
+				m_Registered = m_Writer.AddWriteObserver(
+					[this](const unsigned int&, const Record& p_Record)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						if (!m_Usable)
+						{
+							return;
+						}
+						m_Open |= Bit(p_Record);
+						if (++m_OpenRecords == m_BlockRecords)
+						{
+							AppendBlock(m_Open);
+							m_Open = 0;
+							m_OpenRecords = 0;
+						}
+					},
+					l_Mapped,
+					m_ObserverId) == CumulativeWriter<Record>::RecordReadStatus::Okay;
+				if (!m_Registered)
+				{
+					l_Lock.lock();
+					m_Usable = false;
+				}
+			}
+
+			virtual ~TypeBitmaps()
+			{
+				if (m_Registered)
+				{
+					m_Writer.RemoveWriteObserver(m_ObserverId);
+				}
+			}
+
+			const unsigned int& BlockRecords() const noexcept
+			{
+				return m_BlockRecords;
+			}
+
+			// Bit TaggedRecord::TypeOf<U>() is set for every type in block
+			// p_Block, completed or still being filled; false past the end, or
+			// for every block if the bitmaps could not be built
+			const bool BlockTypes(const unsigned int& p_Block, std::uint64_t& p_Bitmap) const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (!m_Usable)
+				{
+					return false;
+				}
+				if (p_Block < m_Blocks.size())
+				{
+					p_Bitmap = m_Blocks[p_Block];
+					return true;
+				}
+				if (p_Block == m_Blocks.size() && m_OpenRecords > 0)
+				{
+					p_Bitmap = m_Open;
+					return true;
+				}
+				return false;
+			}
+
+			// Appends every U in [p_First, p_First + p_Count) to p_Out, in log
+			// order, and its record index to p_Indices if given.  Blocks whose
+			// bitmap has no U are skipped without being read.
+			template<typename U>
+			const ScanStatus Scan(
+				const unsigned int& p_First,
+				const unsigned int& p_Count,
+				std::vector<U>& p_Out,
+				std::vector<unsigned int>* p_Indices = nullptr)
+			{
+				if (p_First > m_Writer.RecordCount() || p_Count > m_Writer.RecordCount() - p_First)
+				{
+					return ScanStatus::OffsetOutOfRange;
+				}
+
+				const std::uint64_t l_Wanted(std::uint64_t(1) << Record::template TypeOf<U>());
+				const unsigned int l_End(p_First + p_Count);
+				std::vector<Record> l_Block;
+				for (unsigned int l_Next(p_First); l_Next < l_End;)
+				{
+					const unsigned int l_BlockIndex(l_Next / m_BlockRecords);
+					const unsigned int l_BlockEnd(std::min(l_End, (l_BlockIndex + 1) * m_BlockRecords));
+					std::uint64_t l_Bitmap(0);
+					if (BlockTypes(l_BlockIndex, l_Bitmap) && (l_Bitmap & l_Wanted) == 0)
+					{
+						l_Next = l_BlockEnd;
+						continue;
+					}
+
+					l_Block.resize(l_BlockEnd - l_Next);
+					if (m_Writer.ReadRecords(l_Next, static_cast<unsigned int>(l_Block.size()), l_Block.data()) !=
+						CumulativeWriter<Record>::RecordReadStatus::Okay)
+					{
+						return ScanStatus::ReadError;
+					}
+
+					U l_Value;
+					for (std::size_t i(0); i < l_Block.size(); ++i)
+					{
+						if (l_Block[i].Get(l_Value))
+						{
+							p_Out.push_back(l_Value);
+							if (p_Indices != nullptr)
+							{
+								p_Indices->push_back(l_Next + static_cast<unsigned int>(i));
+							}
+						}
+					}
+					l_Next = l_BlockEnd;
+				}
+				return ScanStatus::Okay;
+			}
+	};
+
+	template<typename... Types> const std::size_t TaggedRecord<Types...>::c_DataSize;
+	template<typename... Types> const std::uint32_t TypeBitmaps<Types...>::c_Magic;
+	template<typename... Types> const std::uint32_t TypeBitmaps<Types...>::c_Version;
+}
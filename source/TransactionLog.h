@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "FileUtils.h"
+
+namespace Bluebird
+{
+	// A CumulativeWriter<T> whose records are appended in transactions: the
+	// records of a transaction are buffered until Commit, then written with a
+	// commit record after them in a single write and a single sync, so a
+	// group is either wholly in the log or not at all.
+	//
+	//	auto l_Txn(l_Log.BeginTxn());
+	//	l_Txn.Append(l_Order);
+	//	l_Txn.Append(l_Fill);
+	//	l_Txn.Commit();
+	//
+	// On open, anything after the last whole group is cut from the file.  A
+	// commit record only counts if the m_Records entries before it are data
+	// records of the same transaction, since a crash part way through a
+	// write can leave a later page of it on disk and lose an earlier one.
+	// If the log cannot be read or cut, Recovery says so and commits are
+	// refused.  Transactions on different threads may be built at once;
+	// their commits are serialized by the writer, so groups never interleave.
+	template<typename T>
+	class TransactionLog
+	{
+		public:
+
+			struct Entry
+			{
+				std::uint32_t	m_Kind;			// c_DataKind or c_CommitKind
+				std::uint32_t	m_Records;		// Commit records: data records in the transaction
+				std::uint64_t	m_Transaction;
+				T				m_Record;		// Zeroed in commit records
+			};
+
+			using Writer = CumulativeWriter<Entry>;
+			using RecordReadStatus = typename Writer::RecordReadStatus;
+
+			static const std::uint32_t	c_DataKind = 0x41544144;		// "DATA"
+			static const std::uint32_t	c_CommitKind = 0x54494D43;		// "CMIT"
+
+			enum class RecoveryState
+			{
+				Unknown,
+				ErrorReading,			// The log was left as it was; commits are refused
+				ErrorTruncating,		// Uncommitted records remain; commits are refused
+				Okay		=	255
+			};
+
+			class Transaction
+			{
+				private:
+
+					TransactionLog*		m_Log;
+					std::uint64_t		m_Id;
+					std::vector<Entry>	m_Entries;
+
+					Transaction() = delete;
+					Transaction(const Transaction&) = delete;
+
+				public:
+
+					Transaction(TransactionLog* p_Log, const std::uint64_t& p_Id)
+						:
+						m_Log(p_Log),
+						m_Id(p_Id),
+						m_Entries()
+					{
+					}
+
+					Transaction(Transaction&& p_Other) noexcept
+						:
+						m_Log(p_Other.m_Log),
+						m_Id(p_Other.m_Id),
+						m_Entries(std::move(p_Other.m_Entries))
+					{
+						p_Other.m_Log = nullptr;
+					}
+
+					const std::uint64_t& Id() const noexcept
+					{
+						return m_Id;
+					}
+
+					const std::size_t Size() const noexcept
+					{
+						return m_Entries.size();
+					}
+
+					void Append(const T& p_Record)
+					{
+						Entry l_Entry;
+						std::memset(&l_Entry, 0, sizeof(l_Entry));
+						l_Entry.m_Kind = c_DataKind;
+						l_Entry.m_Transaction = m_Id;
+						l_Entry.m_Record = p_Record;
+						m_Entries.push_back(l_Entry);
+					}
+
+					void Append(const T* p_Records, const unsigned int& p_Count)
+					{
+						for (unsigned int i(0); i < p_Count; ++i)
+						{
+							Append(p_Records[i]);
+						}
+					}
+
+					// Writes the records and their commit record; false if the write
+					// failed, or the transaction was already committed or aborted
+					const bool Commit()
+					{
+						if (m_Log == nullptr || m_Log->m_Recovery != RecoveryState::Okay)
+						{
+							Abort();
+							return false;
+						}
+
+						Entry l_Commit;
+						std::memset(&l_Commit, 0, sizeof(l_Commit));
+						l_Commit.m_Kind = c_CommitKind;
+						l_Commit.m_Records = static_cast<std::uint32_t>(m_Entries.size());
+						l_Commit.m_Transaction = m_Id;
+						m_Entries.push_back(l_Commit);
+
+						const bool l_result(m_Log->m_Writer->WriteRecords(m_Entries.data(), static_cast<unsigned int>(m_Entries.size())));
+						Abort();
+						return l_result;
+					}
+
+					// Drops the buffered records without writing anything
+					void Abort() noexcept
+					{
+						m_Entries.clear();
+						m_Log = nullptr;
+					}
+			};
+
+		private:
+
+			std::unique_ptr<Writer>	m_Writer;
+			std::uint64_t		m_NextTransaction;
+			unsigned int		m_Discarded;
+			RecoveryState		m_Recovery;
+			std::mutex			m_Lock;
+
+			TransactionLog() = delete;
+			TransactionLog(const TransactionLog&) = delete;
+
+			// True if the p_Record.m_Records entries before the commit record at p_Commit
+			// are the data records of its transaction
+			const bool WholeGroup(const unsigned int& p_Commit, const Entry& p_Record, bool& p_ReadError)
+			{
+				static const unsigned int c_ScanRecords = 4096;
+
+				if (p_Record.m_Records > p_Commit)
+				{
+					return false;
+				}
+				std::vector<Entry> l_Block;
+				for (unsigned int l_First(p_Commit - p_Record.m_Records); l_First < p_Commit;)
+				{
+					l_Block.resize(std::min(p_Commit - l_First, c_ScanRecords));
+					if (m_Writer->ReadRecords(l_First, static_cast<unsigned int>(l_Block.size()), l_Block.data()) != RecordReadStatus::Okay)
+					{
+						p_ReadError = true;
+						return false;
+					}
+					for (const auto& l_Entry : l_Block)
+					{
+						if (l_Entry.m_Kind != c_DataKind || l_Entry.m_Transaction != p_Record.m_Transaction)
+						{
+							return false;
+						}
+					}
+					l_First += static_cast<unsigned int>(l_Block.size());
+				}
+				return true;
+			}
+
+			// Finds the end of the last whole committed group and cuts the file there
+			void Recover(const std::string& p_Filename)
+			{
+				static const unsigned int c_ScanRecords = 4096;
+
+				const unsigned int l_Total(m_Writer->RecordCount());
+				unsigned int l_Committed(0);
+				bool l_ReadError(false);
+				std::vector<Entry> l_Block;
+				for (unsigned int l_End(l_Total); l_End > 0 && l_Committed == 0 && !l_ReadError;)
+				{
+					const unsigned int l_First(l_End - std::min(l_End, c_ScanRecords));
+					l_Block.resize(l_End - l_First);
+					if (m_Writer->ReadRecords(l_First, static_cast<unsigned int>(l_Block.size()), l_Block.data()) != RecordReadStatus::Okay)
+					{
+						l_ReadError = true;
+						break;
+					}
+					for (std::size_t i(l_Block.size()); i > 0 && !l_ReadError; --i)
+					{
+						const unsigned int l_Index(l_First + static_cast<unsigned int>(i) - 1);
+						if (l_Block[i - 1].m_Kind == c_CommitKind && WholeGroup(l_Index, l_Block[i - 1], l_ReadError))
+						{
+							l_Committed = l_Index + 1;
+							m_NextTransaction = l_Block[i - 1].m_Transaction + 1;
+							break;
+						}
+					}
+					l_End = l_First;
+				}
+
+				if (l_ReadError)
+				{
+					m_Recovery = RecoveryState::ErrorReading;
+					return;
+				}
+				if (l_Committed == l_Total && m_Writer->WasOkayAtLoad())
+				{
+					m_Recovery = RecoveryState::Okay;
+					return;
+				}
+
+				m_Writer.reset();
+				if (TruncateFile(p_Filename, static_cast<unsigned long long>(l_Committed) * sizeof(Entry)))
+				{
+					m_Discarded = l_Total - l_Committed;
+					m_Recovery = RecoveryState::Okay;
+				}
+				else
+				{
+					m_Recovery = RecoveryState::ErrorTruncating;
+				}
+				m_Writer.reset(new Writer(p_Filename));
+			}
+
+		public:
+
+			TransactionLog(const std::string& p_Filename)
+				:
+				m_Writer(new Writer(p_Filename)),
+				m_NextTransaction(1),
+				m_Discarded(0),
+				m_Recovery(RecoveryState::Unknown),
+				m_Lock()
+			{
+				Recover(p_Filename);
+			}
+
+			virtual ~TransactionLog()
+			{
+				m_Writer->Close();
+			}
+
+			Transaction BeginTxn()
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				return Transaction(this, m_NextTransaction++);
+			}
+
+			const RecoveryState& Recovery() const noexcept
+			{
+				return m_Recovery;
+			}
+
+			// Data and commit records in the log
+			const unsigned int& RecordCount() const noexcept
+			{
+				return m_Writer->RecordCount();
+			}
+
+			// Uncommitted records cut from the end of the file when it was opened
+			const unsigned int& DiscardedAtLoad() const noexcept
+			{
+				return m_Discarded;
+			}
+
+			// Appends the data records among log records [p_First, p_First + p_Count) to p_Out
+			const RecordReadStatus Read(const unsigned int& p_First, const unsigned int& p_Count, std::vector<T>& p_Out)
+			{
+				std::vector<Entry> l_Entries(p_Count);
+				const RecordReadStatus l_Status(m_Writer->ReadRecords(p_First, p_Count, l_Entries.data()));
+				if (l_Status == RecordReadStatus::Okay)
+				{
+					for (const auto& l_Entry : l_Entries)
+					{
+						if (l_Entry.m_Kind == c_DataKind)
+						{
+							p_Out.push_back(l_Entry.m_Record);
+						}
+					}
+				}
+				return l_Status;
+			}
+
+			// The underlying writer, for observers and flush settings; records
+			// must only be appended through transactions
+			Writer& Underlying() noexcept
+			{
+				return *m_Writer;
+			}
+	};
+
+	template<typename T> const std::uint32_t TransactionLog<T>::c_DataKind;
+	template<typename T> const std::uint32_t TransactionLog<T>::c_CommitKind;
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CumulativeWriter.h"
+
+namespace Bluebird
+{
+	enum class AggregateKind
+	{
+		Count,
+		Sum,
+		Mean,
+		Min,
+		Max,
+		NonFinite
+	};
+
+	// Rolling aggregates over one field of the records appended to a
+	// CumulativeWriter<T>, covering either the last N records or the records
+	// written in the last T of time.  Each append updates every window in O(1)
+	// amortised: the sum and count are running totals and minimum/maximum
+	// come from monotonic deques, so queries never re-read the log.  The
+	// running sum is added up again from the window's samples each time as
+	// many samples have left the window as it holds, so rounding cannot build
+	// up over a long run.
+	//
+	// NaN and infinite values are left out of every aggregate and only
+	// counted, as AggregateKind::NonFinite.  A record window starts from the
+	// last N records already in the log; a time window, having no write times
+	// for those, starts empty.
+	template<typename T>
+	class WindowAggregates
+	{
+		public:
+
+			using Clock = std::chrono::steady_clock;
+			using RecordReadStatus = typename CumulativeWriter<T>::RecordReadStatus;
+
+		private:
+
+			struct Sample
+			{
+				unsigned long long	m_Sequence;
+				Clock::time_point	m_Time;
+				double				m_Value;
+			};
+
+			struct Window
+			{
+				std::function<double(const T&)>	m_Field;
+				unsigned int					m_Records;
+				Clock::duration					m_Age;
+				std::deque<Sample>				m_Samples;
+				std::deque<Sample>				m_Minimum;
+				std::deque<Sample>				m_Maximum;
+				double							m_Sum;
+				unsigned long long				m_Sequence;
+				unsigned long long				m_Evicted;			// Since m_Sum was last added up
+				unsigned long long				m_NonFinite;
+				unsigned int					m_ObserverId;
+			};
+
+			CumulativeWriter<T>&					m_Writer;
+			std::vector<std::unique_ptr<Window>>	m_Windows;
+			mutable std::mutex						m_Lock;
+
+			WindowAggregates() = delete;
+			WindowAggregates(const WindowAggregates&) = delete;
+
+			static void Evict(Window& p_Window, const Clock::time_point& p_Now) noexcept
+			{
+				while (!p_Window.m_Samples.empty() &&
+					((p_Window.m_Records != 0 && p_Window.m_Samples.size() > p_Window.m_Records) ||
+					(p_Window.m_Records == 0 && p_Now - p_Window.m_Samples.front().m_Time > p_Window.m_Age)))
+				{
+					const unsigned long long l_Sequence(p_Window.m_Samples.front().m_Sequence);
+					p_Window.m_Sum -= p_Window.m_Samples.front().m_Value;
+					p_Window.m_Samples.pop_front();
+					++p_Window.m_Evicted;
+
+					if (!p_Window.m_Minimum.empty() && p_Window.m_Minimum.front().m_Sequence == l_Sequence)
+					{
+						p_Window.m_Minimum.pop_front();
+					}
+					if (!p_Window.m_Maximum.empty() && p_Window.m_Maximum.front().m_Sequence == l_Sequence)
+					{
+						p_Window.m_Maximum.pop_front();
+					}
+				}
+
+				// Add the sum up again once as many samples have left as remain
+				if (p_Window.m_Evicted != 0 && p_Window.m_Evicted >= p_Window.m_Samples.size())
+				{
+					p_Window.m_Sum = 0;
+					for (const Sample& l_Sample : p_Window.m_Samples)
+					{
+						p_Window.m_Sum += l_Sample.m_Value;
+					}
+					p_Window.m_Evicted = 0;
+				}
+			}
+
+			static void Push(Window& p_Window, const Clock::time_point& p_Now, const double& p_Value)
+			{
+				if (!std::isfinite(p_Value))
+				{
+					++p_Window.m_NonFinite;
+					return;
+				}
+
+				const Sample l_Sample{ p_Window.m_Sequence++, p_Now, p_Value };
+				p_Window.m_Samples.push_back(l_Sample);
+				p_Window.m_Sum += l_Sample.m_Value;
+
+				while (!p_Window.m_Minimum.empty() && p_Window.m_Minimum.back().m_Value >= l_Sample.m_Value)
+				{
+					p_Window.m_Minimum.pop_back();
+				}
+				p_Window.m_Minimum.push_back(l_Sample);
+
+				while (!p_Window.m_Maximum.empty() && p_Window.m_Maximum.back().m_Value <= l_Sample.m_Value)
+				{
+					p_Window.m_Maximum.pop_back();
+				}
+				p_Window.m_Maximum.push_back(l_Sample);
+			}
+
+			// Registers a window fed from record p_FirstRecord on.  The catch-up
+			// runs under the writer's lock, so m_Lock must not be held here
+			template<typename M>
+			const RecordReadStatus AddWindow(
+				M T::* p_Member,
+				const unsigned int& p_Records,
+				const Clock::duration& p_Age,
+				const unsigned int& p_FirstRecord,
+				unsigned int& p_Window)
+			{
+				std::unique_ptr<Window> l_Window;
+				try
+				{
+					l_Window.reset(new Window());
+					l_Window->m_Field = [p_Member](const T& p_Record) { return static_cast<double>(p_Record.*p_Member); };
+				}
+				catch (const std::bad_alloc&)
+				{
+					return RecordReadStatus::BadMemoryAlloc;
+				}
+				l_Window->m_Records = p_Records;
+				l_Window->m_Age = p_Age;
+				l_Window->m_Sum = 0;
+				l_Window->m_Sequence = 0;
+				l_Window->m_Evicted = 0;
+				l_Window->m_NonFinite = 0;
+
+				Window* l_Target(l_Window.get());
+				const RecordReadStatus l_Status(m_Writer.AddWriteObserver(
+					[this, l_Target](const unsigned int&, const T& p_Record)
+					{
+						const Clock::time_point l_Now(Clock::now());
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						Push(*l_Target, l_Now, l_Target->m_Field(p_Record));
+						Evict(*l_Target, l_Now);
+					},
+					p_FirstRecord,
+					l_Window->m_ObserverId));
+				if (l_Status != RecordReadStatus::Okay)
+				{
+					return l_Status;
+				}
+
+				try
+				{
+					std::lock_guard<std::mutex> l_Lock(m_Lock);
+					m_Windows.push_back(std::move(l_Window));
+					p_Window = static_cast<unsigned int>(m_Windows.size() - 1);
+				}
+				catch (const std::bad_alloc&)
+				{
+					m_Writer.RemoveWriteObserver(l_Target->m_ObserverId);
+					return RecordReadStatus::BadMemoryAlloc;
+				}
+				return RecordReadStatus::Okay;
+			}
+
+		public:
+
+			WindowAggregates(CumulativeWriter<T>& p_Writer)
+				:
+				m_Writer(p_Writer),
+				m_Windows(),
+				m_Lock()
+			{
+			}
+
+			virtual ~WindowAggregates()
+			{
+				for (const auto& l_Window : m_Windows)
+				{
+					m_Writer.RemoveWriteObserver(l_Window->m_ObserverId);
+				}
+			}
+
+			// A window over the last p_Records records written, starting from
+			// those already in the log, setting p_Window to its id
+			template<typename M>
+			const RecordReadStatus AddRecordWindow(M T::* p_Member, const unsigned int& p_Records, unsigned int& p_Window)
+			{
+				const unsigned int l_Records(p_Records != 0 ? p_Records : 1);
+				const unsigned int l_Written(m_Writer.LockedRecordCount());
+				return AddWindow(p_Member, l_Records, Clock::duration::zero(), l_Written > l_Records ? l_Written - l_Records : 0, p_Window);
+			}
+
+			// A window over the records written within the last p_Age, setting
+			// p_Window to its id
+			template<typename M>
+			const RecordReadStatus AddTimeWindow(M T::* p_Member, const Clock::duration& p_Age, unsigned int& p_Window)
+			{
+				return AddWindow(p_Member, 0, p_Age, m_Writer.LockedRecordCount(), p_Window);
+			}
+
+			// False for an unknown window, or Mean/Min/Max of an empty one
+			const bool Query(const unsigned int& p_Window, const AggregateKind& p_Kind, double& p_Result) const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (p_Window >= m_Windows.size())
+				{
+					return false;
+				}
+
+				Window& l_Window(*m_Windows[p_Window]);
+				Evict(l_Window, Clock::now());
+
+				switch (p_Kind)
+				{
+					case AggregateKind::Count:
+						p_Result = static_cast<double>(l_Window.m_Samples.size());
+						return true;
+					case AggregateKind::Sum:
+						p_Result = l_Window.m_Sum;
+						return true;
+					case AggregateKind::NonFinite:
+						p_Result = static_cast<double>(l_Window.m_NonFinite);
+						return true;
+					default:
+						break;
+				}
+
+				if (l_Window.m_Samples.empty())
+				{
+					return false;
+				}
+
+				switch (p_Kind)
+				{
+					case AggregateKind::Mean:
+						p_Result = l_Window.m_Sum / l_Window.m_Samples.size();
+						break;
+					case AggregateKind::Min:
+						p_Result = l_Window.m_Minimum.front().m_Value;
+						break;
+					default:
+						p_Result = l_Window.m_Maximum.front().m_Value;
+						break;
+				}
+				return true;
+			}
+	};
+}
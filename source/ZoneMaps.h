@@ -0,0 +1,356 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CumulativeWriter.h"
+#include "RecordField.h"
+
+namespace Bluebird
+{
+	// The minimum and maximum of every zoned field over one block of records.
+	// Bounds are kept as the field's own bytes in a 64 bit slot so no value
+	// is rounded through a wider type.
+	class Zone
+	{
+		private:
+
+			const RecordFields*			m_Fields;
+			std::vector<std::uint64_t>	m_Bounds;
+			unsigned int				m_Records;
+
+			template<typename M>
+			static const M Decode(const std::uint64_t& p_Slot) noexcept
+			{
+				M l_result;
+				std::memcpy(&l_result, &p_Slot, sizeof(M));
+				return l_result;
+			}
+
+		public:
+
+			Zone()
+				:
+				m_Fields(nullptr),
+				m_Bounds(),
+				m_Records(0)
+			{
+			}
+
+			void Assign(const RecordFields& p_Fields, const std::uint64_t* p_Bounds, const unsigned int& p_Records)
+			{
+				m_Fields = &p_Fields;
+				m_Bounds.assign(p_Bounds, p_Bounds + p_Fields.size() * 2);
+				m_Records = p_Records;
+			}
+
+			const unsigned int& Records() const noexcept
+			{
+				return m_Records;
+			}
+
+			// False when the field at p_Offset is not zoned as an M
+			template<typename M>
+			const bool Bounds(const std::size_t& p_Offset, M& p_Min, M& p_Max) const noexcept
+			{
+				if (m_Fields == nullptr || m_Records == 0)
+				{
+					return false;
+				}
+
+				for (std::size_t i(0); i < m_Fields->size(); ++i)
+				{
+					const RecordField& l_Field((*m_Fields)[i]);
+					if (l_Field.m_Offset == p_Offset && l_Field.m_Type == FieldTypeOf<M>())
+					{
+						p_Min = Decode<M>(m_Bounds[i * 2]);
+						p_Max = Decode<M>(m_Bounds[i * 2 + 1]);
+						return true;
+					}
+				}
+				return false;
+			}
+	};
+
+	// Keeps a Zone for every block of p_BlockRecords records of a
+	// CumulativeWriter<T> over the given fields, so scans can skip blocks
+	// that cannot hold a match without reading them.  Completed blocks are
+	// appended to a sidecar file and loaded at open; the block being filled
+	// is kept in memory and updated as records are written.  NaNs are left
+	// out of a block's bounds, as no ordered comparison matches them.  If
+	// the log cannot be read to bring the zones up to date at open, no zone
+	// is offered and every block is read.
+	template<typename T>
+	class ZoneMaps
+	{
+		private:
+
+			struct FileHeader
+			{
+				std::uint32_t	m_Magic;
+				std::uint32_t	m_Version;
+				std::uint32_t	m_RecordSize;
+				std::uint32_t	m_BlockRecords;
+				std::uint32_t	m_FieldCount;
+				std::uint32_t	m_Reserved;
+			};
+
+			struct FileField
+			{
+				std::uint32_t	m_Offset;
+				std::uint32_t	m_Type;
+			};
+
+			static const std::uint32_t	c_Magic = 0x454E4F5A;		// "ZONE"
+			static const std::uint32_t	c_Version = 1;
+
+			CumulativeWriter<T>&		m_Writer;
+			const RecordFields			m_Fields;
+			const std::string			m_Filename;
+			const unsigned int			m_BlockRecords;
+			std::vector<std::uint64_t>	m_Blocks;			// Two slots per field per completed block
+			std::vector<std::uint64_t>	m_Open;
+			unsigned int				m_OpenRecords;
+			std::ofstream				m_File;
+			bool						m_Usable;
+			mutable std::mutex			m_Lock;
+			unsigned int				m_ObserverId;
+			bool						m_Registered;
+
+			ZoneMaps() = delete;
+			ZoneMaps(const ZoneMaps&) = delete;
+
+			template<typename M>
+			static void Widen(const char* p_Value, std::uint64_t& p_Min, std::uint64_t& p_Max, const bool& p_First) noexcept
+			{
+				M l_Value;
+				M l_Min;
+				M l_Max;
+				std::memcpy(&l_Value, p_Value, sizeof(M));
+				std::memcpy(&l_Min, &p_Min, sizeof(M));
+				std::memcpy(&l_Max, &p_Max, sizeof(M));
+				if (l_Value != l_Value)
+				{
+					// A NaN only sets the bounds until the first number replaces them
+					if (p_First)
+					{
+						std::memcpy(&p_Min, &l_Value, sizeof(M));
+						std::memcpy(&p_Max, &l_Value, sizeof(M));
+					}
+					return;
+				}
+
+				const bool l_Empty(p_First || l_Min != l_Min);
+				if (l_Empty || l_Value < l_Min)
+				{
+					std::memcpy(&p_Min, &l_Value, sizeof(M));
+				}
+				if (l_Empty || l_Value > l_Max)
+				{
+					std::memcpy(&p_Max, &l_Value, sizeof(M));
+				}
+			}
+
+			// Widens the bounds in p_Bounds, which already cover p_Records records, by p_Record
+			void Add(std::uint64_t* p_Bounds, const unsigned int& p_Records, const T& p_Record) const noexcept
+			{
+				const char* l_Record(reinterpret_cast<const char*>(&p_Record));
+				const bool l_First(p_Records == 0);
+				for (std::size_t i(0); i < m_Fields.size(); ++i)
+				{
+					const char* l_Value(l_Record + m_Fields[i].m_Offset);
+					std::uint64_t& l_Min(p_Bounds[i * 2]);
+					std::uint64_t& l_Max(p_Bounds[i * 2 + 1]);
+					switch (m_Fields[i].m_Type)
+					{
+						case FieldType::Int8:		Widen<std::int8_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::UInt8:		Widen<std::uint8_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::Int16:		Widen<std::int16_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::UInt16:		Widen<std::uint16_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::Int32:		Widen<std::int32_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::UInt32:		Widen<std::uint32_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::Int64:		Widen<std::int64_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::UInt64:		Widen<std::uint64_t>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::Float32:	Widen<float>(l_Value, l_Min, l_Max, l_First); break;
+						case FieldType::Float64:	Widen<double>(l_Value, l_Min, l_Max, l_First); break;
+					}
+				}
+			}
+
+			// Loads the completed blocks from the sidecar if it describes these fields
+			const bool Load()
+			{
+				std::ifstream l_File(m_Filename, std::ios_base::in | std::ios_base::binary);
+				FileHeader l_Header;
+				if (!l_File.read(reinterpret_cast<char*>(&l_Header), sizeof(l_Header)) ||
+					l_Header.m_Magic != c_Magic ||
+					l_Header.m_Version != c_Version ||
+					l_Header.m_RecordSize != sizeof(T) ||
+					l_Header.m_BlockRecords != m_BlockRecords ||
+					l_Header.m_FieldCount != m_Fields.size())
+				{
+					return false;
+				}
+
+				for (const auto& l_Field : m_Fields)
+				{
+					FileField l_Stored;
+					if (!l_File.read(reinterpret_cast<char*>(&l_Stored), sizeof(l_Stored)) ||
+						l_Stored.m_Offset != l_Field.m_Offset ||
+						l_Stored.m_Type != static_cast<std::uint32_t>(l_Field.m_Type))
+					{
+						return false;
+					}
+				}
+
+				// A torn final block is dropped and rebuilt
+				const std::size_t l_Slots(m_Fields.size() * 2);
+				std::vector<std::uint64_t> l_Bounds(l_Slots);
+				while (l_File.read(reinterpret_cast<char*>(l_Bounds.data()), l_Slots * sizeof(std::uint64_t)))
+				{
+					m_Blocks.insert(m_Blocks.end(), l_Bounds.begin(), l_Bounds.end());
+				}
+				return true;
+			}
+
+			const bool Rewrite()
+			{
+				m_File.close();
+				m_File.open(m_Filename, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+				const FileHeader l_Header{ c_Magic, c_Version, sizeof(T), m_BlockRecords, static_cast<std::uint32_t>(m_Fields.size()), 0 };
+				m_File.write(reinterpret_cast<const char*>(&l_Header), sizeof(l_Header));
+				for (const auto& l_Field : m_Fields)
+				{
+					const FileField l_Stored{ static_cast<std::uint32_t>(l_Field.m_Offset), static_cast<std::uint32_t>(l_Field.m_Type) };
+					m_File.write(reinterpret_cast<const char*>(&l_Stored), sizeof(l_Stored));
+				}
+				if (!m_Blocks.empty())
+				{
+					m_File.write(reinterpret_cast<const char*>(m_Blocks.data()), m_Blocks.size() * sizeof(std::uint64_t));
+				}
+				m_File.flush();
+				return m_File.good();
+			}
+
+			void AppendBlock(const std::uint64_t* p_Bounds)
+			{
+				m_Blocks.insert(m_Blocks.end(), p_Bounds, p_Bounds + m_Fields.size() * 2);
+				m_File.write(reinterpret_cast<const char*>(p_Bounds), m_Fields.size() * 2 * sizeof(std::uint64_t));
+				m_File.flush();
+			}
+
+		public:
+
+			ZoneMaps(
+				CumulativeWriter<T>& p_Writer,
+				const RecordFields& p_Fields,
+				const std::string& p_Filename,
+				const unsigned int& p_BlockRecords = 4096)
+				:
+				m_Writer(p_Writer),
+				m_Fields(p_Fields),
+				m_Filename(p_Filename),
+				m_BlockRecords(p_BlockRecords != 0 ? p_BlockRecords : 1),
+				m_Blocks(),
+				m_Open(p_Fields.size() * 2, 0),
+				m_OpenRecords(0),
+				m_File(),
+				m_Usable(true),
+				m_Lock(),
+				m_ObserverId(0),
+				m_Registered(false)
+			{
+				std::unique_lock<std::mutex> l_Lock(m_Lock);
+
+				// Blocks past the end of the log mean the sidecar belongs to another log
+				const unsigned int l_Complete(m_Writer.RecordCount() / m_BlockRecords);
+				const std::size_t l_Slots(m_Fields.size() * 2);
+				if (!Load() || (l_Slots > 0 && m_Blocks.size() / l_Slots > l_Complete))
+				{
+					m_Blocks.clear();
+				}
+				if (l_Slots > 0)
+				{
+					m_Blocks.resize(m_Blocks.size() / l_Slots * l_Slots);
+				}
+				Rewrite();
+				const unsigned int l_Zoned((l_Slots > 0 ? static_cast<unsigned int>(m_Blocks.size() / l_Slots) : l_Complete) * m_BlockRecords);
+				l_Lock.unlock();
+
+				// Zones the blocks written since the sidecar was last updated on the way in
+				m_Registered = m_Writer.AddWriteObserver(
+					[this](const unsigned int&, const T& p_Record)
+					{
+						std::lock_guard<std::mutex> l_Lock(m_Lock);
+						if (!m_Usable)
+						{
+							return;
+						}
+						Add(m_Open.data(), m_OpenRecords++, p_Record);
+						if (m_OpenRecords == m_BlockRecords)
+						{
+							AppendBlock(m_Open.data());
+							m_OpenRecords = 0;
+						}
+					},
+					l_Zoned,
+					m_ObserverId) == CumulativeWriter<T>::RecordReadStatus::Okay;
+				if (!m_Registered)
+				{
+					l_Lock.lock();
+					m_Usable = false;
+				}
+			}
+
+			virtual ~ZoneMaps()
+			{
+				if (m_Registered)
+				{
+					m_Writer.RemoveWriteObserver(m_ObserverId);
+				}
+			}
+
+			const unsigned int& BlockRecords() const noexcept
+			{
+				return m_BlockRecords;
+			}
+
+			const RecordFields& Fields() const noexcept
+			{
+				return m_Fields;
+			}
+
+			// The zone of block p_Block, completed or still being filled; false
+			// past the end, or for every block if the zones could not be built
+			const bool BlockZone(const unsigned int& p_Block, Zone& p_Zone) const
+			{
+				std::lock_guard<std::mutex> l_Lock(m_Lock);
+				if (!m_Usable)
+				{
+					return false;
+				}
+				const std::size_t l_Slots(m_Fields.size() * 2);
+				const std::size_t l_Completed(l_Slots > 0 ? m_Blocks.size() / l_Slots : 0);
+				if (p_Block < l_Completed)
+				{
+					p_Zone.Assign(m_Fields, m_Blocks.data() + p_Block * l_Slots, m_BlockRecords);
+					return true;
+				}
+				if (p_Block == l_Completed && m_OpenRecords > 0)
+				{
+					p_Zone.Assign(m_Fields, m_Open.data(), m_OpenRecords);
+					return true;
+				}
+				return false;
+			}
+	};
+
+	template<typename T> const std::uint32_t ZoneMaps<T>::c_Magic;
+	template<typename T> const std::uint32_t ZoneMaps<T>::c_Version;
+}
@@ -1,481 +1,1272 @@
-#include <ios>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
-#include <iostream>
+#include <cstring>
 #include <fstream>
-#include <chrono>
-#include <mutex>
-#include <thread>
+#include <limits>
 #include <memory>
-#ifndef _WIN32
-	#include <unistd.h>
-#else
-	#ifndef WIN32_LEAN_AND_MEAN
-		#define WIN32_LEAN_AND_MEAN
-	#endif
-	#include <Windows.h>
-#endif
-
+#include <sstream>
+#include <thread>
 
+#include "ArrowExporter.h"
+#include "ColumnBatchReader.h"
+#include "CommitCoordinator.h"
+#include "CumulativeWriter.h"
+#include "ExternalSorter.h"
+#include "FileUtils.h"
+#include "HashIndex.h"
+#include "IdempotentWriter.h"
+#include "KeyValueView.h"
+#include "LeasedWriter.h"
+#include "LogMerger.h"
+#include "MultiplexedLog.h"
+#include "Predicate.h"
+#include "QuantileSketches.h"
+#include "RecordSampler.h"
+#include "ReverseReader.h"
+#include "ScanCursor.h"
+#include "SegmentBloomFilters.h"
+#include "SharedAppendLog.h"
+#include "StateCheckpoints.h"
+#include "TaggedRecords.h"
+#include "TransactionLog.h"
+#include "WindowAggregates.h"
 
 namespace Bluebird
 {
-#ifdef _WIN32
-	//Returns the last Win32 error, in string format. Returns an empty string if there is no error.
-	const std::string GetLastErrorAsString(const DWORD& p_Error)
+	struct Something
+	{
+		unsigned int X, Y, Z;
+	};
+
+	struct Reading
+	{
+		unsigned int Sensor;
+		float Value;
+	};
+
+	struct Total
+	{
+		unsigned long long Sum;
+	};
+
+	struct Flagged
+	{
+		unsigned int Id;
+		bool Set;
+	};
+
+	void PrintSomething(const Something& p_Other)
+	{
+		std::cout << "Record Print [0x" << std::hex << p_Other.X << ", 0x" << p_Other.Y << ", 0x" << p_Other.Z << "]" << std::endl;
+	}
+
+	const bool Expect(const bool& p_Condition, const std::string& p_What)
 	{
-		std::string l_result("No Error");
-		
-		if (p_Error != 0)
+		if (!p_Condition)
 		{
-			LPSTR messageBuffer(nullptr);
-			size_t size(
-				FormatMessageA(
-					FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-					NULL,
-					p_Error,
-					MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-					(LPSTR)&messageBuffer,
-					0,
-					NULL));
+			std::cout << p_What << " Failed..." << std::endl;
+		}
+		return p_Condition;
+	}
 
-			l_result = std::string(messageBuffer, size);
+	// Leaves p_Bytes of junk on the end of p_Filename, as a writer that died part way would
+	void AppendJunk(const std::string& p_Filename, const std::size_t& p_Bytes)
+	{
+		std::ofstream l_File(p_Filename, std::ios_base::out | std::ios_base::binary | std::ios_base::app);
+		const std::string l_Junk(p_Bytes, 'Z');
+		l_File.write(l_Junk.data(), l_Junk.size());
+	}
+
+	// An exported range comes out as a schema, batches of columns in record
+	// order and the end of stream marker
+	const bool TestArrowExport()
+	{
+		const std::string l_Filename("behaviour_exported.log");
+		std::remove(l_Filename.c_str());
 
-			//Free the buffer.
-			LocalFree(messageBuffer);
+		CumulativeWriter<Something> l_Log(l_Filename);
+		for (unsigned int i = 0; i < 1000; ++i)
+		{
+			Something l_Record{ i, i * 2, i * 3 };
+			l_Log.Write(&l_Record);
 		}
 
-		return l_result;
+		ArrowExporter<Something> l_Exporter(
+			{ MakeRecordField("X", &Something::X), MakeRecordField("Y", &Something::Y), MakeRecordField("Z", &Something::Z) },
+			300,
+			3);
+		std::ostringstream l_Out;
+		bool l_Passed(Expect(l_Exporter.Export(l_Log, 10, 990, l_Out) == ArrowExporter<Something>::ExportStatus::Okay, "Arrow Export"));
+		const std::string l_Stream(l_Out.str());
+
+		// Steps over each message by its metadata length; a batch body is
+		// three columns of four byte values, each padded to eight bytes
+		const auto l_Word([&l_Stream](const std::size_t& p_Offset)
+		{
+			std::uint32_t l_Value(0);
+			if (p_Offset + sizeof(l_Value) <= l_Stream.size())
+			{
+				std::memcpy(&l_Value, l_Stream.data() + p_Offset, sizeof(l_Value));
+			}
+			return l_Value;
+		});
+		std::size_t l_Offset(8 + l_Word(4));
+		unsigned int l_Expected(10);
+		for (const unsigned int l_Rows : { 300u, 300u, 300u, 90u })
+		{
+			const std::size_t l_Body(l_Offset + 8 + l_Word(l_Offset + 4));
+			const std::size_t l_Column((l_Rows * 4 + 7) / 8 * 8);
+			l_Passed &= Expect(
+				l_Word(l_Offset) == 0xFFFFFFFF &&
+					l_Word(l_Body) == l_Expected &&
+					l_Word(l_Body + (l_Rows - 1) * 4) == l_Expected + l_Rows - 1 &&
+					l_Word(l_Body + l_Column) == l_Expected * 2 &&
+					l_Word(l_Body + l_Column * 2) == l_Expected * 3,
+				"Arrow Batch");
+			l_Offset = l_Body + l_Column * 3;
+			l_Expected += l_Rows;
+		}
+		l_Passed &= Expect(l_Word(l_Offset) == 0xFFFFFFFF && l_Word(l_Offset + 4) == 0 && l_Offset + 8 == l_Stream.size(), "Arrow End Of Stream");
+		return l_Passed;
 	}
-#endif
 
-	struct Something
+	// Ordered logs merge into one ordered log, and a failed read stops the
+	// merge without appending what was merged after it
+	const bool TestLogMerge()
 	{
-		unsigned int X, Y, Z;
-	};
+		std::vector<std::unique_ptr<CumulativeWriter<Something>>> l_Logs;
+		std::vector<CumulativeWriter<Something>*> l_Inputs;
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			const std::string l_Filename("behaviour_merge" + std::to_string(i) + ".log");
+			std::remove(l_Filename.c_str());
+			l_Logs.emplace_back(new CumulativeWriter<Something>(l_Filename));
+			for (unsigned int j = 0; j < 200; ++j)
+			{
+				Something l_Record{ j * 3 + i, i, j };
+				l_Logs.back()->Write(&l_Record);
+			}
+			l_Inputs.push_back(l_Logs.back().get());
+		}
 
-	void PrintSomething(const Something& p_Other)
+		bool l_Passed(true);
+		using Merger = LogMerger<Something, unsigned int>;
+		Merger l_Merger(&Something::X, 50, 64);
+		{
+			std::remove("behaviour_merged.log");
+			CumulativeWriter<Something> l_Output("behaviour_merged.log");
+			l_Passed &= Expect(l_Merger.Merge(l_Inputs, l_Output) == Merger::MergeStatus::Okay, "Merge");
+
+			std::vector<Something> l_Merged(l_Output.RecordCount());
+			l_Passed &= Expect(
+				l_Merged.size() == 600 &&
+					l_Output.ReadRecords(0, 600, l_Merged.data()) == CumulativeWriter<Something>::RecordReadStatus::Okay,
+				"Merge Count");
+			bool l_Ordered(true);
+			for (unsigned int i = 0; i < l_Merged.size(); ++i)
+			{
+				l_Ordered = l_Ordered && l_Merged[i].X == i;
+			}
+			l_Passed &= Expect(l_Ordered, "Merge Order");
+		}
+		{
+			// The last input loses its records from under its writer
+			TruncateFile(l_Logs.back()->Filename(), 0);
+			std::remove("behaviour_merged_partial.log");
+			CumulativeWriter<Something> l_Output("behaviour_merged_partial.log");
+			l_Passed &= Expect(l_Merger.Merge(l_Inputs, l_Output) == Merger::MergeStatus::ReadError, "Merge Read Error");
+			l_Passed &= Expect(l_Output.RecordCount() == 0, "Merge Stops At Read Error");
+		}
+		return l_Passed;
+	}
+
+	// A sort on a budget of a few records spills enough runs to need several
+	// merge passes, keeps equal keys in input order and puts NaN keys last
+	const bool TestExternalSort()
 	{
-		std::cout << "Record Print [0x" << std::hex << p_Other.X << ", 0x" << p_Other.Y << ", 0x" << p_Other.Z << "]" << std::endl;
+		const std::string l_Filename("behaviour_unsorted.log");
+		std::remove(l_Filename.c_str());
+		CumulativeWriter<Reading> l_Log(l_Filename);
+		for (unsigned int i = 0; i < 1000; ++i)
+		{
+			Reading l_Reading{ i, i % 10 == 0 ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>((i * 7) % 50) };
+			l_Log.Write(&l_Reading);
+		}
+
+		using Sorter = ExternalSorter<Reading, float>;
+		Sorter l_Sorter(&Reading::Value, sizeof(Reading) * 2 * 8, "behaviour_sort", 2);
+		std::remove("behaviour_sorted.log");
+		CumulativeWriter<Reading> l_Output("behaviour_sorted.log");
+		bool l_Passed(Expect(l_Sorter.Sort(l_Log, l_Output) == Sorter::SortStatus::Okay, "External Sort"));
+
+		std::vector<Reading> l_Sorted(l_Output.RecordCount());
+		l_Passed &= Expect(
+			l_Sorted.size() == 1000 &&
+				l_Output.ReadRecords(0, 1000, l_Sorted.data()) == CumulativeWriter<Reading>::RecordReadStatus::Okay,
+			"External Sort Count");
+		bool l_Ordered(l_Sorted.size() == 1000);
+		for (std::size_t i = 0; l_Ordered && i < l_Sorted.size(); ++i)
+		{
+			const Reading& l_Reading(l_Sorted[i]);
+			if (i >= 900)
+			{
+				l_Ordered = std::isnan(l_Reading.Value) && l_Reading.Sensor == (i - 900) * 10;
+			}
+			else
+			{
+				const Reading& l_Previous(l_Sorted[i == 0 ? 0 : i - 1]);
+				l_Ordered = !std::isnan(l_Reading.Value) &&
+					(i == 0 ||
+						l_Previous.Value < l_Reading.Value ||
+						(l_Previous.Value == l_Reading.Value && l_Previous.Sensor < l_Reading.Sensor));
+			}
+		}
+		l_Passed &= Expect(l_Ordered, "External Sort Order");
+		return l_Passed;
 	}
 
-	using FileStreamPtr = std::shared_ptr<std::fstream>;
-
-	// Type T must have a public default constructor, or a private
-	// default constructor and "CumulativeWriter" defined as a friend
-	template<typename T>
-	class CumulativeWriter
+	// An index made over a log already written catches up, then follows new
+	// writes, and one whose slots were saved ahead of its header catches up
+	// again without linking a record to itself
+	const bool TestHashIndexCatchUp()
 	{
-		public:
+		using Index = HashIndex<Something, unsigned int>;
+		const std::string l_Filename("behaviour_indexed.log");
+		const std::string l_IndexFilename("behaviour_indexed.idx");
+		std::remove(l_Filename.c_str());
+		std::remove(l_IndexFilename.c_str());
+		std::remove((l_IndexFilename + ".post").c_str());
+
+		bool l_Passed(true);
+		{
+			CumulativeWriter<Something> l_Log(l_Filename);
+			for (unsigned int i = 0; i < 100; ++i)
+			{
+				Something l_Record{ i % 10, i, 0 };
+				l_Log.Write(&l_Record);
+			}
+			Index l_Index(l_Log, &Something::X, l_IndexFilename, Index::IndexMode::AllRecords);
+			l_Passed &= Expect(l_Index.Status() == Index::IndexStatus::Okay, "Index Open");
+			for (unsigned int i = 100; i < 110; ++i)
+			{
+				Something l_Record{ 3, i, 0 };
+				l_Log.Write(&l_Record);
+			}
+			const std::vector<unsigned int> l_Found(l_Index.FindAll(3));
+			l_Passed &= Expect(l_Found.size() == 20 && l_Found.front() == 3 && l_Found.back() == 109, "Index Catch Up");
+		}
+		{
+			// Wind the indexed record count, after the magic, version, key
+			// size, mode, capacity and used count, back as a crash could
+			std::fstream l_File(l_IndexFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			const std::uint64_t l_Indexed(105);
+			l_File.seekp(32);
+			l_File.write(reinterpret_cast<const char*>(&l_Indexed), sizeof(l_Indexed));
+		}
+		{
+			CumulativeWriter<Something> l_Log(l_Filename);
+			Index l_Index(l_Log, &Something::X, l_IndexFilename, Index::IndexMode::AllRecords);
+			const std::vector<unsigned int> l_Found(l_Index.FindAll(3));
+			l_Passed &= Expect(
+				l_Index.Status() == Index::IndexStatus::Okay &&
+					l_Found.size() == 20 &&
+					l_Found[9] == 93 &&
+					l_Found.back() == 109,
+				"Index Caught Up Again");
+		}
+		return l_Passed;
+	}
+
+	// The view keeps the latest record per key, compacts superseded records
+	// out of sealed segments and rebuilds the same table from its checkpoint
+	// or, without one, from the compacted log
+	const bool TestKeyValueView()
+	{
+		const std::string l_BaseName("behaviour_view.log");
+		const std::string l_CheckpointFilename("behaviour_view.ckpt");
+		for (unsigned int i = 0; i < 20; ++i)
+		{
+			char l_Suffix[8];
+			std::snprintf(l_Suffix, sizeof(l_Suffix), ".%06u", i);
+			std::remove((l_BaseName + l_Suffix).c_str());
+		}
+		std::remove(l_CheckpointFilename.c_str());
 
-			enum class Status
+		using View = KeyValueView<Something, unsigned int>;
+		const auto l_Matches([](const View& p_View)
+		{
+			bool l_Matched(p_View.Size() == 10);
+			for (unsigned int l_Key = 0; l_Key < 10; ++l_Key)
 			{
-				Unknown,
-				FileNotFound,
-				ReadyClosed,
-				ReadyOpen,
-				Writing,
-				Reading,
-				Closing,
-				Closed,
-				ErrorOpeningStream,
-				ErrorWriting,
-				ErrorWritingStreamNotReady,
-				ErrorSeeking,
-				ErrorReading,
-				PossibleCorruption,
-				UnableToCalculateRecords
-			};
+				Something l_Value{ 0, 0, 0 };
+				l_Matched = l_Matched && p_View.Get(l_Key, l_Value) && l_Value.Y == 990 + l_Key;
+			}
+			return l_Matched;
+		});
 
-			enum class RecordReadStatus
+		bool l_Passed(true);
+		{
+			SegmentedLog<Something> l_Log(l_BaseName, 100);
+			View l_View(l_Log, &Something::X, l_CheckpointFilename, 1u << 16, 0.1);
+			for (unsigned int i = 0; i < 1000; ++i)
 			{
-				Unknown,
-				OffsetOutOfRange,
-				BadMemoryAlloc,
-				StreamNotOpen,
-				StreamReadError,
-				Okay			=	255
-			};
+				Something l_Record{ i % 10, i, 0 };
+				l_Log.Write(&l_Record);
+			}
+			l_Passed &= Expect(l_Matches(l_View), "View Latest");
 
-			enum class LoadState
+			l_View.RequestCheckpoint();
+			const auto l_Deadline(std::chrono::steady_clock::now() + std::chrono::seconds(5));
+			while (l_Log.RecordCount() == 1000 && std::chrono::steady_clock::now() < l_Deadline)
 			{
-				Unknown,
-				Corrupt		=	254,
-				Okay		=	255
-			};
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			l_Passed &= Expect(l_Log.RecordCount() < 1000, "View Compaction");
+			l_Passed &= Expect(l_Matches(l_View), "View After Compaction");
+		}
+		{
+			SegmentedLog<Something> l_Log(l_BaseName, 100);
+			View l_View(l_Log, &Something::X, l_CheckpointFilename);
+			l_Passed &= Expect(l_View.Status() == View::ViewStatus::Okay && l_Matches(l_View), "View From Checkpoint");
+		}
+		std::remove(l_CheckpointFilename.c_str());
+		{
+			SegmentedLog<Something> l_Log(l_BaseName, 100);
+			View l_View(l_Log, &Something::X, l_CheckpointFilename);
+			l_Passed &= Expect(l_Matches(l_View), "View From Compacted Log");
+		}
+		return l_Passed;
+	}
 
-		private:
+	// Bloom filters find a float key however its zero was written, and a
+	// filter built before its segment was rewritten is not trusted
+	const bool TestBloomFilters()
+	{
+		const std::string l_BaseName("behaviour_bloom.log");
+		for (unsigned int i = 0; i < 4; ++i)
+		{
+			char l_Suffix[8];
+			std::snprintf(l_Suffix, sizeof(l_Suffix), ".%06u", i);
+			std::remove((l_BaseName + l_Suffix).c_str());
+			std::remove((l_BaseName + l_Suffix + ".bloom").c_str());
+		}
 
-			std::string		m_Filename;
-#ifdef _WIN32
-			HANDLE			m_FileStream;
-			DWORD			m_FileSizeDword;
-#else
-			FileStreamPtr		m_FileStream;
-#endif
-			Status			m_Status;
-			Status			m_PrevStatus;
-			std::mutex		m_Lock;
-			LoadState		m_LoadState;
+		// Polls p_Ready for up to five seconds while filters are built
+		const auto l_Await([](const auto& p_Ready)
+		{
+			for (unsigned int i = 0; i < 500 && !p_Ready(); ++i)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			return p_Ready();
+		});
+
+		bool l_Passed(true);
+		SegmentedLog<Reading> l_Log(l_BaseName, 100);
+		SegmentBloomFilters<Reading, float> l_Filters(l_Log, &Reading::Value);
+		std::vector<Reading> l_Records;
+		for (unsigned int i = 0; i < 250; ++i)
+		{
+			l_Records.push_back(Reading{ i, i == 0 ? -0.0f : static_cast<float>(i) });
+		}
+		l_Log.WriteRecords(l_Records.data(), static_cast<unsigned int>(l_Records.size()));
+		l_Passed &= Expect(l_Await([&l_Filters]() { return !l_Filters.MayContain(0, 150.0f); }), "Bloom Filter Built");
+
+		unsigned int l_Segment(0), l_Record(0);
+		Reading l_Found{ 0, 0 };
+		l_Passed &= Expect(
+			l_Filters.MayContain(0, 0.0f) &&
+				l_Filters.FindLatest(0.0f, l_Segment, l_Record, l_Found) &&
+				l_Segment == 0 &&
+				l_Found.Sensor == 0,
+			"Bloom Filter Zero Key");
+
+		// Rewrite the first segment as compaction would
+		std::vector<Reading> l_Compacted;
+		for (unsigned int i = 0; i < 50; ++i)
+		{
+			l_Compacted.push_back(Reading{ i, 1000.0f + i });
+		}
+		l_Log.ReplaceSegment(0, l_Compacted.data(), static_cast<unsigned int>(l_Compacted.size()));
+		l_Passed &= Expect(
+			l_Filters.FindLatest(1000.0f, l_Segment, l_Record, l_Found) && l_Segment == 0 && l_Record == 0,
+			"Bloom Filter Stale");
+		l_Passed &= Expect(l_Await([&l_Filters]() { return !l_Filters.MayContain(0, 50.0f); }), "Bloom Filter Rebuilt");
+		l_Passed &= Expect(l_Filters.MayContain(0, 1049.0f), "Bloom Filter Rebuilt Keys");
+		return l_Passed;
+	}
+
+	// A record window starts from the records already written, leaves NaNs
+	// out, and its sum recovers once a huge value has left the window
+	const bool TestWindowAggregates()
+	{
+		const std::string l_Filename("behaviour_window.log");
+		std::remove(l_Filename.c_str());
 
-			const unsigned int	c_RecordSize;
-			unsigned int		m_RecordCount;
+		bool l_Passed(true);
+		CumulativeWriter<Reading> l_Log(l_Filename);
+		for (unsigned int i = 0; i < 100; ++i)
+		{
+			Reading l_Record{ i, static_cast<float>(i) };
+			l_Log.Write(&l_Record);
+		}
 
-			CumulativeWriter() = delete;
-			CumulativeWriter(const CumulativeWriter&) = delete;
+		WindowAggregates<Reading> l_Aggregates(l_Log);
+		unsigned int l_Window(0);
+		double l_Sum(0), l_Count(0), l_Minimum(0), l_Maximum(0), l_NonFinite(0);
+		l_Passed &= Expect(
+			l_Aggregates.AddRecordWindow(&Reading::Value, 10, l_Window) == CumulativeWriter<Reading>::RecordReadStatus::Okay &&
+				l_Aggregates.Query(l_Window, AggregateKind::Sum, l_Sum) &&
+				l_Sum == 945,
+			"Window Catch Up");
+
+		const Reading l_NaN{ 100, std::numeric_limits<float>::quiet_NaN() };
+		l_Log.Write(&l_NaN);
+		l_Passed &= Expect(
+			l_Aggregates.Query(l_Window, AggregateKind::Count, l_Count) && l_Count == 10 &&
+				l_Aggregates.Query(l_Window, AggregateKind::Sum, l_Sum) && l_Sum == 945 &&
+				l_Aggregates.Query(l_Window, AggregateKind::Min, l_Minimum) && l_Minimum == 90 &&
+				l_Aggregates.Query(l_Window, AggregateKind::Max, l_Maximum) && l_Maximum == 99 &&
+				l_Aggregates.Query(l_Window, AggregateKind::NonFinite, l_NonFinite) && l_NonFinite == 1,
+			"Window NaN");
+
+		const Reading l_Huge{ 101, 1e16f };
+		l_Log.Write(&l_Huge);
+		for (unsigned int i = 0; i < 20; ++i)
+		{
+			const Reading l_One{ 102 + i, 1.0f };
+			l_Log.Write(&l_One);
+		}
+		l_Passed &= Expect(l_Aggregates.Query(l_Window, AggregateKind::Sum, l_Sum) && l_Sum == 10, "Window Sum Drift");
+		return l_Passed;
+	}
 
-		public:
+	// Checkpoints beyond a log cut short, and a torn one, are dropped at open
+	const bool TestCheckpointRecovery()
+	{
+		using Checkpoints = StateCheckpoints<Something, Total>;
+		const std::string l_Filename("behaviour_checkpointed.log");
+		const std::string l_CheckpointFilename("behaviour_checkpointed.ckpt");
+		std::remove(l_Filename.c_str());
+		std::remove(l_CheckpointFilename.c_str());
+		const Checkpoints::FoldFunction l_Fold([](Total& p_Total, const Something& p_Record) { p_Total.Sum += p_Record.X; });
 
-			CumulativeWriter(const std::string& p_Filename)
-				:
-				m_Filename(p_Filename),
-#ifdef _WIN32
-				m_FileStream(INVALID_HANDLE_VALUE),
-				m_FileSizeDword(0),
-#else
-				m_FileStream(nullptr),
-#endif
-				m_Status(Status::Unknown),
-				m_PrevStatus(m_Status),
-				m_Lock(),
-				m_LoadState(LoadState::Unknown),
-				m_RecordCount(0),
-				c_RecordSize(sizeof(T))
+		{
+			CumulativeWriter<Something> l_Log(l_Filename);
+			Checkpoints l_Checkpoints(l_Log, l_CheckpointFilename, l_Fold, 10);
+			for (unsigned int i = 1; i <= 100; ++i)
 			{
-				m_Status = Status::ReadyClosed;
-				OpenFileStream();
+				Something l_Record{ i, 0, 0 };
+				l_Log.Write(&l_Record);
 			}
+		}
+		TruncateFile(l_Filename, 55 * sizeof(Something));
+		AppendJunk(l_CheckpointFilename, 3);
+
+		CumulativeWriter<Something> l_Log(l_Filename);
+		Checkpoints l_Checkpoints(l_Log, l_CheckpointFilename, l_Fold, 10);
+		for (unsigned int i = 56; i <= 100; ++i)
+		{
+			Something l_Record{ i * 2, 0, 0 };
+			l_Log.Write(&l_Record);
+		}
+
+		bool l_Matched(true);
+		unsigned long long l_Expected(0);
+		for (unsigned int i = 0; i < 100; ++i)
+		{
+			l_Expected += i < 55 ? i + 1 : (i + 1) * 2;
+			Total l_State{ 0 };
+			l_Matched = l_Matched &&
+				l_Checkpoints.StateAtRecord(i, l_State) == Checkpoints::StateStatus::Okay &&
+				l_State.Sum == l_Expected;
+		}
+		return Expect(l_Matched, "Checkpoint Recovery");
+	}
+
+	// Sketches of ranges ending in the open block count its NaNs once and
+	// read none of its records twice
+	const bool TestQuantileSketches()
+	{
+		const std::string l_Filename("behaviour_sketched.log");
+		const std::string l_SketchFilename("behaviour_sketched.qsk");
+		std::remove(l_Filename.c_str());
+		std::remove(l_SketchFilename.c_str());
+
+		CumulativeWriter<Reading> l_Log(l_Filename);
+		QuantileSketches<Reading> l_Sketches(l_Log, &Reading::Value, l_SketchFilename, 100);
+		for (unsigned int i = 0; i < 150; ++i)
+		{
+			Reading l_Record{ i, i % 10 == 0 ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(i) };
+			l_Log.Write(&l_Record);
+		}
+
+		std::unique_ptr<QuantileSketch> l_Sketch(new QuantileSketch());
+		bool l_Passed(Expect(
+			l_Sketches.Sketch(100, 50, *l_Sketch) && l_Sketch->m_Count == 45 && l_Sketch->m_NonFinite == 5 && l_Sketch->m_Max == 149,
+			"Sketch Open Block"));
+		l_Passed &= Expect(
+			l_Sketches.Sketch(0, 150, *l_Sketch) && l_Sketch->m_Count == 135 && l_Sketch->m_NonFinite == 15,
+			"Sketch Whole Log");
+		return l_Passed;
+	}
+
+	// Time bucketed samples fall within their buckets, and times far apart
+	// give an error or an exact bucket rather than overflowing
+	const bool TestSampleByTime()
+	{
+		const std::string l_Filename("behaviour_sampled.log");
+		std::remove(l_Filename.c_str());
 
-			virtual ~CumulativeWriter()
+		CumulativeWriter<Something> l_Log(l_Filename);
+		std::vector<long long> l_Times(100);
+		for (unsigned int i = 0; i < 100; ++i)
+		{
+			Something l_Record{ i, 0, 0 };
+			l_Log.Write(&l_Record);
+			l_Times[i] = i;
+		}
+
+		using Sampler = RecordSampler<Something>;
+		Sampler l_Sampler(l_Log, 7);
+		const Sampler::TimeFunction l_Time([&l_Times](const Something& p_Record) { return l_Times[p_Record.X]; });
+		std::vector<std::vector<Something>> l_Buckets;
+		bool l_Bucketed(l_Sampler.SampleByTime(0, 100, l_Time, 10, 3, l_Buckets) == Sampler::SampleStatus::Okay && l_Buckets.size() == 10);
+		for (std::size_t b = 0; l_Bucketed && b < l_Buckets.size(); ++b)
+		{
+			l_Bucketed = l_Buckets[b].size() == 3;
+			for (std::size_t i = 0; l_Bucketed && i < 3; ++i)
 			{
-				Close();
+				l_Bucketed = l_Buckets[b][i].X / 10 == b && (i == 0 || l_Buckets[b][i - 1].X < l_Buckets[b][i].X);
 			}
+		}
+		bool l_Passed(Expect(l_Bucketed, "Sample By Time"));
+
+		l_Times[99] = 1000000000000LL;
+		l_Passed &= Expect(
+			l_Sampler.SampleByTime(0, 100, l_Time, 10, 3, l_Buckets) == Sampler::SampleStatus::TooManyBuckets && l_Buckets.empty(),
+			"Sample Too Many Buckets");
+
+		l_Times[0] = -(1LL << 62);
+		l_Times[99] = 1LL << 62;
+		l_Passed &= Expect(
+			l_Sampler.SampleByTime(0, 100, l_Time, 1LL << 62, 3, l_Buckets) == Sampler::SampleStatus::Okay &&
+				l_Buckets.size() == 3 &&
+				l_Buckets[0].size() == 1 &&
+				l_Buckets[1].size() == 3 &&
+				l_Buckets[2].size() == 1 &&
+				l_Buckets[2][0].X == 99,
+			"Sample Wide Times");
+		return l_Passed;
+	}
 
-			inline const bool FileStreamValid() const noexcept
+	// Zones over a float member holding NaNs skip nothing a full scan matches
+	const bool TestZoneMapsNaN()
+	{
+		const std::string l_Filename("behaviour_zoned.log");
+		const std::string l_ZoneFilename("behaviour_zoned.zone");
+		std::remove(l_Filename.c_str());
+		std::remove(l_ZoneFilename.c_str());
+
+		CumulativeWriter<Reading> l_Log(l_Filename);
+		const RecordFields l_Fields{ MakeRecordField("Sensor", &Reading::Sensor), MakeRecordField("Value", &Reading::Value) };
+		ZoneMaps<Reading> l_Zones(l_Log, l_Fields, l_ZoneFilename, 8);
+		for (unsigned int i = 0; i < 64; ++i)
+		{
+			Reading l_Reading{ i, i % 8 == 0 ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(i) };
+			l_Log.Write(&l_Reading);
+		}
+
+		bool l_Passed(true);
+		const auto l_Above(BLUEBIRD_FIELD(Reading, Value) > 8.5 && BLUEBIRD_FIELD(Reading, Sensor) < 60u);
+		const auto l_Below(BLUEBIRD_FIELD(Reading, Sensor) < 5.5);
+		const ZoneMaps<Reading>* l_Zoned[2]{ nullptr, &l_Zones };
+		for (const auto l_ZoneMaps : l_Zoned)
+		{
+			std::vector<Reading> l_Out;
+			l_Passed &= Expect(ScanWhere(l_Log, l_ZoneMaps, 0, 64, l_Above, l_Out) == ScanStatus::Okay && l_Out.size() == 45, "Zone Scan NaN");
+			l_Out.clear();
+			l_Passed &= Expect(ScanWhere(l_Log, l_ZoneMaps, 0, 64, l_Below, l_Out) == ScanStatus::Okay && l_Out.size() == 6, "Zone Scan Fraction");
+		}
+		return l_Passed;
+	}
+
+	// A bool field compares with integer and floating point operands as 0 or 1
+	const bool TestBoolPredicate()
+	{
+		const std::string l_Filename("behaviour_flagged.log");
+		const std::string l_ZoneFilename("behaviour_flagged.zone");
+		std::remove(l_Filename.c_str());
+		std::remove(l_ZoneFilename.c_str());
+
+		CumulativeWriter<Flagged> l_Log(l_Filename);
+		const RecordFields l_Fields{ MakeRecordField("Id", &Flagged::Id), MakeRecordField("Set", &Flagged::Set) };
+		ZoneMaps<Flagged> l_Zones(l_Log, l_Fields, l_ZoneFilename, 8);
+		for (unsigned int i = 0; i < 64; ++i)
+		{
+			Flagged l_Record{ i, i % 3 == 0 };
+			l_Log.Write(&l_Record);
+		}
+
+		bool l_Passed(true);
+		const auto l_Set(BLUEBIRD_FIELD(Flagged, Set) == 1 && BLUEBIRD_FIELD(Flagged, Set) > 0.5);
+		const auto l_Clear(BLUEBIRD_FIELD(Flagged, Set) < 1u && BLUEBIRD_FIELD(Flagged, Set) == false);
+		const ZoneMaps<Flagged>* l_Zoned[2]{ nullptr, &l_Zones };
+		for (const auto l_ZoneMaps : l_Zoned)
+		{
+			std::vector<Flagged> l_Out;
+			l_Passed &= Expect(ScanWhere(l_Log, l_ZoneMaps, 0, 64, l_Set, l_Out) == ScanStatus::Okay && l_Out.size() == 22, "Bool Scan Set");
+			l_Out.clear();
+			l_Passed &= Expect(ScanWhere(l_Log, l_ZoneMaps, 0, 64, l_Clear, l_Out) == ScanStatus::Okay && l_Out.size() == 42, "Bool Scan Clear");
+		}
+		return l_Passed;
+	}
+
+	// A range read in column batches comes back transposed, aligned and
+	// complete, with the last batch cut short
+	const bool TestColumnBatches()
+	{
+		const std::string l_Filename("behaviour_columns.log");
+		std::remove(l_Filename.c_str());
+
+		CumulativeWriter<Reading> l_Log(l_Filename);
+		for (unsigned int i = 0; i < 1000; ++i)
+		{
+			Reading l_Record{ i, i * 0.5f };
+			l_Log.Write(&l_Record);
+		}
+
+		using Reader = ColumnBatchReader<Reading>;
+		const RecordFields l_Fields{ MakeRecordField("Sensor", &Reading::Sensor), MakeRecordField("Value", &Reading::Value) };
+		Reader l_Reader(l_Log, l_Fields, 37, 900, 256);
+		bool l_Matched(true);
+		unsigned int l_Batches(0), l_Records(0);
+		while (l_Reader.Next() == Reader::BatchStatus::Okay)
+		{
+			const unsigned int* l_Sensors(l_Reader.Column<unsigned int>(0));
+			const float* l_Values(l_Reader.Column<float>(1));
+			l_Matched = l_Matched &&
+				l_Sensors != nullptr &&
+				l_Values != nullptr &&
+				l_Reader.Column<float>(0) == nullptr &&
+				reinterpret_cast<std::uintptr_t>(l_Sensors) % Reader::c_Alignment == 0 &&
+				reinterpret_cast<std::uintptr_t>(l_Values) % Reader::c_Alignment == 0 &&
+				l_Reader.FirstRecord() == 37 + l_Records;
+			for (std::size_t i = 0; l_Matched && i < l_Reader.Records(); ++i)
 			{
-#ifdef _WIN32
-				return m_FileStream != INVALID_HANDLE_VALUE;
-#else
-				return m_FileStream != nullptr;
-#endif
-			}
-
-		private:
-
-			void OpenFileStream() noexcept
-			{
-				std::lock_guard<std::mutex> l_Lock(m_Lock);
-				if (!FileStreamValid())
-				{
-					try
-					{
-#ifdef _WIN32
-						m_FileStream = CreateFileA(
-							m_Filename.c_str(),
-							GENERIC_READ | GENERIC_WRITE,
-							FILE_SHARE_READ | FILE_SHARE_WRITE,
-							NULL,		// Default security
-							OPEN_ALWAYS,// Open or create
-							FILE_ATTRIBUTE_NORMAL, // | FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH,
-							NULL);
-#else
-						m_FileStream = std::make_shared<std::fstream>(
-							m_Filename,
-							std::ios_base::out | std::ios_base::in | std::ios_base::app | std::ios_base::ate);
-						*m_FileStream << std::unitbuf;
-#endif
-						CalculateRecordCount();
-						if (m_Status != Status::UnableToCalculateRecords)
-						{
-							m_Status = Status::ReadyOpen;
-						}
-					}
-					catch (const std::exception&)
-					{
-						m_Status = Status::ErrorOpeningStream;
-					}
-				}
+				l_Matched = l_Sensors[i] == l_Reader.FirstRecord() + i && l_Values[i] == l_Sensors[i] * 0.5f;
 			}
+			++l_Batches;
+			l_Records += static_cast<unsigned int>(l_Reader.Records());
+		}
+		return Expect(l_Matched && l_Batches == 4 && l_Records == 900, "Column Batches");
+	}
 
-			void CalculateRecordCount()
+	// A scan whose snapshot segment fills up delivers just the snapshot, and
+	// one whose snapshot segment is compacted part way restarts that segment
+	const bool TestScanCursor()
+	{
+		const std::string l_BaseName("behaviour_scanned.log");
+		for (unsigned int i = 0; i < 4; ++i)
+		{
+			char l_Suffix[8];
+			std::snprintf(l_Suffix, sizeof(l_Suffix), ".%06u", i);
+			std::remove((l_BaseName + l_Suffix).c_str());
+		}
+
+		using Scanner = SegmentScanner<Something>;
+		SegmentedLog<Something> l_Log(l_BaseName, 100);
+		std::vector<Something> l_Records;
+		for (unsigned int i = 0; i < 150; ++i)
+		{
+			l_Records.push_back(Something{ i, 0, 0 });
+		}
+		l_Log.WriteRecords(l_Records.data(), 150);
+
+		Scanner l_Whole(l_Log, Scanner::Begin(l_Log, 16));
+		Scanner l_Compacted(l_Log, Scanner::Begin(l_Log, 16));
+		std::vector<Something> l_Block;
+		for (unsigned int i = 0; i < 8; ++i)
+		{
+			l_Compacted.Next(l_Block);
+		}
+		bool l_Passed(Expect(l_Compacted.Cursor().m_Segment == 1 && l_Block.front().X == 100, "Scan Into Snapshot Segment"));
+
+		// Fill and seal the snapshot segment, then compact it
+		l_Log.WriteRecords(l_Records.data(), 50);
+		for (unsigned int i = 0; i < 30; ++i)
+		{
+			l_Records[i] = Something{ 1000 + i, 0, 0 };
+		}
+		std::vector<unsigned int> l_Seen;
+		while (l_Whole.Next(l_Block) == Scanner::ScanStatus::Okay)
+		{
+			for (const auto& l_Record : l_Block)
 			{
-				if (FileStreamValid())
-				{
-					try
-					{
-#ifdef _WIN32
-						LARGE_INTEGER l_FileSize;
-						if (GetFileSizeEx(m_FileStream, &l_FileSize) != 0)
-						{
-							unsigned int l_fpos(static_cast<unsigned int>(l_FileSize.QuadPart));
-#else
-							auto l_fpos(m_FileStream->tellg());
-							//std::fpos_t l_fpos(l_Pos);
-#endif
-							m_RecordCount = static_cast<unsigned int>(l_fpos) / c_RecordSize;
-
-							auto l_Remainder(l_fpos % c_RecordSize);
-							if (l_Remainder == 0)
-							{
-								m_LoadState = LoadState::Okay;
-							}
-							else
-							{
-								//std::cout << "There are [" << l_fpos << "bytes] in the file which is [" << m_RecordCount << "] full records and [" << l_Remainder << "bytes] remaining" << std::endl;
-								m_LoadState = LoadState::Corrupt;
-							}							
-#ifdef _WIN32
-						}					
-						else
-						{
-							m_LoadState = LoadState::Corrupt;
-						}
-#endif
-					}
-					catch (const std::exception&)
-					{
-						m_Status = Status::UnableToCalculateRecords;
-					}
-				}
+				l_Seen.push_back(l_Record.X);
+			}
+		}
+		bool l_Matched(l_Seen.size() == 150);
+		for (unsigned int i = 0; l_Matched && i < 150; ++i)
+		{
+			l_Matched = l_Seen[i] == i;
+		}
+		l_Passed &= Expect(l_Matched, "Scan Sealed Snapshot");
+
+		l_Log.ReplaceSegment(1, l_Records.data(), 30);
+		l_Seen.clear();
+		while (l_Compacted.Next(l_Block) == Scanner::ScanStatus::Okay)
+		{
+			for (const auto& l_Record : l_Block)
+			{
+				l_Seen.push_back(l_Record.X);
 			}
+		}
+		l_Matched = l_Seen.size() == 30;
+		for (unsigned int i = 0; l_Matched && i < 30; ++i)
+		{
+			l_Matched = l_Seen[i] == 1000 + i;
+		}
+		l_Passed &= Expect(l_Matched, "Scan Compacted Snapshot");
+		return l_Passed;
+	}
 
-		public:
+	// A reverse walk delivers every record newest first, across block
+	// boundaries, and none appended once it has begun
+	const bool TestReverseReader()
+	{
+		const std::string l_Filename("behaviour_reversed.log");
+		std::remove(l_Filename.c_str());
 
-			using TPtr = std::shared_ptr<T>;
-			using ReadRecordResult = std::pair<RecordReadStatus, TPtr>;
+		CumulativeWriter<Something> l_Log(l_Filename);
+		for (unsigned int i = 0; i < 1000; ++i)
+		{
+			Something l_Record{ i, 0, 0 };
+			l_Log.Write(&l_Record);
+		}
 
-			const ReadRecordResult ReadRecord(const unsigned int& p_RecordOffset) noexcept
+		ReverseReader<Something> l_Reader(l_Log, 64);
+		bool l_Matched(true);
+		unsigned int l_Expected(1000);
+		for (auto l_Record(l_Reader.begin()); l_Record != l_Reader.end(); ++l_Record)
+		{
+			if (l_Expected == 500)
 			{
-				RecordReadStatus l_resultCode(RecordReadStatus::Unknown);
-				std::shared_ptr<T> l_result(nullptr);
+				Something l_Late{ 5000, 0, 0 };
+				l_Log.Write(&l_Late);
+			}
+			--l_Expected;
+			l_Matched = l_Matched && l_Record->X == l_Expected && l_Reader.CurrentIndex() == l_Expected;
+		}
+		return Expect(
+			l_Matched && l_Expected == 0 && l_Reader.Status() == ReverseReader<Something>::ReadStatus::Okay,
+			"Reverse Read");
+	}
+
+	// Scattered, repeated and unordered indices come back in the order asked,
+	// whether close enough to share a read or far apart
+	const bool TestReadMany()
+	{
+		const std::string l_Filename("behaviour_many.log");
+		std::remove(l_Filename.c_str());
+
+		CumulativeWriter<Something> l_Log(l_Filename);
+		std::vector<Something> l_Records;
+		for (unsigned int i = 0; i < 200000; ++i)
+		{
+			l_Records.push_back(Something{ i, i * 2, 0 });
+		}
+		l_Log.WriteRecords(l_Records.data(), static_cast<unsigned int>(l_Records.size()));
+
+		const std::vector<unsigned int> l_Indices{ 199999, 5, 7, 5, 150000, 6, 0, 90000, 90001, 199999 };
+		std::vector<Something> l_Out(l_Indices.size());
+		bool l_Matched(l_Log.ReadMany(l_Indices.data(), l_Indices.size(), l_Out.data(), 3) == CumulativeWriter<Something>::RecordReadStatus::Okay);
+		for (std::size_t i = 0; l_Matched && i < l_Indices.size(); ++i)
+		{
+			l_Matched = l_Out[i].X == l_Indices[i] && l_Out[i].Y == l_Indices[i] * 2;
+		}
+		bool l_Passed(Expect(l_Matched, "Read Many"));
+
+		const unsigned int l_Beyond[2]{ 3, 200000 };
+		l_Passed &= Expect(
+			l_Log.ReadMany(l_Beyond, 2, l_Out.data()) == CumulativeWriter<Something>::RecordReadStatus::OffsetOutOfRange,
+			"Read Many Out Of Range");
+		return l_Passed;
+	}
 
-				if (FileStreamValid())
+	// Writers sharing a scheduler flush together, and a scheduler torn down
+	// with a round in flight finishes it rather than hanging
+	const bool TestSchedulerShutdown()
+	{
+		bool l_Passed(true);
+		{
+			FlushScheduler l_Scheduler(std::chrono::milliseconds(0), 3);
+			std::vector<std::unique_ptr<CumulativeWriter<Something>>> l_Writers;
+			for (unsigned int i = 0; i < 4; ++i)
+			{
+				const std::string l_Filename("behaviour_flushed" + std::to_string(i) + ".log");
+				std::remove(l_Filename.c_str());
+				l_Writers.emplace_back(new CumulativeWriter<Something>(l_Filename));
+				l_Writers.back()->UseFlushScheduler(l_Scheduler);
+			}
+
+			Something l_Record{ 7, 8, 9 };
+			std::thread l_Other([&]()
+			{
+				for (unsigned int i = 0; i < 20; ++i)
 				{
-					try
+					for (auto& l_Writer : l_Writers)
 					{
-						std::lock_guard<std::mutex> l_Lock(m_Lock);
-						if (p_RecordOffset < m_RecordCount)
-						{
-							m_PrevStatus = m_Status;
-							m_Status = Status::Reading;
-
-							l_result = std::shared_ptr<T>(new T());
-							
-							try
-							{
-#ifdef _WIN32							
-								LARGE_INTEGER l_NewFilePosition;
-								LARGE_INTEGER l_SeekPos{ p_RecordOffset * c_RecordSize };
-								if (SetFilePointerEx(
-									m_FileStream,
-									l_SeekPos,
-									&l_NewFilePosition,
-									FILE_BEGIN) != 0)
-								{
-									OVERLAPPED l_Overlapped{ 0 };
-									if (ReadFileEx(
-										m_FileStream,
-										l_result.get(),
-										c_RecordSize,
-										&l_Overlapped,
-										CompletionRoutine) != 0)
-									{										
-										m_Status = m_PrevStatus;
-										l_resultCode = RecordReadStatus::Okay;
-									}
-									else
-									{
-										m_Status = Status::ErrorReading;
-										throw std::exception("Read Error");
-									}
-								}
-								else
-								{
-									m_Status = Status::ErrorSeeking;
-									throw std::exception("Seeking Error");
-								}
-#else
-								std::streampos l_SeekPos(p_RecordOffset * c_RecordSize);
-								m_FileStream->seekg(l_SeekPos);
-								m_FileStream->read(
-									reinterpret_cast<char*>(l_result.get()),
-									c_RecordSize);
-								m_Status = m_PrevStatus;
-								l_resultCode = RecordReadStatus::Okay;
-#endif
-							}
-							catch (const std::exception&)
-							{
-								l_resultCode = RecordReadStatus::StreamReadError;
-							}
-						}
-						else
-						{
-							l_resultCode = RecordReadStatus::OffsetOutOfRange;
-						}
-					}
-					catch (const std::bad_alloc&)
-					{
-						l_resultCode = RecordReadStatus::BadMemoryAlloc;
+						l_Writer->Write(&l_Record);
 					}
 				}
-				else
+			});
+			for (unsigned int i = 0; i < 5; ++i)
+			{
+				for (auto& l_Writer : l_Writers)
 				{
-					l_resultCode = RecordReadStatus::StreamNotOpen;
+					l_Writer->Write(&l_Record);
 				}
-
-				return std::make_pair(l_resultCode, l_result);
 			}
+			l_Other.join();
 
-			const ReadRecordResult LoadLastRecord() noexcept
+			for (auto& l_Writer : l_Writers)
 			{
-				return ReadRecord(m_RecordCount - 1);
+				l_Passed &= Expect(l_Writer->WaitForFlush() && l_Writer->RecordCount() == 25, "Scheduled Flush");
 			}
+			l_Writers.clear();
+		}
+
+		for (unsigned int i = 0; i < 50; ++i)
+		{
+			std::unique_ptr<FlushScheduler> l_Scheduler(new FlushScheduler(std::chrono::milliseconds(0), 4));
+			l_Scheduler->MarkDirty(l_Scheduler->Register("behaviour_flushed0.log"));
+			l_Scheduler.reset();
+		}
+		return l_Passed;
+	}
 
-			const unsigned int& RecordCount() const noexcept
+	// A file whose sync fails stays dirty, so every later flush reports it
+	// until it is synced or unregistered
+	const bool TestFlushRetry()
+	{
+		const std::string l_Filename("behaviour_unflushable.log");
+		std::remove(l_Filename.c_str());
+
+		FlushScheduler l_Scheduler(std::chrono::milliseconds(0), 2);
+		const unsigned int l_Id(l_Scheduler.Register(l_Filename));
+		l_Scheduler.MarkDirty(l_Id);
+		bool l_Passed(Expect(!l_Scheduler.WaitForFlush(), "Failed Flush"));
+		l_Passed &= Expect(!l_Scheduler.WaitForFlush(), "Failed Flush Retried");
+		l_Passed &= Expect(!l_Scheduler.Unregister(l_Id) && l_Scheduler.WaitForFlush(), "Failed Flush Unregistered");
+		return l_Passed;
+	}
+
+	// A pool counts the handles flush schedulers keep as well as the
+	// writers' own, and writers parked to stay under its cap carry on
+	// appending and reading where they left off
+	const bool TestFilePool()
+	{
+		bool l_Passed(true);
+		const std::size_t l_Capacities[2]{ 100, 3 };
+		for (const auto& l_Capacity : l_Capacities)
+		{
+			FilePool l_Pool(l_Capacity);
+			FlushScheduler l_Scheduler(std::chrono::milliseconds(0), 1);
+			std::vector<std::unique_ptr<CumulativeWriter<Something>>> l_Writers;
+			for (unsigned int i = 0; i < 4; ++i)
 			{
-				return m_RecordCount;
+				const std::string l_Filename("behaviour_pooled" + std::to_string(i) + ".log");
+				std::remove(l_Filename.c_str());
+				l_Writers.emplace_back(new CumulativeWriter<Something>(l_Filename));
+				if (i % 2 == 0)
+				{
+					l_Writers.back()->UseFilePool(l_Pool);
+					l_Writers.back()->UseFlushScheduler(l_Scheduler);
+				}
+				else
+				{
+					l_Writers.back()->UseFlushScheduler(l_Scheduler);
+					l_Writers.back()->UseFilePool(l_Pool);
+				}
 			}
 
-			const unsigned int& RecordSize() const noexcept
+			bool l_Flushed(true);
+			for (unsigned int l_Round = 0; l_Round < 2; ++l_Round)
 			{
-				return c_RecordSize;
+				for (unsigned int i = 0; i < 4; ++i)
+				{
+					Something l_Record{ i, l_Round, 0 };
+					l_Writers[i]->Write(&l_Record);
+				}
+				for (auto& l_Writer : l_Writers)
+				{
+					l_Flushed = l_Writer->WaitForFlush() && l_Flushed;
+				}
 			}
+			l_Passed &= Expect(l_Flushed && l_Pool.OpenCount() == std::min<std::size_t>(l_Capacity, 8), "Pool Counts Flush Handles");
 
-			const LoadState& LoadState() const noexcept
+			bool l_Matched(true);
+			for (unsigned int i = 0; i < 4; ++i)
 			{
-				return m_LoadState;
+				Something l_Records[2];
+				l_Matched = l_Matched &&
+					l_Writers[i]->ReadRecords(0, 2, l_Records) == CumulativeWriter<Something>::RecordReadStatus::Okay &&
+					l_Records[0].X == i && l_Records[0].Y == 0 && l_Records[1].X == i && l_Records[1].Y == 1;
 			}
+			l_Passed &= Expect(l_Matched && l_Pool.OpenCount() <= l_Capacity, "Pooled Reads");
+		}
+		return l_Passed;
+	}
+
+	// Streams written interleaved read back in order, whether from their
+	// views, the physical file or both, and again once the index is rebuilt
+	const bool TestMultiplexedLog()
+	{
+		const std::string l_Filename("behaviour_multiplexed.log");
+		std::remove(l_Filename.c_str());
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			char l_Suffix[16];
+			std::snprintf(l_Suffix, sizeof(l_Suffix), ".stream.%06u", i);
+			std::remove((l_Filename + l_Suffix).c_str());
+		}
 
-			const bool WasCorruptAtLoad() const noexcept
+		// Stream s holds X = s, Y = 0, 1, 2 ...
+		const auto l_Matches([](MultiplexedLog<Something>& p_Log, const unsigned int& p_Records)
+		{
+			bool l_Matched(p_Log.Streams().size() == 3);
+			std::vector<Something> l_Out(p_Records);
+			for (unsigned int s = 0; l_Matched && s < 3; ++s)
 			{
-				return m_LoadState == LoadState::Corrupt;
+				l_Matched = p_Log.StreamRecordCount(s) == p_Records &&
+					p_Log.ReadStream(s, 0, p_Records, l_Out.data()) == MultiplexedLog<Something>::RecordReadStatus::Okay;
+				for (unsigned int i = 0; l_Matched && i < p_Records; ++i)
+				{
+					l_Matched = l_Out[i].X == s && l_Out[i].Y == i;
+				}
 			}
-
-			const bool WasOkayAtLoad() const noexcept
+			return l_Matched;
+		});
+		const auto l_Write([](MultiplexedLog<Something>& p_Log, const unsigned int& p_First, const unsigned int& p_Records)
+		{
+			std::vector<unsigned int> l_Streams;
+			std::vector<Something> l_Records;
+			for (unsigned int i = p_First; i < p_First + p_Records; ++i)
 			{
-				return m_LoadState == LoadState::Okay;
+				for (unsigned int s = 0; s < 3; ++s)
+				{
+					l_Streams.push_back(s);
+					l_Records.push_back(Something{ s, i, 0 });
+				}
 			}
+			return p_Log.WriteMany(l_Streams.data(), l_Records.data(), static_cast<unsigned int>(l_Records.size()));
+		});
 
-			const bool Closing() const noexcept
+		bool l_Passed(true);
+		{
+			MultiplexedLog<Something> l_Log(l_Filename, std::chrono::hours(1));
+			l_Passed &= Expect(l_Log.Valid() && l_Write(l_Log, 0, 100) && l_Matches(l_Log, 100), "Multiplexed Physical Read");
+			l_Passed &= Expect(l_Log.Materialize() && l_Write(l_Log, 100, 50) && l_Matches(l_Log, 150), "Multiplexed View Read");
+		}
+		{
+			MultiplexedLog<Something> l_Log(l_Filename, std::chrono::hours(1));
+			l_Passed &= Expect(l_Log.Valid() && l_Matches(l_Log, 150), "Multiplexed Reopen");
+		}
+		return l_Passed;
+	}
+
+	// Type bitmaps follow a log of mixed records across a reopen
+	const bool TestTypeBitmaps()
+	{
+		using Record = TaggedRecord<Something, Reading>;
+		const std::string l_Filename("behaviour_tagged.log");
+		const std::string l_TypesFilename("behaviour_tagged.types");
+		std::remove(l_Filename.c_str());
+		std::remove(l_TypesFilename.c_str());
+
+		{
+			CumulativeWriter<Record> l_Log(l_Filename);
+			TypeBitmaps<Something, Reading> l_Types(l_Log, l_TypesFilename, 4);
+			for (unsigned int i = 0; i < 20; ++i)
 			{
-				return m_Status == Status::Closing || m_Status == Status::Closed;
+				const Record l_Record(i % 5 == 0 ? Record::Make(Reading{ i, 1.5f }) : Record::Make(Something{ i, 0, 0 }));
+				l_Log.Write(&l_Record);
 			}
+		}
 
-			void Close() noexcept
-			{
-				m_Status = Status::Closing;
+		CumulativeWriter<Record> l_Log(l_Filename);
+		TypeBitmaps<Something, Reading> l_Types(l_Log, l_TypesFilename, 4);
+		const Record l_Record(Record::Make(Reading{ 20, 2.5f }));
+		l_Log.Write(&l_Record);
+
+		std::vector<Reading> l_Readings;
+		std::vector<unsigned int> l_Indices;
+		return Expect(
+			l_Types.Scan<Reading>(0, 21, l_Readings, &l_Indices) == ScanStatus::Okay &&
+				l_Readings.size() == 5 &&
+				l_Indices.back() == 20,
+			"Type Bitmaps Scan");
+	}
+
+	// A commit group with a damaged entry is dropped whole at open
+	const bool TestTransactionRecovery()
+	{
+		using Log = TransactionLog<Something>;
+		const std::string l_Filename("behaviour_txn.log");
+		std::remove(l_Filename.c_str());
 
-				std::lock_guard<std::mutex> l_Lock(m_Lock);
-				if (FileStreamValid())
+		bool l_Passed(true);
+		{
+			Log l_Log(l_Filename);
+			for (unsigned int i = 0; i < 3; ++i)
+			{
+				auto l_Txn(l_Log.BeginTxn());
+				for (unsigned int j = 0; j < 5; ++j)
 				{
-					try
-					{
-#ifdef _WIN32
-						CloseHandle(m_FileStream);
-						m_FileStream = INVALID_HANDLE_VALUE;
-#else
-						m_FileStream->close();
-						m_FileStream = nullptr;
-#endif
-					}
-					catch (const std::exception&)
-					{
-					}
+					l_Txn.Append(Something{ i, j, 0 });
 				}
+				l_Passed &= Expect(l_Txn.Commit(), "Txn Commit");
+			}
+		}
+		{
+			// Zero an entry inside the last group
+			Log::Entry l_Zero;
+			std::memset(&l_Zero, 0, sizeof(l_Zero));
+			std::fstream l_File(l_Filename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			l_File.seekp(sizeof(Log::Entry) * 14);
+			l_File.write(reinterpret_cast<const char*>(&l_Zero), sizeof(l_Zero));
+		}
+		{
+			Log l_Log(l_Filename);
+			l_Passed &= Expect(l_Log.Recovery() == Log::RecoveryState::Okay, "Txn Recovery");
+			l_Passed &= Expect(l_Log.RecordCount() == 12 && l_Log.DiscardedAtLoad() == 6, "Txn Damaged Group Dropped");
+
+			auto l_Txn(l_Log.BeginTxn());
+			l_Txn.Append(Something{ 9, 9, 9 });
+			l_Passed &= Expect(l_Txn.Commit() && l_Txn.Id() == 3, "Txn Commit After Recovery");
+		}
+		return l_Passed;
+	}
+
+	// A commit that died after writing its intents is rolled back on the next open
+	const bool TestCommitRecovery()
+	{
+		const std::string l_Intents("behaviour_commit.intents");
+		const std::string l_FirstLog("behaviour_commit_a.log");
+		const std::string l_SecondLog("behaviour_commit_b.log");
+		std::remove(l_Intents.c_str());
+		std::remove(l_FirstLog.c_str());
+		std::remove(l_SecondLog.c_str());
+
+		bool l_Passed(true);
+		Something l_Records[3]{ { 1, 1, 1 }, { 2, 2, 2 }, { 3, 3, 3 } };
+		{
+			CommitCoordinator l_Coordinator(l_Intents, { l_FirstLog, l_SecondLog });
+			CumulativeWriter<Something> l_First(l_FirstLog);
+			CumulativeWriter<Something> l_Second(l_SecondLog);
+			auto l_Batch(l_Coordinator.Begin());
+			l_Batch.Append(0, l_First, l_Records, 1);
+			l_Batch.Append(1, l_Second, l_Records, 3);
+			l_Passed &= Expect(l_Batch.Commit(), "Cross Log Commit");
+
+			// Both appends prepared, only the first made before the crash
+			CumulativeWriter<CommitCoordinator::Intent> l_Log(l_Intents);
+			const CommitCoordinator::Intent l_PrepareFirst{ CommitCoordinator::c_PrepareKind, 0, 99, sizeof(Something), sizeof(Something) };
+			const CommitCoordinator::Intent l_PrepareSecond{ CommitCoordinator::c_PrepareKind, 1, 99, sizeof(Something) * 3, sizeof(Something) };
+			l_Log.Write(&l_PrepareFirst);
+			l_Log.Write(&l_PrepareSecond);
+			l_First.Write(&l_Records[0]);
+		}
+		{
+			CommitCoordinator l_Coordinator(l_Intents, { l_FirstLog, l_SecondLog });
+			l_Passed &= Expect(l_Coordinator.Recovery() == CommitCoordinator::RecoveryState::RolledBack, "Cross Log Recovery");
+
+			CumulativeWriter<Something> l_First(l_FirstLog);
+			CumulativeWriter<Something> l_Second(l_SecondLog);
+			l_Passed &= Expect(l_First.RecordCount() == 1 && l_Second.RecordCount() == 3, "Cross Log Rolled Back");
+
+			auto l_Batch(l_Coordinator.Begin());
+			l_Batch.Append(0, l_First, l_Records, 2);
+			l_Passed &= Expect(l_Batch.Commit() && l_First.RecordCount() == 3, "Cross Log Commit After Recovery");
+		}
+		return l_Passed;
+	}
+
+	// Retried writes are dropped, partly landed batches only append the
+	// rest, and the marks survive a reopen with or without the checkpoint
+	const bool TestIdempotentWriter()
+	{
+		using Writer = IdempotentWriter<Something>;
+		const std::string l_Filename("behaviour_idempotent.log");
+		const std::string l_CheckpointFilename("behaviour_idempotent.hwm");
+		std::remove(l_Filename.c_str());
+		std::remove(l_CheckpointFilename.c_str());
 
-				m_Status = Status::Closed;
+		bool l_Passed(true);
+		{
+			Writer l_Writer(l_Filename, l_CheckpointFilename, 3);
+			std::vector<Something> l_Records;
+			for (unsigned int i = 1; i <= 8; ++i)
+			{
+				l_Records.push_back(Something{ 7, i, 0 });
+			}
+			bool l_Written(true);
+			for (unsigned int i = 0; i < 5; ++i)
+			{
+				l_Written = l_Written && l_Writer.Write(7, i + 1, &l_Records[i]) == Writer::WriteStatus::Okay;
+			}
+			l_Passed &= Expect(
+				l_Written &&
+					l_Writer.Write(7, 3, &l_Records[2]) == Writer::WriteStatus::Duplicate &&
+					l_Writer.WriteRecords(7, 4, &l_Records[3], 5) == Writer::WriteStatus::Okay &&
+					l_Writer.Write(&l_Records[0]) == Writer::WriteStatus::Okay &&
+					l_Writer.Write(&l_Records[0]) == Writer::WriteStatus::Okay,
+				"Idempotent Writes");
+
+			std::vector<Writer::ProducedRecord> l_Stored(10);
+			bool l_Matched(l_Writer.Underlying().ReadRecords(0, 10, l_Stored.data()) == Writer::Writer::RecordReadStatus::Okay);
+			for (unsigned int i = 0; l_Matched && i < 8; ++i)
+			{
+				l_Matched = l_Stored[i].m_Producer == 7 && l_Stored[i].m_Sequence == i + 1 && l_Stored[i].m_Record.Y == i + 1;
 			}
+			l_Passed &= Expect(l_Matched && l_Writer.Underlying().RecordCount() == 10 && l_Stored[9].m_Producer == 0, "Idempotent Records");
+		}
 
-#ifdef _WIN32
-			static void WINAPI CompletionRoutine(DWORD u32_ErrorCode, DWORD u32_BytesTransfered, OVERLAPPED* pk_Overlapped)
+		for (unsigned int l_Pass = 0; l_Pass < 2; ++l_Pass)
+		{
+			if (l_Pass == 1)
 			{
-				// Purposefully empty function
+				std::remove(l_CheckpointFilename.c_str());
 			}
-#endif
+			Writer l_Writer(l_Filename, l_CheckpointFilename, 3);
+			const Something l_Record{ 7, 8, 0 };
+			l_Passed &= Expect(
+				l_Writer.HighWaterMark(7) == 8 &&
+					l_Writer.ProducerCount() == 1 &&
+					l_Writer.Write(7, 8, &l_Record) == Writer::WriteStatus::Duplicate,
+				"Idempotent Reopen");
+		}
+		return l_Passed;
+	}
 
-			const bool Write(const T* p_Record) noexcept
+	// An append behind one that never published gives up, and Recover cuts
+	// the log back to the watermark
+	const bool TestSharedAppendRecovery()
+	{
+		using Log = SharedAppendLog<Something>;
+		const std::string l_Filename("behaviour_shared.log");
+		std::remove(l_Filename.c_str());
+		std::remove((l_Filename + ".tail").c_str());
+
+		bool l_Passed(true);
+		Something l_Record{ 1, 2, 3 };
+		{
+			Log l_Log(l_Filename, false, std::chrono::milliseconds(100));
+			l_Passed &= Expect(l_Log.Write(&l_Record) == Log::AppendStatus::Okay, "Shared Append");
 			{
-				bool l_result(false);
+				// An appender that died after reserving a slot: the tail, after
+				// the state, record size, broken flag and padding, moves on
+				// while the watermark does not
+				std::fstream l_Control(l_Filename + ".tail", std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+				std::uint64_t l_Tail(0);
+				l_Control.seekg(16);
+				l_Control.read(reinterpret_cast<char*>(&l_Tail), sizeof(l_Tail));
+				++l_Tail;
+				l_Control.seekp(16);
+				l_Control.write(reinterpret_cast<const char*>(&l_Tail), sizeof(l_Tail));
+			}
+			l_Passed &= Expect(l_Log.Write(&l_Record) == Log::AppendStatus::Broken, "Shared Append Deadline");
+			l_Passed &= Expect(l_Log.Write(&l_Record) == Log::AppendStatus::Broken, "Shared Append Stays Broken");
+		}
+		l_Passed &= Expect(Log::Recover(l_Filename), "Shared Recover");
+		{
+			Log l_Log(l_Filename);
+			l_Passed &= Expect(l_Log.Valid() && l_Log.RecordCount() == 1, "Shared Recovered Count");
+			l_Passed &= Expect(l_Log.Write(&l_Record) == Log::AppendStatus::Okay && l_Log.RecordCount() == 2, "Shared Append After Recover");
+		}
+		return l_Passed;
+	}
 
-				if (!Closing())
-				{
-					std::lock_guard<std::mutex> l_Lock(m_Lock);
-					m_PrevStatus = m_Status;
+	// A new holder fences out the last and cuts off what it never acknowledged
+	const bool TestLeaseTakeOver()
+	{
+		using Leased = LeasedWriter<Something>;
+		const std::string l_Filename("behaviour_leased.log");
+		std::remove(l_Filename.c_str());
+		std::remove((l_Filename + ".lease").c_str());
+
+		bool l_Passed(true);
+		Something l_Record{ 4, 5, 6 };
+		Leased l_First(l_Filename);
+		Leased l_Second(l_Filename);
+		l_Passed &= Expect(l_First.TryAcquire() == Leased::LeaseStatus::Okay, "Lease Acquire");
+		l_Passed &= Expect(l_Second.TryAcquire() == Leased::LeaseStatus::HeldElsewhere, "Lease Exclusive");
+		for (unsigned int i = 0; i < 5; ++i)
+		{
+			l_Passed &= Expect(l_First.Write(&l_Record) == Leased::WriteStatus::Okay, "Lease Write");
+		}
+		l_Passed &= Expect(l_First.AcknowledgedRecords() == 5, "Lease Acknowledged");
+
+		l_First.Release();
+		AppendJunk(l_Filename, sizeof(Something) * 2 + 3);
+		l_Passed &= Expect(l_Second.TryAcquire() == Leased::LeaseStatus::Okay && l_Second.Epoch() == 2, "Lease Take Over");
+		l_Passed &= Expect(l_Second.Underlying()->RecordCount() == 5, "Lease Cut Back");
+		l_Passed &= Expect(l_First.Write(&l_Record) == Leased::WriteStatus::NotHeld, "Lease Released");
+		return l_Passed;
+	}
 
-					if (FileStreamValid())
-					{
-						m_Status = Status::Writing;
-						try
-						{
-#ifdef _WIN32
-							LARGE_INTEGER l_NewFilePointer;
-							if (SetFilePointerEx(
-								m_FileStream,
-								{ 0 },
-								&l_NewFilePointer,
-								FILE_END) != 0)
-							{
-								OVERLAPPED l_Overlapped{ 0 };
-								if (WriteFileEx(
-									m_FileStream,
-									p_Record,
-									c_RecordSize,
-									&l_Overlapped,
-									CompletionRoutine) != 0)
-								{
-									if (FlushFileBuffers(m_FileStream) != 0)
-									{
-										int gothere = 1;
-									}
-									++m_RecordCount;
-									m_Status = m_PrevStatus;
-									l_result = true;
-								}
-								else
-								{
-									auto l_GLE(GetLastError());
-									if (l_GLE != ERROR_IO_PENDING)
-									{
-										std::cout << GetLastErrorAsString(l_GLE).c_str() << std::endl;
-										throw std::exception("Unable to Write");
-									}
-								}
-							}
-							else
-							{
-								auto l_GLE(GetLastError());
-								if (l_GLE != ERROR_IO_PENDING)
-								{
-									std::cout << GetLastErrorAsString(l_GLE).c_str() << std::endl;
-									throw std::exception("Unable to Seek");
-								}
-							}
-#else
-							*m_FileStream << std::unitbuf;
-							m_FileStream->seekp(0, std::ios_base::end);
-							m_FileStream->write(reinterpret_cast<const char*>(p_Record), c_RecordSize);
-							m_FileStream->sync();
-							sync();
-							++m_RecordCount;
-							m_Status = m_PrevStatus;
-							l_result = true;
-#endif														
-						}
-						catch (const std::exception&)
-						{
-							m_Status = Status::ErrorWriting;
-						}
-					}
-					else
-					{
-						m_Status = Status::ErrorWritingStreamNotReady;
-					}
-				}
+	// Bulk, Default and Critical writes all land in write order, with or
+	// without a scheduler, and are all on disk once WaitForFlush returns
+	const bool TestDurabilityClasses()
+	{
+		using Writer = CumulativeWriter<Something>;
+		const std::string l_Filename("behaviour_durability.log");
+		const std::string l_ScheduledFilename("behaviour_durability_scheduled.log");
+		std::remove(l_Filename.c_str());
+		std::remove(l_ScheduledFilename.c_str());
 
-				return l_result;
+		bool l_Passed(true);
+		{
+			FlushScheduler l_Scheduler(std::chrono::milliseconds(0), 2);
+			Writer l_Log(l_Filename);
+			Writer l_Scheduled(l_ScheduledFilename);
+			l_Scheduled.UseFlushScheduler(l_Scheduler);
+			for (Writer* l_Writer : { &l_Log, &l_Scheduled })
+			{
+				for (unsigned int i = 0; i < 10; ++i)
+				{
+					Something l_Record{ i, 0, 0 };
+					l_Writer->Write(&l_Record, Writer::Durability::Bulk);
+				}
+				Something l_Plain{ 10, 0, 0 };
+				l_Writer->Write(&l_Plain);
+				const Something l_Batch[3]{ { 11, 0, 0 }, { 12, 0, 0 }, { 13, 0, 0 } };
+				l_Writer->WriteRecords(l_Batch, 3, Writer::Durability::Bulk);
+				Something l_Critical{ 14, 0, 0 };
+				l_Passed &= Expect(l_Writer->Write(&l_Critical, Writer::Durability::Critical), "Critical Write");
+				Something l_Last{ 15, 0, 0 };
+				l_Writer->Write(&l_Last, Writer::Durability::Bulk);
+				l_Passed &= Expect(l_Writer->WaitForFlush() && l_Writer->RecordCount() == 16, "Durability Flush");
 			}
-	};
+		}
 
+		for (const std::string& l_Name : { l_Filename, l_ScheduledFilename })
+		{
+			Writer l_Log(l_Name);
+			std::vector<Something> l_Records(16);
+			bool l_InOrder(l_Log.RecordCount() == 16 && l_Log.ReadRecords(0, 16, l_Records.data()) == Writer::RecordReadStatus::Okay);
+			for (unsigned int i = 0; l_InOrder && i < 16; ++i)
+			{
+				l_InOrder = l_Records[i].X == i;
+			}
+			l_Passed &= Expect(l_InOrder, "Durability Order");
+		}
+		return l_Passed;
+	}
 }
 
 
@@ -483,6 +1274,36 @@ int main()
 {
 	using namespace Bluebird;
 
+	unsigned int l_FailedTests(0);
+	l_FailedTests += TestArrowExport() ? 0 : 1;
+	l_FailedTests += TestLogMerge() ? 0 : 1;
+	l_FailedTests += TestExternalSort() ? 0 : 1;
+	l_FailedTests += TestHashIndexCatchUp() ? 0 : 1;
+	l_FailedTests += TestKeyValueView() ? 0 : 1;
+	l_FailedTests += TestBloomFilters() ? 0 : 1;
+	l_FailedTests += TestWindowAggregates() ? 0 : 1;
+	l_FailedTests += TestCheckpointRecovery() ? 0 : 1;
+	l_FailedTests += TestQuantileSketches() ? 0 : 1;
+	l_FailedTests += TestSampleByTime() ? 0 : 1;
+	l_FailedTests += TestZoneMapsNaN() ? 0 : 1;
+	l_FailedTests += TestBoolPredicate() ? 0 : 1;
+	l_FailedTests += TestColumnBatches() ? 0 : 1;
+	l_FailedTests += TestScanCursor() ? 0 : 1;
+	l_FailedTests += TestReverseReader() ? 0 : 1;
+	l_FailedTests += TestReadMany() ? 0 : 1;
+	l_FailedTests += TestSchedulerShutdown() ? 0 : 1;
+	l_FailedTests += TestFlushRetry() ? 0 : 1;
+	l_FailedTests += TestFilePool() ? 0 : 1;
+	l_FailedTests += TestMultiplexedLog() ? 0 : 1;
+	l_FailedTests += TestTypeBitmaps() ? 0 : 1;
+	l_FailedTests += TestTransactionRecovery() ? 0 : 1;
+	l_FailedTests += TestCommitRecovery() ? 0 : 1;
+	l_FailedTests += TestIdempotentWriter() ? 0 : 1;
+	l_FailedTests += TestSharedAppendRecovery() ? 0 : 1;
+	l_FailedTests += TestLeaseTakeOver() ? 0 : 1;
+	l_FailedTests += TestDurabilityClasses() ? 0 : 1;
+	std::cout << "Behaviour Tests Failed: " << l_FailedTests << std::endl;
+
 	std::srand(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count()));
 	unsigned int l_R1, l_R2, l_R3;
 